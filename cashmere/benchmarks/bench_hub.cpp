@@ -0,0 +1,83 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <benchmark/benchmark.h>
+
+#include "cashmere/brokerstore.h"
+
+#include <format>
+#include <vector>
+
+using namespace Cashmere;
+
+namespace
+{
+
+constexpr size_t kPeers = 10;
+
+BrokerStoreBasePtr store;
+BrokerBasePtr hub;
+std::vector<BrokerBasePtr> peers;
+
+// A hub with ten journals connected to it, each with an entry of its own, so
+// that every connection of the hub provides sources with clocks.
+void StartHub(const benchmark::State&)
+{
+  store = BrokerStore::create();
+  hub = store->getOrCreate("hub://ff@localhost");
+  for (size_t i = 0; i < kPeers; ++i) {
+    auto peer = store->getOrCreate(std::format("cache://{:x}@localhost", i + 1));
+    peer->connect(Connection{hub});
+    peers.push_back(peer);
+  }
+  for (const auto& peer : peers) {
+    peer->append(1);
+  }
+}
+
+void StopHub(const benchmark::State&)
+{
+  peers.clear();
+  hub.reset();
+  store.reset();
+}
+
+// Appends to one journal after the other, each forwarded by the hub to the
+// other nine.
+void BM_HubInsert(benchmark::State& state)
+{
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(peers[i++ % kPeers]->append(1));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Queries of the hub by its last peer for what it already has: the cost of
+// finding the peer to ask rather than of the entries.
+void BM_HubQuery(benchmark::State& state)
+{
+  const auto from = hub->clock();
+  const auto sender = static_cast<Source>(kPeers);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(hub->query(from, sender));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}
+
+BENCHMARK(BM_HubInsert)->Setup(StartHub)->Teardown(StopHub);
+BENCHMARK(BM_HubQuery)->Setup(StartHub)->Teardown(StopHub);
@@ -0,0 +1,391 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <benchmark/benchmark.h>
+
+#include "cashmere/brokerstore.h"
+#include "cashmere/brokerwrapper.h"
+#include "cashmere/utils/file.h"
+
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace Cashmere;
+using namespace std::chrono_literals;
+
+namespace
+{
+
+constexpr uint16_t kBasePort = 50740;
+// Entries each node appends per iteration.
+constexpr int64_t kAppends = 100;
+constexpr auto kConvergenceTimeout = 30s;
+
+enum Topology
+{
+  Chain,
+  Star,
+  Mesh
+};
+
+enum Storage
+{
+  Cache,
+  File
+};
+
+struct Traffic
+{
+  std::atomic<int64_t> messages = 0;
+  std::atomic<int64_t> entries = 0;
+
+  void reset()
+  {
+    messages = 0;
+    entries = 0;
+  }
+
+  void count(int64_t carried = 0)
+  {
+    ++messages;
+    entries += carried;
+  }
+};
+
+// One end of an in-process link between two brokers: it forwards every call
+// to its target and accounts for it. Connections only hold a weak reference
+// to their broker, so both ends are kept by the topology.
+class Link : public BrokerBase
+{
+public:
+  Link(BrokerBasePtr target, Traffic& traffic)
+    : BrokerBase(target->url())
+    , _target(target)
+    , _traffic(traffic)
+  {
+  }
+
+  // The end the target calls back through.
+  void pair(std::shared_ptr<Link> other)
+  {
+    _other = other;
+  }
+
+  std::string schema() const override
+  {
+    return _target->schema();
+  }
+
+  Connection connect(Connection conn) override
+  {
+    _traffic.count();
+    return _target->connect(Connection(
+      _other.lock(), conn.source(), conn.clock(), conn.provides()
+    ));
+  }
+
+  bool refresh(const Connection& conn, Source sender) override
+  {
+    _traffic.count();
+    return _target->refresh(conn, sender);
+  }
+
+  bool update(const Connection& changes, Source sender) override
+  {
+    _traffic.count();
+    return _target->update(changes, sender);
+  }
+
+  Clock insert(const Entry& data, Source sender = 0) override
+  {
+    _traffic.count(1);
+    return _target->insert(data, sender);
+  }
+
+  Clock insert(const EntryList& entries, Source sender = 0) override
+  {
+    _traffic.count(entries.size());
+    return _target->insert(entries, sender);
+  }
+
+  EntryList query(const Clock& from = {}, Source sender = 0) const override
+  {
+    auto entries = _target->query(from, sender);
+    _traffic.count(entries.size());
+    return entries;
+  }
+
+  bool scan(
+    const Clock& from, Source sender, const EntryVisitor& visit,
+    const Entry* after = nullptr
+  ) const override
+  {
+    _traffic.count();
+    return _target->scan(from, sender, visit, after);
+  }
+
+  Clock clock() const override
+  {
+    return _target->clock();
+  }
+
+  IdClockMap versions() const override
+  {
+    return _target->versions();
+  }
+
+  SourcesMap sources(Source sender = 0) const override
+  {
+    return _target->sources(sender);
+  }
+
+  Clock relay(const Data& entry, Source sender) override
+  {
+    _traffic.count();
+    return _target->relay(entry, sender);
+  }
+
+  std::set<Source> connectedPorts() const override
+  {
+    return _target->connectedPorts();
+  }
+
+  Source disconnect(Source source) override
+  {
+    _traffic.count();
+    return _target->disconnect(source);
+  }
+
+private:
+  BrokerBasePtr _target;
+  std::weak_ptr<Link> _other;
+  Traffic& _traffic;
+};
+
+// Journals of a topology, each one appended to by its own writer. Nodes are
+// linked in process, through Link pairs that count the messages, or with
+// gRPC stubs to the runners serving them on the loopback interface.
+class Network
+{
+public:
+  Network(Topology topology, size_t size, Storage storage, bool grpc)
+    : _store(BrokerStore::create())
+    , _wrappers(WrapperStore::create())
+    , _grpc(grpc)
+  {
+    for (size_t i = 0; i < size; ++i) {
+      _journals.push_back(_store->getOrCreate(
+        storage == File
+          ? std::format("file://{:x}@localhost{}", 0xa0 + i, _dir.directory)
+          : std::format("cache://{:x}@localhost", 0xa0 + i)
+      ));
+    }
+    _nodes = _journals;
+    if (topology == Star) {
+      _nodes.push_back(_store->getOrCreate("hub://c0@localhost"));
+    }
+    if (_grpc) {
+      serve();
+    }
+
+    for (size_t i = 0; i < size; ++i) {
+      if (topology == Chain && i + 1 < size) {
+        link(i, i + 1);
+      } else if (topology == Star) {
+        link(i, size);
+      } else if (topology == Mesh) {
+        for (size_t j = 0; j < i; ++j) {
+          link(i, j);
+        }
+      }
+    }
+  }
+
+  ~Network()
+  {
+    for (auto& runner : _runners) {
+      runner->stop();
+    }
+    for (auto& thread : _threads) {
+      thread.join();
+    }
+  }
+
+  bool valid() const
+  {
+    return _valid;
+  }
+
+  const std::vector<BrokerBasePtr>& journals() const
+  {
+    return _journals;
+  }
+
+  Traffic& traffic()
+  {
+    return _traffic;
+  }
+
+  bool converged() const
+  {
+    const auto clock = _nodes.front()->clock();
+    for (const auto& node : _nodes) {
+      if (node->clock() != clock) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  static std::string address(size_t i)
+  {
+    return std::format("grpc://127.0.0.1:{}", kBasePort + i);
+  }
+
+  void serve()
+  {
+    for (size_t i = 0; i < _nodes.size(); ++i) {
+      auto runner = _wrappers->getOrCreate(address(i));
+      if (!runner) {
+        _valid = false;
+        return;
+      }
+      _threads.push_back(runner->start(_nodes[i]));
+      _runners.push_back(runner);
+    }
+  }
+
+  void link(size_t from, size_t to)
+  {
+    if (_grpc) {
+      _valid = _valid && _nodes[from]->connect(address(to)).source() > 0;
+      return;
+    }
+    auto there = std::make_shared<Link>(_nodes[to], _traffic);
+    auto back = std::make_shared<Link>(_nodes[from], _traffic);
+    there->pair(back);
+    back->pair(there);
+    _links.push_back(there);
+    _links.push_back(back);
+    _nodes[from]->connect(Connection(there));
+  }
+
+  TempDir _dir;
+  BrokerStoreBasePtr _store;
+  WrapperStoreBasePtr _wrappers;
+  bool _grpc;
+  bool _valid = true;
+  Traffic _traffic;
+  std::vector<BrokerBasePtr> _journals;
+  std::vector<BrokerBasePtr> _nodes;
+  std::vector<BrokerBasePtr> _links;
+  std::vector<WrapperBasePtr> _runners;
+  std::vector<std::thread> _threads;
+};
+
+// Every journal appends kAppends entries from its own thread, then the
+// nodes are polled until their clocks match. The iteration time spans both,
+// the append and convergence times are reported apart, in milliseconds, and
+// so are the messages and entries sent between nodes per iteration.
+void Replicate(benchmark::State& state, bool grpc)
+{
+  using Time = std::chrono::steady_clock;
+  using Ms = std::chrono::duration<double, std::milli>;
+
+  Network network(
+    Topology(state.range(0)), state.range(1), Storage(state.range(2)), grpc
+  );
+  if (!network.valid()) {
+    state.SkipWithError("the nodes could not be linked");
+    return;
+  }
+  network.traffic().reset();
+
+  double appendMs = 0;
+  double convergenceMs = 0;
+  for (auto _ : state) {
+    const auto start = Time::now();
+    std::vector<std::thread> writers;
+    for (const auto& journal : network.journals()) {
+      writers.emplace_back([journal] {
+        for (int64_t i = 0; i < kAppends; ++i) {
+          journal->append(1);
+        }
+      });
+    }
+    for (auto& writer : writers) {
+      writer.join();
+    }
+    const auto appended = Time::now();
+
+    while (!network.converged() &&
+           Time::now() - appended < kConvergenceTimeout) {
+      std::this_thread::sleep_for(100us);
+    }
+    const auto converged = Time::now();
+    if (!network.converged()) {
+      state.SkipWithError("the nodes did not converge");
+      break;
+    }
+
+    appendMs += Ms(appended - start).count();
+    convergenceMs += Ms(converged - appended).count();
+    state.SetIterationTime(
+      std::chrono::duration<double>(converged - start).count()
+    );
+  }
+
+  const auto perIteration = benchmark::Counter::kAvgIterations;
+  state.SetItemsProcessed(
+    state.iterations() * kAppends * network.journals().size()
+  );
+  state.counters["append_ms"] = benchmark::Counter(appendMs, perIteration);
+  state.counters["convergence_ms"] =
+    benchmark::Counter(convergenceMs, perIteration);
+  if (!grpc) {
+    state.counters["messages"] =
+      benchmark::Counter(network.traffic().messages, perIteration);
+    state.counters["entries_sent"] =
+      benchmark::Counter(network.traffic().entries, perIteration);
+  }
+}
+
+void BM_Replication(benchmark::State& state)
+{
+  Replicate(state, false);
+}
+
+void BM_ReplicationGrpc(benchmark::State& state)
+{
+  Replicate(state, true);
+}
+
+void Topologies(benchmark::internal::Benchmark* benchmark)
+{
+  benchmark->ArgNames({"chain_star_mesh", "nodes", "cache_file"})
+    ->ArgsProduct({{Chain, Star, Mesh}, {3, 8}, {Cache, File}})
+    ->Unit(benchmark::kMillisecond)
+    ->UseManualTime();
+}
+
+}
+
+BENCHMARK(BM_Replication)->Apply(Topologies);
+BENCHMARK(BM_ReplicationGrpc)->Apply(Topologies);
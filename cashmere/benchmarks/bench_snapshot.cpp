@@ -0,0 +1,115 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <benchmark/benchmark.h>
+
+#include "cashmere/journalbase.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace Cashmere;
+
+namespace
+{
+
+// Journal that keeps no entries, so that the writer can append for as long as
+// the readers run.
+class DiscardingJournal : public JournalBase
+{
+public:
+  using JournalBase::JournalBase;
+
+  bool save(const Entry&) override
+  {
+    return true;
+  }
+
+  Data entry(Clock) const override
+  {
+    return {0, 0, {}};
+  }
+
+  EntryList entries() const override
+  {
+    return {};
+  }
+
+  std::string schema() const override
+  {
+    return "discarding";
+  }
+};
+
+BrokerPtr journal;
+BrokerPtr peer;
+std::atomic<bool> writing;
+std::thread writer;
+
+// A journal connected to a peer, taking appends from a writer thread for the
+// whole duration of the benchmark.
+void StartWriter(const benchmark::State&)
+{
+  journal = std::make_shared<DiscardingJournal>("discarding://aa@localhost");
+  peer = std::make_shared<DiscardingJournal>("discarding://bb@localhost");
+  journal->connect(Connection{peer});
+  writing = true;
+  writer = std::thread([] {
+    while (writing) {
+      journal->append(1);
+    }
+  });
+}
+
+void StopWriter(const benchmark::State&)
+{
+  writing = false;
+  writer.join();
+  journal.reset();
+  peer.reset();
+}
+
+void BM_ReadSnapshot(benchmark::State& state)
+{
+  for (auto _ : state) {
+    const auto snapshot = journal->snapshot();
+    benchmark::DoNotOptimize(snapshot->clock.size() + snapshot->sources.size());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ReadClockAndSources(benchmark::State& state)
+{
+  for (auto _ : state) {
+    const auto clock = journal->clock();
+    const auto sources = journal->sources();
+    benchmark::DoNotOptimize(clock.size() + sources.size());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}
+
+BENCHMARK(BM_ReadSnapshot)
+  ->Setup(StartWriter)
+  ->Teardown(StopWriter)
+  ->ThreadRange(1, 4)
+  ->UseRealTime();
+
+BENCHMARK(BM_ReadClockAndSources)
+  ->Setup(StartWriter)
+  ->Teardown(StopWriter)
+  ->ThreadRange(1, 4)
+  ->UseRealTime();
@@ -0,0 +1,140 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <benchmark/benchmark.h>
+
+#include "cashmere/journalbase.h"
+
+#include <format>
+#include <vector>
+
+using namespace Cashmere;
+
+namespace
+{
+
+struct Traffic
+{
+  int64_t messages = 0;
+  int64_t tuples = 0;
+};
+
+Traffic traffic;
+
+// In-memory journal that accounts for every topology message it receives.
+class CountingJournal : public JournalBase
+{
+public:
+  using JournalBase::JournalBase;
+
+  bool save(const Entry& data) override
+  {
+    return _entries.emplace(data.clock, data.entry).second;
+  }
+
+  Data entry(Clock time) const override
+  {
+    const auto it = _entries.find(time);
+    return it == _entries.cend() ? Data{0, 0, {}} : it->second;
+  }
+
+  EntryList entries() const override
+  {
+    EntryList list;
+    for (const auto& [clock, entry] : _entries) {
+      list.push_back({clock, entry});
+    }
+    return list;
+  }
+
+  std::string schema() const override
+  {
+    return "counting";
+  }
+
+  bool refresh(const Connection& conn, Source source) override
+  {
+    ++traffic.messages;
+    traffic.tuples += conn.provides().size();
+    return JournalBase::refresh(conn, source);
+  }
+
+  bool update(const Connection& changes, Source source) override
+  {
+    ++traffic.messages;
+    traffic.tuples += changes.provides().size();
+    return JournalBase::update(changes, source);
+  }
+
+private:
+  ClockDataMap _entries;
+};
+
+BrokerPtr makeJournal(size_t i)
+{
+  return std::make_shared<CountingJournal>(
+    std::format("counting://{:x}@localhost", 0x100 + i)
+  );
+}
+
+std::vector<BrokerPtr> makeMesh(size_t size)
+{
+  std::vector<BrokerPtr> mesh;
+  for (size_t i = 0; i < size; ++i) {
+    mesh.push_back(makeJournal(i));
+    for (size_t j = 0; j < i; ++j) {
+      mesh[i]->connect(Connection{mesh[j]});
+    }
+  }
+  return mesh;
+}
+
+// A topology change is a new node joining a fully connected mesh through a
+// single peer and leaving it again. The counters report the topology
+// messages, and the (id, distance, clock) tuples they carry, per change.
+void BM_MeshTopologyChange(benchmark::State& state)
+{
+  const auto size = static_cast<size_t>(state.range(0));
+
+  Traffic changes;
+  for (auto _ : state) {
+    state.PauseTiming();
+    const auto mesh = makeMesh(size);
+    const auto joining = makeJournal(size);
+    traffic = {};
+    state.ResumeTiming();
+
+    const auto conn = joining->connect(Connection{mesh.front()});
+    joining->disconnect(conn.source());
+
+    state.PauseTiming();
+    changes.messages += traffic.messages;
+    changes.tuples += traffic.tuples;
+    state.ResumeTiming();
+  }
+
+  state.counters["messages"] =
+    benchmark::Counter(changes.messages, benchmark::Counter::kAvgIterations);
+  state.counters["tuples"] =
+    benchmark::Counter(changes.tuples, benchmark::Counter::kAvgIterations);
+}
+
+}
+
+BENCHMARK(BM_MeshTopologyChange)
+  ->ArgName("nodes")
+  ->Arg(5)
+  ->Arg(20)
+  ->Unit(benchmark::kMillisecond);
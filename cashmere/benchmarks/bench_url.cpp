@@ -0,0 +1,95 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <benchmark/benchmark.h>
+
+#include "cashmere/brokerstore.h"
+#include "cashmere/utils/url.h"
+
+#include <array>
+#include <regex>
+#include <string>
+
+using namespace Cashmere;
+
+namespace
+{
+
+const std::array<std::string, 4> kUrls = {
+  "hub://aa@localhost",
+  "file://bb@localhost/tmp/cashmere.journal",
+  "grpc://10.0.0.2:5000?inflight=16&replicate=64&deadline_ms=500",
+  "cache://cc@localhost?flush_ms=2",
+};
+
+// ParseUrl as it was before it was written by hand, for comparison.
+Url ParseUrlWithRegex(const std::string& url)
+{
+  auto regex = std::regex(
+    "([^:]*):/{2}(([^/][^@]*)@){0,1}([^/?]*){0,1}(/[^?]*){0,1}(\\?(.*)){0,1}"
+  );
+  std::smatch matches;
+  std::regex_search(url, matches, regex);
+  if (matches.size() > 7) {
+    return {url, matches[1], matches[3], matches[4], matches[5], matches[7]};
+  }
+  return {url, "", "", "", "", ""};
+}
+
+void BM_ParseUrlWithRegex(benchmark::State& state)
+{
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ParseUrlWithRegex(kUrls[i++ % kUrls.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_ParseUrl(benchmark::State& state)
+{
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(ParseUrl(kUrls[i++ % kUrls.size()]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_UrlKey(benchmark::State& state)
+{
+  const auto url = ParseUrl(kUrls[2]);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(url.key());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+// Lookup of a broker the store already has, as done for every connection.
+void BM_GetExistingBroker(benchmark::State& state)
+{
+  static auto store = BrokerStore::create();
+  const std::string url = "hub://aa@localhost?a=1";
+  store->getOrCreate(url);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(store->getOrCreate(url));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}
+
+BENCHMARK(BM_ParseUrlWithRegex);
+BENCHMARK(BM_ParseUrl);
+BENCHMARK(BM_UrlKey);
+BENCHMARK(BM_GetExistingBroker)->ThreadRange(1, 8)->UseRealTime();
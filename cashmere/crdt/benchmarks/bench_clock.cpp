@@ -0,0 +1,102 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <benchmark/benchmark.h>
+
+#include "cashmere/clock.h"
+#include "history.h"
+
+#include <sstream>
+
+using namespace Cashmere;
+
+namespace
+{
+
+// Two clocks of the same pool, each with times the other has not seen.
+void BM_ClockMerge(benchmark::State& state)
+{
+  History history(state.range(0));
+  const auto a = history.clock();
+  const auto b = history.clock();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(a.merge(b));
+  }
+}
+
+void BM_ClockTick(benchmark::State& state)
+{
+  History history(state.range(0));
+  const auto clock = history.clock();
+  const auto id = history.ids().back();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(clock.tick(id));
+  }
+}
+
+// A clock and its next tick, which compares every time of both.
+void BM_ClockSmallerThan(benchmark::State& state)
+{
+  History history(state.range(0));
+  const auto clock = history.clock();
+  const auto next = clock.tick(history.ids().back());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(clock.smallerThan(next));
+  }
+}
+
+// Two ticks of the same clock by different devices.
+void BM_ClockConcurrent(benchmark::State& state)
+{
+  History history(state.range(0));
+  const auto clock = history.clock();
+  const auto a = clock.tick(history.ids().front());
+  const auto b = clock.tick(history.ids().back());
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(a.concurrent(b));
+  }
+}
+
+void BM_ClockRead(benchmark::State& state)
+{
+  History history(state.range(0));
+  const auto text = history.clock().str();
+  for (auto _ : state) {
+    std::istringstream in(text);
+    Clock clock;
+    benchmark::DoNotOptimize(Clock::Read(in, clock));
+  }
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+
+void BM_ClockWrite(benchmark::State& state)
+{
+  History history(state.range(0));
+  const auto clock = history.clock();
+  for (auto _ : state) {
+    std::ostringstream out;
+    out << clock;
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+}
+
+BENCHMARK(BM_ClockMerge)->Apply(PoolSizes);
+BENCHMARK(BM_ClockTick)->Apply(PoolSizes);
+BENCHMARK(BM_ClockSmallerThan)->Apply(PoolSizes);
+BENCHMARK(BM_ClockConcurrent)->Apply(PoolSizes);
+BENCHMARK(BM_ClockRead)->Apply(PoolSizes);
+BENCHMARK(BM_ClockWrite)->Apply(PoolSizes);
@@ -0,0 +1,62 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <benchmark/benchmark.h>
+
+#include "cashmere/entry.h"
+#include "history.h"
+
+#include <sstream>
+
+using namespace Cashmere;
+
+namespace
+{
+
+// An entry editing an earlier one, both with a clock holding the whole pool.
+Entry EditOf(History& history)
+{
+  const auto alters = history.clock();
+  const auto id = history.ids().front();
+  return {alters.tick(id), {id, 100, alters}};
+}
+
+void BM_EntryRead(benchmark::State& state)
+{
+  History history(state.range(0));
+  const auto text = EditOf(history).str();
+  for (auto _ : state) {
+    std::istringstream in(text);
+    Entry entry;
+    benchmark::DoNotOptimize(Entry::Read(in, entry));
+  }
+  state.SetBytesProcessed(state.iterations() * text.size());
+}
+
+void BM_EntryWrite(benchmark::State& state)
+{
+  History history(state.range(0));
+  const auto entry = EditOf(history);
+  for (auto _ : state) {
+    std::ostringstream out;
+    out << entry;
+    benchmark::DoNotOptimize(out);
+  }
+}
+
+}
+
+BENCHMARK(BM_EntryRead)->Apply(PoolSizes);
+BENCHMARK(BM_EntryWrite)->Apply(PoolSizes);
@@ -0,0 +1,41 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <benchmark/benchmark.h>
+
+#include "cashmere/ledger.h"
+#include "history.h"
+
+using namespace Cashmere;
+
+namespace
+{
+
+// Balance of the entries appended by a pool of the given size.
+void BM_LedgerConstruction(benchmark::State& state)
+{
+  const auto entries = History(state.range(0)).entries(state.range(1));
+  for (auto _ : state) {
+    Ledger ledger(entries);
+    benchmark::DoNotOptimize(ledger.balance());
+  }
+  state.SetItemsProcessed(state.iterations() * entries.size());
+}
+
+}
+
+BENCHMARK(BM_LedgerConstruction)
+  ->ArgNames({"devices", "entries"})
+  ->ArgsProduct({{2, 8, 64}, {256, 4096}});
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# Cashmere - a distributed conflict-free replicated database.
+# Copyright (C) 2026 Aeliton G. Silva
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU Affero General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public License
+# along with this program.  If not, see <https://www.gnu.org/licenses/>.
+"""Compares two runs of a Google Benchmark target saved as JSON.
+
+Usage: compare.py [--threshold PERCENT] [--metric cpu_time|real_time]
+                  BASELINE.json CONTENDER.json
+
+Prints the change of each benchmark found in both runs and exits with 1 if
+any of them got slower by more than the threshold. With repetitions, only
+the median of each benchmark is compared.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path, metric):
+    with open(path) as file:
+        run = json.load(file)
+    times = {}
+    medians = {}
+    for benchmark in run["benchmarks"]:
+        if benchmark.get("error_occurred"):
+            continue
+        name = benchmark.get("run_name", benchmark["name"])
+        kind = benchmark.get("aggregate_name")
+        if kind == "median":
+            medians[name] = benchmark[metric]
+        elif kind is None:
+            times.setdefault(name, benchmark[metric])
+    times.update(medians)
+    return times
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("baseline")
+    parser.add_argument("contender")
+    parser.add_argument("--threshold", type=float, default=5.0)
+    parser.add_argument(
+        "--metric", choices=["cpu_time", "real_time"], default="cpu_time"
+    )
+    args = parser.parse_args()
+
+    baseline = load(args.baseline, args.metric)
+    contender = load(args.contender, args.metric)
+
+    regressions = 0
+    width = max((len(name) for name in baseline), default=0)
+    for name, before in baseline.items():
+        if name not in contender:
+            continue
+        after = contender[name]
+        change = 100.0 * (after - before) / before if before else 0.0
+        slower = change > args.threshold
+        regressions += slower
+        print(
+            f"{name:<{width}}  {before:12.1f}  {after:12.1f}  {change:+7.1f}%"
+            + ("  SLOWER" if slower else "")
+        )
+
+    missing = sorted(set(baseline) ^ set(contender))
+    for name in missing:
+        print(f"{name}: only in one run")
+
+    if regressions:
+        print(f"{regressions} benchmarks slower by over {args.threshold}%")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,99 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef CASHMERE_BENCHMARKS_HISTORY_H
+#define CASHMERE_BENCHMARKS_HISTORY_H
+
+#include <benchmark/benchmark.h>
+
+#include "cashmere/entry.h"
+
+#include <random>
+#include <vector>
+
+namespace Cashmere
+{
+
+// Pool sizes the benchmarks run with, in devices.
+inline void PoolSizes(benchmark::internal::Benchmark* benchmark)
+{
+  benchmark->ArgName("devices")->RangeMultiplier(2)->Range(2, 64);
+}
+
+// Inputs of the benchmarks, the same on every run: they come from a fixed
+// seed rather than from Cashmere::Random.
+class History
+{
+public:
+  explicit History(size_t devices, uint64_t seed = 0x5eed)
+    : _engine(seed)
+  {
+    for (size_t i = 0; i < devices; ++i) {
+      _ids.push_back(_engine());
+    }
+    _clocks.resize(devices);
+    _entries.resize(devices);
+  }
+
+  const std::vector<Id>& ids() const
+  {
+    return _ids;
+  }
+
+  // Clock holding every device of the pool, as seen after some time of use.
+  Clock clock()
+  {
+    Clock out;
+    for (const auto id : _ids) {
+      out[id] = 1 + _engine() % 1000;
+    }
+    return out;
+  }
+
+  // Entries appended by the devices of the pool in turns at random, each one
+  // syncing with another device from time to time and editing one of its
+  // earlier entries once in a while.
+  EntryList entries(size_t count)
+  {
+    EntryList out;
+    for (size_t i = 0; i < count; ++i) {
+      const auto device = _engine() % _ids.size();
+      auto& clock = _clocks[device];
+      if (_engine() % 4 == 0) {
+        clock = clock.merge(_clocks[_engine() % _ids.size()]);
+      }
+      clock = clock.tick(_ids[device]);
+
+      Clock alters;
+      auto& own = _entries[device];
+      if (!own.empty() && _engine() % 8 == 0) {
+        alters = own[_engine() % own.size()];
+      }
+      own.push_back(clock);
+      out.push_back({clock, {_ids[device], Amount(_engine() % 10000), alters}});
+    }
+    return out;
+  }
+
+private:
+  std::mt19937_64 _engine;
+  std::vector<Id> _ids;
+  std::vector<Clock> _clocks;
+  std::vector<std::vector<Clock>> _entries;
+};
+
+}
+
+#endif
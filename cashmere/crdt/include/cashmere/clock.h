@@ -34,6 +34,8 @@ public:
   bool isNext(const Clock& other, Id id) const;
   bool smallerThan(const Clock& other) const;
   bool concurrent(const Clock& other) const;
+  // Entries this clock has seen that the other has not.
+  uint64_t ahead(const Clock& other) const;
   bool valid() const;
   std::string str() const;
 
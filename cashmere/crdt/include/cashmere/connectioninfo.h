@@ -21,6 +21,12 @@
 namespace Cashmere
 {
 
+// Marks, in incremental updates, an id that is no longer provided.
+constexpr int16_t kUnreachable = -1;
+// Ids farther than this are dropped, so that a removed id stops bouncing
+// around cycles in the topology.
+constexpr int16_t kMaxDistance = 16;
+
 struct CASHMERE_EXPORT ConnectionInfo
 {
   int16_t distance;
@@ -18,6 +18,7 @@
 
 #include <cashmere/clock.h>
 
+#include <functional>
 #include <list>
 
 namespace Cashmere
@@ -29,6 +30,8 @@ struct Entry;
 using ClockDataMap = std::map<Clock, Data>;
 using ClockEntryMap = std::map<Clock, Entry>;
 using EntryList = std::list<Entry>;
+// Called once per visited entry, returns false to stop the visit.
+using EntryVisitor = std::function<bool(const Entry&)>;
 
 struct CASHMERE_EXPORT Data
 {
@@ -61,6 +61,17 @@ bool Clock::concurrent(const Clock& other) const
   return *this != other && !smallerThan(other) && !other.smallerThan(*this);
 }
 
+uint64_t Clock::ahead(const Clock& other) const
+{
+  uint64_t count = 0;
+  for (const auto& [id, time] : *this) {
+    const auto it = other.find(id);
+    const Time known = it == other.cend() ? 0 : it->second;
+    count += time > known ? time - known : 0;
+  }
+  return count;
+}
+
 std::ostream& operator<<(std::ostream& os, const Clock& clock)
 {
   os << "{";
@@ -45,6 +45,14 @@ TEST(Clock, ClockDoesNotConcurrsWithItself)
   ASSERT_EQ(clock.concurrent(clock), false);
 }
 
+TEST(Clock, AheadCountsTheEntriesTheOtherHasNotSeen)
+{
+  const auto clock = Clock{{0xAA, 5}, {0xBB, 2}};
+  ASSERT_EQ(clock.ahead(Clock{{0xAA, 3}, {0xCC, 9}}), 4);
+  ASSERT_EQ(clock.ahead(clock), 0);
+  ASSERT_EQ(Clock{}.ahead(clock), 0);
+}
+
 TEST(Clock, ParseInvalidStrings) {}
 
 class StringTest : public ::testing::TestWithParam<std::string>
@@ -16,7 +16,11 @@
 #ifndef CASHMERE_BROKER_INTERFACE_H
 #define CASHMERE_BROKER_INTERFACE_H
 
+#include <chrono>
+#include <map>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include "cashmere/cashmere.h"
 #include "cashmere/connection.h"
@@ -28,6 +32,38 @@ namespace Cashmere
 class BrokerStoreBase;
 using BrokerStoreBasePtr = std::shared_ptr<BrokerStoreBase>;
 
+// Immutable view of the state of a broker, shared by all its readers until
+// the broker changes.
+struct CASHMERE_EXPORT BrokerState
+{
+  Clock clock;
+  SourcesMap sources;
+  IdClockMap versions;
+  // Grows with every change of the broker, zero if it does not keep count.
+  uint64_t generation = 0;
+  // When the clock of each peer in sources, by port and id, last changed.
+  // Empty if the broker does not keep track.
+  std::map<std::pair<Source, Id>, std::chrono::system_clock::time_point>
+    progress;
+};
+
+using BrokerStatePtr = std::shared_ptr<const BrokerState>;
+
+// How far the peer `id`, reached through `port`, is behind the clock() of the
+// broker: the entries it has not seen yet, and when it was last seen making
+// progress, the epoch if the broker does not keep track.
+struct CASHMERE_EXPORT PeerLag
+{
+  Source port;
+  Id id;
+  uint64_t behind;
+  std::chrono::system_clock::time_point progress;
+
+  bool operator==(const PeerLag& other) const = default;
+};
+
+using PeerLagList = std::vector<PeerLag>;
+
 class CASHMERE_EXPORT BrokerBase : public std::enable_shared_from_this<BrokerBase>
 {
   struct Impl;
@@ -41,19 +77,34 @@ public:
   virtual std::string schema() const = 0;
   virtual Connection connect(Connection conn) = 0;
   virtual bool refresh(const Connection& conn, Source sender) = 0;
+  virtual bool update(const Connection& changes, Source sender);
   virtual Clock insert(const Entry& data, Source sender = 0) = 0;
   virtual Clock insert(const EntryList& entries, Source sender = 0);
 
   virtual EntryList query(const Clock& from = {}, Source sender = 0) const = 0;
+  // Visits the entries query() returns one at a time, in a stable order,
+  // resuming after the `after` entry if given, or visiting none if there is no
+  // such entry. Returns false if the visit was stopped or failed. `visit` may
+  // be called with the broker locked, so it must not call into other brokers.
+  virtual bool scan(
+    const Clock& from, Source sender, const EntryVisitor& visit,
+    const Entry* after = nullptr
+  ) const;
   virtual Clock clock() const = 0;
   virtual IdClockMap versions() const = 0;
   virtual SourcesMap sources(Source sender = 0) const = 0;
+  virtual BrokerStatePtr snapshot() const;
+  // Lag of every peer but the broker itself, from its snapshot().
+  virtual PeerLagList lag() const;
   virtual Clock relay(const Data& entry, Source sender) = 0;
   virtual std::set<Source> connectedPorts() const = 0;
   virtual Source disconnect(Source source) = 0;
   virtual Data entry(Clock) const;
 
   virtual EntryList entries() const;
+  // Visits the stored entries in storage order, as scan() does for query().
+  virtual bool forEach(const EntryVisitor& visit, const Entry* after = nullptr)
+    const;
 
   virtual Connection stub();
   virtual Connection connect(const std::string& url);
@@ -81,6 +132,8 @@ CASHMERE_EXPORT std::ostream&
 operator<<(std::ostream& os, const IdClockMap& data);
 CASHMERE_EXPORT std::ostream&
 operator<<(std::ostream& os, const SourcesMap& data);
+CASHMERE_EXPORT std::ostream&
+operator<<(std::ostream& os, const PeerLagList& data);
 
 }
 #endif
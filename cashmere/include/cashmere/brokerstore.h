@@ -21,6 +21,7 @@
 namespace Cashmere
 {
 
+struct Url;
 class BrokerStoreBase;
 using BrokerStoreBasePtr = std::shared_ptr<BrokerStoreBase>;
 using BrokerStoreBaseWeakPtr = std::weak_ptr<BrokerStoreBase>;
@@ -34,6 +35,9 @@ public:
   virtual std::size_t size() const = 0;
 };
 
+// Creates brokers with the plugin of the schema of their url, from
+// lib/cashmere/plugins. Plugins are opened the first time a broker of their
+// schema is created, by any store of the process.
 class CASHMERE_EXPORT BrokerStore : public BrokerStoreBase {
   struct Private{ explicit Private() = default; };
   public:
@@ -45,6 +49,8 @@ class CASHMERE_EXPORT BrokerStore : public BrokerStoreBase {
 
     struct Impl;
   private:
+    BrokerBasePtr getOrCreate(const std::string& url, const Url& key);
+
     std::unique_ptr<Impl> _impl;
 };
 
@@ -35,15 +35,12 @@ using BrokerBaseWeakPtr = std::weak_ptr<BrokerBase>;
 class BrokerStoreBase;
 using BrokerStoreBasePtr = std::shared_ptr<BrokerStoreBase>;
 
+// Handle to a peer, with the clock and sources it was last known to have.
+// Copies share those until one of them changes them, so they are cheap to
+// hand around.
 class CASHMERE_EXPORT Connection
 {
 public:
-  enum class Origin
-  {
-    Cache,
-    Remote
-  };
-
   virtual ~Connection();
 
   explicit Connection();
@@ -54,14 +51,24 @@ public:
 
   Connection& connect(Connection conn);
   bool refresh(const Connection& conn) const;
+  bool update(const Connection& changes) const;
   Clock insert(const Entry& data) const;
   Clock insert(const EntryList& data) const;
 
   EntryList query(const Clock& clock = {}) const;
-  Clock& clock(Origin origin = Origin::Cache) const;
+  bool scan(
+    const Clock& clock, const EntryVisitor& visit, const Entry* after = nullptr
+  ) const;
   Clock relay(const Data& entry) const;
 
-  IdConnectionInfoMap& provides(Origin origin = Origin::Cache) const;
+  const Clock& clock() const;
+  Clock& clock();
+  const IdConnectionInfoMap& provides() const;
+  IdConnectionInfoMap& provides();
+  // Replaces the clock and sources known of the peer by the ones of the peer
+  // itself, unless it did not change since they were last fetched. Returns
+  // whether they were fetched.
+  bool fetch();
 
   void disconnect();
   bool valid() const;
@@ -76,10 +83,23 @@ public:
   operator<<(std::ostream& os, const Connection& data);
 
 private:
+  struct State
+  {
+    Clock version;
+    IdConnectionInfoMap sources;
+    // Generation of the snapshot of the peer they were fetched from, if any.
+    uint64_t generation = 0;
+  };
+
+  // Shared by the connections that know nothing of their peer yet.
+  static const std::shared_ptr<State>& EmptyState();
+
   virtual BrokerBasePtr broker() const;
+  // The state of this connection alone, copied first if shared.
+  State& state();
+
   mutable Source _source;
-  mutable Clock _version;
-  mutable IdConnectionInfoMap _sources;
+  std::shared_ptr<State> _state;
   BrokerBaseWeakPtr _broker;
 };
 
@@ -17,7 +17,15 @@
 #define CASHMERE_BROKER_H
 
 #include "cashmere/brokerbase.h"
+#include "cashmere/tracing.h"
+#include <atomic>
+#include <deque>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <unordered_map>
 #include <vector>
 
 namespace Cashmere
@@ -27,6 +35,15 @@ class Broker;
 using BrokerPtr = std::shared_ptr<Broker>;
 using BrokerWeakPtr = std::weak_ptr<Broker>;
 
+// Brokers may be called from any thread. Each one guards its connections,
+// clocks and, for journals, its storage with a single lock, which is never
+// held while calling into another broker: peers may call back, directly or
+// around a cycle, from the same or from another thread.
+//
+// Accepted entries are queued and forwarded to the peers, in the order they
+// were accepted, by whichever thread finds the queue idle; topology updates
+// are sent the same way. A call may thus return before another thread is
+// done forwarding what it queued.
 class CASHMERE_EXPORT Broker : public BrokerBase
 {
 public:
@@ -39,23 +56,86 @@ public:
   virtual Clock clock() const override;
   virtual IdClockMap versions() const override;
   virtual SourcesMap sources(Source sender = 0) const override;
+  virtual BrokerStatePtr snapshot() const override;
   virtual Clock insert(const Entry& data, Source sender = 0) override;
   virtual EntryList
   query(const Clock& from = {}, Source sender = 0) const override;
+  virtual bool scan(
+    const Clock& from, Source sender, const EntryVisitor& visit,
+    const Entry* after = nullptr
+  ) const override;
 
   Source disconnect(Source source) override;
   virtual bool refresh(const Connection& conn, Source source) override;
+  virtual bool update(const Connection& changes, Source source) override;
   virtual std::set<Source> connectedPorts() const override;
 
   Connection connect(Connection conn) override;
 
   Clock relay(const Data& entry, Source sender) override;
 
+protected:
+  using Lock = std::unique_lock<std::recursive_mutex>;
+
+  Lock lock() const;
+  Connection peer(Source port) const;
+
+  // The state as being changed, for use with the lock held. clock(),
+  // sources() and versions() return the last committed snapshot instead.
+  const Clock& currentClock() const;
+  virtual IdConnectionInfoMap provided() const;
+  void commit();
+
+  // Takes an entry into this broker and queues it to be forwarded. Called
+  // with the lock held.
+  virtual Clock accept(const Entry& data, Source sender);
+  void forward();
+
 private:
+  struct RefreshScope;
+  struct Advertised
+  {
+    Clock clock;
+    IdConnectionInfoMap provides;
+  };
+  struct Forward
+  {
+    Entry data;
+    Source sender;
+    // Span that accepted the entry, whichever thread forwards it.
+    TraceContext trace;
+  };
+
   void refreshConnections(Source ignore = 0);
+  void holdDown(const IdConnectionInfoMap& changes, Source sender);
+  // Records the clock a peer acked, for the caller to commit.
+  bool delivered(Source port, const Clock& clock);
+  void schedulePublish();
+  void publish();
+  std::optional<std::pair<Connection, Connection>>
+  advertise(Source port, IdConnectionInfoMap provides);
   void setClock(const Clock& clock);
+  SourcesMap currentSources(Source sender = 0) const;
+  void reroute(Source port, Id id, int16_t from, int16_t to);
+  void reroute(
+    Source port, const IdConnectionInfoMap& from, const IdConnectionInfoMap& to
+  );
 
+  mutable std::recursive_mutex _mutex;
+  std::atomic<BrokerStatePtr> _snapshot;
+  uint64_t _generation;
+  // Changed since the last commit().
+  bool _dirty;
   std::vector<Connection> _connections;
+  std::map<Source, Advertised> _advertised;
+  std::set<Source> _outdated;
+  std::map<Id, int16_t> _heldDown;
+  // Ports each id is reachable through, by distance.
+  std::unordered_map<Id, std::set<std::pair<int16_t, Source>>> _routes;
+  std::deque<Forward> _outbox;
+  bool _forwarding;
+  bool _publishing;
+  bool _scheduled;
 };
 
 }
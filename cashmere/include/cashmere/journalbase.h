@@ -32,17 +32,24 @@ public:
   virtual ~JournalBase();
   explicit JournalBase(const std::string& url);
 
-  SourcesMap sources(Source sender = 0) const override;
-
   Clock insert(const Entry& data, Source source = 0) override;
+  using BrokerBase::append;
+  bool append(const Data& entry) override;
   EntryList query(const Clock& from = {}, Source source = 0) const override;
+  bool scan(
+    const Clock& from, Source source, const EntryVisitor& visit,
+    const Entry* after = nullptr
+  ) const override;
   virtual Clock relay(const Data& data, Source sender) override;
 
   Id bookId() const;
 
+protected:
+  Clock accept(const Entry& data, Source source) override;
+  IdConnectionInfoMap provided() const override;
+
 private:
   const Id _bookId;
-  Clock _version;
 };
 
 using JournalPtr = std::shared_ptr<JournalBase>;
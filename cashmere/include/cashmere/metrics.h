@@ -0,0 +1,130 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef CASHMERE_METRICS_H
+#define CASHMERE_METRICS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+#include <cashmere/cashmere_export.h>
+
+namespace Cashmere
+{
+
+enum class Counter : size_t
+{
+  InsertsAccepted,
+  InsertsRejected,
+  GapFetches,
+  EntriesForwarded,
+  Refreshes,
+  TopologyMessages,
+  RelayHops,
+  RelaysDelivered,
+  Queries,
+  QueriedEntries,
+  FileWrites,
+  FileEntriesRead,
+  ReplicateFramesDropped,
+  Count
+};
+
+enum class Histogram : size_t
+{
+  SaveNs,
+  FanOut,
+  RefreshedPorts,
+  QueryNs,
+  FileWriteNs,
+  FileReadNs,
+  Count
+};
+
+// Levels raised and lowered again, e.g. the length of a queue.
+enum class Gauge : size_t
+{
+  // Entries and frames waiting to be forwarded, sent in a batch or acked.
+  ReplicationQueue,
+  Count
+};
+
+constexpr size_t kCounters = static_cast<size_t>(Counter::Count);
+constexpr size_t kHistograms = static_cast<size_t>(Histogram::Count);
+constexpr size_t kGauges = static_cast<size_t>(Gauge::Count);
+// Bucket i holds the values of i significant bits, [2^(i-1), 2^i), and the
+// last one everything above.
+constexpr size_t kHistogramBuckets = 40;
+
+struct CASHMERE_EXPORT HistogramData
+{
+  std::array<uint64_t, kHistogramBuckets> buckets = {};
+  uint64_t sum = 0;
+
+  static size_t Bucket(uint64_t value);
+  // Largest value of the bucket, the last one having none.
+  static uint64_t UpperBound(size_t bucket);
+
+  uint64_t count() const;
+  // Upper bound of the bucket holding the given fraction of the values.
+  uint64_t percentile(double fraction) const;
+};
+
+struct CASHMERE_EXPORT MetricsSnapshot
+{
+  std::array<uint64_t, kCounters> counters = {};
+  std::array<HistogramData, kHistograms> histograms = {};
+  std::array<int64_t, kGauges> gauges = {};
+
+  uint64_t operator[](Counter counter) const;
+  const HistogramData& operator[](Histogram histogram) const;
+  int64_t operator[](Gauge gauge) const;
+  // What was recorded since the given snapshot. Gauges keep their level.
+  MetricsSnapshot operator-(const MetricsSnapshot& before) const;
+};
+
+// Process-wide counters and histograms of the brokers. Each thread records
+// into its own cells, without locking nor sharing cache lines; a snapshot
+// adds up those of every thread, including the ones already gone.
+class CASHMERE_EXPORT Metrics
+{
+public:
+  static void Add(Counter counter, uint64_t value = 1);
+  static void Record(Histogram histogram, uint64_t value);
+  static void Adjust(Gauge gauge, int64_t delta);
+  static MetricsSnapshot Snapshot();
+
+  static std::string_view Name(Counter counter);
+  static std::string_view Name(Histogram histogram);
+  static std::string_view Name(Gauge gauge);
+};
+
+// Records the time it lives, in nanoseconds.
+class CASHMERE_EXPORT ScopedTimer
+{
+public:
+  explicit ScopedTimer(Histogram histogram);
+  ~ScopedTimer();
+
+private:
+  Histogram _histogram;
+  std::chrono::steady_clock::time_point _start;
+};
+
+}
+
+#endif
@@ -0,0 +1,101 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef CASHMERE_TRACING_H
+#define CASHMERE_TRACING_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <cashmere/cashmere_export.h>
+
+namespace Cashmere
+{
+
+// Trace a span belongs to and the span itself, as sent along with a call to
+// another process. Zero ids are no trace.
+struct CASHMERE_EXPORT TraceContext
+{
+  uint64_t trace = 0;
+  uint64_t span = 0;
+
+  bool valid() const;
+  // "<trace>-<span>", in hex.
+  std::string str() const;
+  static TraceContext From(const std::string& text);
+
+  bool operator==(const TraceContext& other) const = default;
+};
+
+struct CASHMERE_EXPORT SpanRecord
+{
+  const char* name;
+  TraceContext context;
+  uint64_t parent;
+  std::chrono::system_clock::time_point start;
+  std::chrono::nanoseconds duration;
+  uint32_t thread;
+  // Whether the parent ran in another thread or process, and whether the
+  // span was continued in another process.
+  bool remoteParent;
+  bool sent;
+};
+
+// Spans recorded by the process while tracing is started, none otherwise.
+// Each thread has a current span, the parent of the spans it opens next;
+// spans opened without one start a new trace.
+class CASHMERE_EXPORT Tracing
+{
+public:
+  // Starts recording, for Stop() to write the spans to `path` as a Chrome
+  // trace, viewable in chrome://tracing or Perfetto.
+  static void Start(const std::string& path = {});
+  static bool Stop();
+  static bool Enabled();
+
+  static TraceContext Current();
+  // Context of the current span, marked as continued in another process.
+  static TraceContext Propagate();
+  static std::vector<SpanRecord> Spans();
+  // Writes the spans recorded so far in the Chrome trace event format.
+  static bool Write(const std::string& path);
+};
+
+// Span lasting as long as it lives, the current one of its thread until then.
+// `name` must outlive the tracing, e.g. be a literal.
+class CASHMERE_EXPORT ScopedSpan
+{
+public:
+  explicit ScopedSpan(const char* name);
+  // Child of a span of another thread or process, e.g. the caller of an RPC.
+  ScopedSpan(const char* name, const TraceContext& parent);
+  ~ScopedSpan();
+
+  ScopedSpan(const ScopedSpan&) = delete;
+  ScopedSpan& operator=(const ScopedSpan&) = delete;
+
+private:
+  void open(const char* name, const TraceContext& parent, bool remote);
+
+  SpanRecord _record;
+  SpanRecord* _outer;
+  bool _recording;
+};
+
+}
+
+#endif
@@ -28,6 +28,8 @@ public:
   bool save(const Entry& data) override;
   Data entry(Clock time) const override;
   EntryList entries() const override;
+  bool forEach(const EntryVisitor& visit, const Entry* after = nullptr)
+    const override;
   virtual std::string schema() const override;
   static BrokerBase* create(const std::string& url);
 
@@ -36,6 +36,8 @@ public:
   bool save(const Entry& data) override;
   Data entry(Clock time) const override;
   EntryList entries() const override;
+  bool forEach(const EntryVisitor& visit, const Entry* after = nullptr)
+    const override;
 
   std::string filename() const;
   std::string schema() const override;
@@ -25,6 +25,7 @@ Journal::Journal(const std::string& url)
 
 bool Journal::save(const Entry& data)
 {
+  auto guard = lock();
   if (_entries.find(data.clock) != _entries.cend()) {
     return false;
   }
@@ -34,6 +35,7 @@ bool Journal::save(const Entry& data)
 
 Data Journal::entry(Clock time) const
 {
+  auto guard = lock();
   if (_entries.find(time) == _entries.end()) {
     return {0, 0, {}};
   }
@@ -43,12 +45,25 @@ Data Journal::entry(Clock time) const
 EntryList Journal::entries() const
 {
   EntryList list;
-  for (const auto& [clock, entry] : _entries) {
-    list.push_back({clock, entry});
-  }
+  forEach([&list](const Entry& entry) {
+    list.push_back(entry);
+    return true;
+  });
   return list;
 }
 
+bool Journal::forEach(const EntryVisitor& visit, const Entry* after) const
+{
+  auto guard = lock();
+  auto it = after ? _entries.upper_bound(after->clock) : _entries.cbegin();
+  for (; it != _entries.cend(); ++it) {
+    if (!visit({it->first, it->second})) {
+      return false;
+    }
+  }
+  return true;
+}
+
 std::string Journal::schema() const
 {
   return "cache";
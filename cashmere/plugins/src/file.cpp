@@ -14,6 +14,7 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "file.h"
+#include "cashmere/metrics.h"
 #include "cashmere/utils/file.h"
 #include <fstream>
 
@@ -29,15 +30,20 @@ JournalFile::~JournalFile() {}
 
 bool JournalFile::save(const Entry& data)
 {
+  auto guard = lock();
+  ScopedTimer timer(Histogram::FileWriteNs);
   std::ofstream file(
     Filename(location(), data.entry.id), std::ios::binary | std::ios::app
   );
   file << data << std::endl;
+  Metrics::Add(Counter::FileWrites);
   return true;
 }
 
 Data JournalFile::entry(Clock clock) const
 {
+  auto guard = lock();
+  ScopedTimer timer(Histogram::FileReadNs);
   for (const auto& [id, count] : clock) {
     std::fstream file(Filename(location(), id), std::ios::binary | std::ios::in);
     if (!SeekToLine(file, count)) {
@@ -55,17 +61,42 @@ Data JournalFile::entry(Clock clock) const
 EntryList JournalFile::entries() const
 {
   EntryList list;
-  for (const auto& [id, count] : clock()) {
+  forEach([&list](const Entry& entry) {
+    list.push_back(entry);
+    return true;
+  });
+  return list;
+}
+
+bool JournalFile::forEach(const EntryVisitor& visit, const Entry* after) const
+{
+  auto guard = lock();
+  ScopedTimer timer(Histogram::FileReadNs);
+  for (const auto& [id, count] : currentClock()) {
+    // Each file holds the entries of one id, the n-th line being its n-th.
+    size_t skip = 0;
+    if (after && id < after->entry.id) {
+      continue;
+    }
+    if (after && id == after->entry.id && after->clock.contains(id)) {
+      skip = after->clock.at(id);
+    }
     std::fstream file(Filename(location(), id), std::ios::binary | std::ios::in);
-    for (size_t i = 0; i < count; ++i) {
+    if (skip > 0 && !SeekToLine(file, skip + 1)) {
+      continue;
+    }
+    for (size_t i = skip; i < count; ++i) {
       Entry entry;
       if (Entry::Read(file, entry)) {
-        list.push_back(entry);
+        Metrics::Add(Counter::FileEntriesRead);
+        if (!visit(entry)) {
+          return false;
+        }
       }
       ReadChar(file, kLineFeed);
     }
   }
-  return list;
+  return true;
 }
 
 std::string JournalFile::filename() const
@@ -17,17 +17,43 @@
 #include "cashmere/utils/url.h"
 #include "brokerbaseimpl.h"
 
+#include <algorithm>
 #include <sstream>
 
 namespace Cashmere
 {
 
+namespace
+{
+
+// Entry following `after`, or the end of the list if `after` isn't in it, as
+// the entries it was visited in may be gone.
+EntryList::const_iterator Following(const EntryList& list, const Entry* after)
+{
+  if (!after) {
+    return list.cbegin();
+  }
+  const auto it = std::find(list.cbegin(), list.cend(), *after);
+  return it == list.cend() ? it : std::next(it);
+}
+
+bool Visit(const EntryList& list, const EntryVisitor& visit, const Entry* after)
+{
+  for (auto it = Following(list, after); it != list.cend(); ++it) {
+    if (!visit(*it)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}
+
 Connection::~Connection() = default;
 
 Connection::Connection()
   : _source(0)
-  , _version()
-  , _sources()
+  , _state(EmptyState())
   , _broker()
 {
 }
@@ -37,8 +63,11 @@ Connection::Connection(
   const IdConnectionInfoMap& sources
 )
   : _source(source)
-  , _version(version)
-  , _sources(sources)
+  , _state(
+      version.empty() && sources.empty()
+        ? EmptyState()
+        : std::make_shared<State>(version, sources)
+    )
   , _broker(broker)
 {
 }
@@ -53,6 +82,21 @@ BrokerBasePtr Connection::broker() const
   return _broker.lock();
 }
 
+const std::shared_ptr<Connection::State>& Connection::EmptyState()
+{
+  static const auto* empty =
+    new std::shared_ptr<State>(std::make_shared<State>());
+  return *empty;
+}
+
+Connection::State& Connection::state()
+{
+  if (_state.use_count() > 1) {
+    _state = std::make_shared<State>(*_state);
+  }
+  return *_state;
+}
+
 std::string Connection::url() const
 {
   return broker() ? broker()->url() : "";
@@ -63,26 +107,53 @@ Source& Connection::source() const
   return _source;
 }
 
-Clock& Connection::clock(Origin origin) const
+const Clock& Connection::clock() const
 {
-  if (origin == Origin::Remote) {
-    _version = broker()->clock();
-  }
-  return _version;
+  return _state->version;
 }
 
-IdConnectionInfoMap& Connection::provides(Origin origin) const
+Clock& Connection::clock()
 {
-  if (origin == Origin::Remote) {
-    for (auto& [port, sources] : broker()->sources(_source)) {
-      for (auto& [id, data] : sources) {
-        ++data.distance;
-        _version = _version.merge(data.clock);
-      }
-      _sources.merge(sources);
+  return state().version;
+}
+
+const IdConnectionInfoMap& Connection::provides() const
+{
+  return _state->sources;
+}
+
+IdConnectionInfoMap& Connection::provides()
+{
+  return state().sources;
+}
+
+bool Connection::fetch()
+{
+  const auto peer = broker();
+  if (!peer) {
+    return false;
+  }
+  const auto snapshot = peer->snapshot();
+  if (snapshot->generation > 0 &&
+      snapshot->generation == _state->generation) {
+    return false;
+  }
+  auto& fetched = state();
+  fetched.version = snapshot->clock;
+  IdConnectionInfoMap provided;
+  for (auto [port, sources] : snapshot->sources) {
+    if (port == _source) {
+      continue;
     }
+    for (auto& [id, data] : sources) {
+      ++data.distance;
+      fetched.version = fetched.version.merge(data.clock);
+    }
+    provided.merge(sources);
   }
-  return _sources;
+  fetched.sources.swap(provided);
+  fetched.generation = snapshot->generation;
+  return true;
 }
 
 void Connection::disconnect()
@@ -103,21 +174,12 @@ Clock Connection::insert(const Entry& data) const
   if (!clock.valid()) {
     return {};
   }
-  for (auto& [id, info] : _sources) {
-    info.clock = info.clock.merge(data.clock);
-  }
-  return _version = clock;
+  return clock;
 }
 
 Clock Connection::insert(const EntryList& data) const
 {
-  auto clock = broker()->insert(data, _source);
-  if (clock.valid()) {
-    for (auto& [id, info] : _sources) {
-      info.clock = info.clock.merge(clock);
-    }
-  }
-  return clock;
+  return broker()->insert(data, _source);
 }
 
 EntryList Connection::query(const Clock& clock) const
@@ -125,6 +187,13 @@ EntryList Connection::query(const Clock& clock) const
   return broker()->query(clock, _source);
 }
 
+bool Connection::scan(
+  const Clock& clock, const EntryVisitor& visit, const Entry* after
+) const
+{
+  return broker()->scan(clock, _source, visit, after);
+}
+
 Clock Connection::relay(const Data& entry) const
 {
   return broker()->relay(entry, _source);
@@ -146,8 +215,7 @@ Connection& Connection::connect(Connection data)
 {
   auto other = broker()->connect(data);
   _source = other._source;
-  _version = other._version;
-  _sources = other._sources;
+  _state = other._state;
   return *this;
 }
 
@@ -159,11 +227,20 @@ bool Connection::refresh(const Connection& data) const
   return false;
 }
 
+bool Connection::update(const Connection& changes) const
+{
+  if (auto source = broker()) {
+    return source->update(changes, _source);
+  }
+  return false;
+}
+
 bool Connection::operator==(const Connection& other) const
 {
   return url() == other.url() &&
-         _version == other._version &&
-         _sources == other._sources &&
+         (_state == other._state ||
+          (_state->version == other._state->version &&
+           _state->sources == other._state->sources)) &&
          _source == other._source;
 }
 
@@ -192,6 +269,40 @@ Clock BrokerBase::insert(const EntryList& entries, Source sender)
   return clock();
 }
 
+bool BrokerBase::update(const Connection&, Source)
+{
+  return false;
+}
+
+BrokerStatePtr BrokerBase::snapshot() const
+{
+  return std::make_shared<const BrokerState>(
+    BrokerState{clock(), sources(), versions()}
+  );
+}
+
+PeerLagList BrokerBase::lag() const
+{
+  const auto state = snapshot();
+  PeerLagList out;
+  for (const auto& [port, ids] : state->sources) {
+    if (port == 0) {
+      continue;
+    }
+    for (const auto& [peer, info] : ids) {
+      if (peer == id()) {
+        continue;
+      }
+      const auto seen = state->progress.find({port, peer});
+      const auto time = seen != state->progress.cend()
+        ? seen->second
+        : std::chrono::system_clock::time_point{};
+      out.push_back({port, peer, state->clock.ahead(info.clock), time});
+    }
+  }
+  return out;
+}
+
 bool BrokerBase::append(Amount value)
 {
   return append({id(), value, {}});
@@ -264,11 +375,25 @@ std::ostream& operator<<(std::ostream& os, const IdClockMap& data)
   return os << "}";
 }
 
+std::ostream& operator<<(std::ostream& os, const PeerLagList& data)
+{
+  os << "PeerLagList{";
+  for (auto it = data.cbegin(); it != data.cend(); ++it) {
+    const auto progress = std::chrono::duration_cast<std::chrono::seconds>(
+      it->progress.time_since_epoch()
+    );
+    os << (it == data.cbegin() ? "{" : ", {") << it->port << ", " << std::hex
+       << it->id << std::dec << ", " << it->behind << ", " << progress.count()
+       << "}";
+  }
+  return os << "}";
+}
+
 std::ostream& operator<<(std::ostream& os, const Connection& info)
 {
   return os << "Connection{ .url: " << (info.broker() ? info.broker()->url() : "")
-            << ", .source = " << info._source << ".version= " << info._version
-            << ", .provides = " << info._sources << "}";
+            << ", .source = " << info._source << ".version= " << info.clock()
+            << ", .provides = " << info.provides() << "}";
 }
 
 Data BrokerBase::entry(Clock) const
@@ -286,6 +411,43 @@ EntryList BrokerBase::entries() const
   return {};
 }
 
+bool BrokerBase::scan(
+  const Clock& from, Source sender, const EntryVisitor& visit,
+  const Entry* after
+) const
+{
+  const Clock clock = this->clock();
+  std::shared_ptr<const EntryList> entries;
+  EntryList::const_iterator next;
+  if (after) {
+    std::lock_guard lock(_impl->scannedMutex);
+    const auto& scanned = _impl->scanned;
+    if (scanned.entries && scanned.from == from &&
+        scanned.sender == sender && scanned.clock == clock &&
+        *std::prev(scanned.next) == *after) {
+      entries = scanned.entries;
+      next = scanned.next;
+    }
+  }
+  if (!entries) {
+    entries = std::make_shared<const EntryList>(query(from, sender));
+    next = Following(*entries, after);
+  }
+  for (; next != entries->cend(); ++next) {
+    if (!visit(*next)) {
+      std::lock_guard lock(_impl->scannedMutex);
+      _impl->scanned = {from, sender, clock, entries, std::next(next)};
+      return false;
+    }
+  }
+  return true;
+}
+
+bool BrokerBase::forEach(const EntryVisitor& visit, const Entry* after) const
+{
+  return Visit(entries(), visit, after);
+}
+
 std::string BrokerBase::location() const
 {
   return _impl->url.path;
@@ -18,7 +18,8 @@
 namespace Cashmere
 {
 
-std::unique_ptr<Random> BrokerBase::Impl::random = std::make_unique<Random>();
+thread_local std::unique_ptr<Random> BrokerBase::Impl::random =
+  std::make_unique<Random>();
 
 BrokerBase::Impl::Impl(const std::string& u)
   : url(ParseUrl(u))
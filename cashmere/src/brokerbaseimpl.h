@@ -21,10 +21,24 @@
 #include "cashmere/utils/random.h"
 #include "cashmere/utils/url.h"
 
+#include <memory>
+#include <mutex>
+
 namespace Cashmere
 {
 
 struct BrokerBase::Impl {
+  // Result of the last query scan() stopped in, and where, for the visit of
+  // its next chunk to resume there while the clock of the broker stays.
+  struct Scanned
+  {
+    Clock from;
+    Source sender = 0;
+    Clock clock;
+    std::shared_ptr<const EntryList> entries;
+    EntryList::const_iterator next;
+  };
+
   Impl(const std::string& u);
   void setStore(BrokerStoreBasePtr value);
   BrokerStoreBasePtr store();
@@ -34,7 +48,10 @@ struct BrokerBase::Impl {
   std::string hostname;
   uint16_t port;
   BrokerStoreBaseWeakPtr storePtr;
-  static std::unique_ptr<Random> random;
+  std::mutex scannedMutex;
+  Scanned scanned;
+  // Per thread, as brokers may be created by several threads at once.
+  static thread_local std::unique_ptr<Random> random;
 };
 
 }
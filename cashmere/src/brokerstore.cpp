@@ -24,30 +24,60 @@ BrokerStoreBasePtr BrokerStore::create()
 
 BrokerBasePtr BrokerStore::getOrCreate(const std::string& url)
 {
-  auto storeIt = _impl->store.find(url);
-  if (storeIt != _impl->store.end()) {
-    return storeIt->second;
+  const auto [key, known] = _impl->keyOf(url);
+  auto broker = getOrCreate(url, key);
+  if (broker && !known) {
+    _impl->remember(url, key);
+  }
+  return broker;
+}
+
+BrokerBasePtr BrokerStore::getOrCreate(const std::string& url, const Url& key)
+{
+  auto& shard = _impl->shardOf(key.url);
+  {
+    std::shared_lock lock(shard.mutex);
+    auto storeIt = shard.store.find(key.url);
+    if (storeIt != shard.store.end()) {
+      return storeIt->second;
+    }
   }
-  const Url parsed = ParseUrl(url);
-  const auto builderIt = _impl->builders.find(parsed.schema);
+  const auto builderIt = _impl->builders.find(key.schema);
   if (builderIt == _impl->builders.end()) {
     return nullptr;
   }
+  // Created with the shard locked, for a single broker of each url to exist.
+  std::unique_lock lock(shard.mutex);
+  auto storeIt = shard.store.find(key.url);
+  if (storeIt != shard.store.end()) {
+    return storeIt->second;
+  }
   auto broker = std::shared_ptr<BrokerBase>(builderIt->second(url));
+  if (!broker) {
+    return nullptr;
+  }
   broker->impl()->setStore(shared_from_this());
-  _impl->store[url] = broker;
+  shard.store[key.url] = broker;
   return broker;
 }
 
 std::size_t BrokerStore::size() const
 {
-  return _impl->store.size();
+  std::size_t size = 0;
+  for (const auto& shard : _impl->shards) {
+    std::shared_lock lock(shard.mutex);
+    size += shard.store.size();
+  }
+  return size;
 }
 
 bool BrokerStore::insert(const std::string& url, BrokerBasePtr broker)
 {
   broker->impl()->setStore(shared_from_this());
-  _impl->store[url] = broker;
+  const auto key = _impl->keyOf(url).first.url;
+  auto& shard = _impl->shardOf(key);
+  std::unique_lock lock(shard.mutex);
+  shard.store[key] = broker;
   return {};
 }
 
@@ -14,22 +14,104 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "cashmere/hub.h"
+#include "cashmere/metrics.h"
+#include "cashmere/tracing.h"
+
+#include <tuple>
+#include <utility>
 
 namespace Cashmere
 {
 
-IdConnectionInfoMap UpdateProvides(SourcesMap provides);
+struct Route
+{
+  Source port;
+  ConnectionInfo info;
+};
+
+// Shortest route to an id and, for the port it goes through, the shortest
+// one through any other port.
+struct Routes
+{
+  Route best;
+  std::optional<Route> next;
+};
+
+using RoutingTable = std::map<Id, Routes>;
+
+RoutingTable RoutesFrom(const SourcesMap& sources);
+IdConnectionInfoMap Advertisement(const RoutingTable& routes, Source port);
+IdConnectionInfoMap UpdateProvides(const SourcesMap& provides);
+IdConnectionInfoMap
+ProvidesChanges(const IdConnectionInfoMap& from, const IdConnectionInfoMap& to);
+
+namespace
+{
+// Brokers refreshed, in this thread, while another broker is publishing.
+// They publish after it, in turn, so that each one sends the topology
+// resulting from the whole change instead of every intermediate step.
+struct Cascade
+{
+  bool running = false;
+  std::deque<std::weak_ptr<BrokerBase>> pending;
+  std::vector<std::weak_ptr<BrokerBase>> holding;
+};
+
+thread_local Cascade cascade;
+thread_local std::multiset<const Broker*> scopes;
+}
+
+// Topology changes made while a scope is alive are sent to the peers once,
+// when the outermost scope of the broker in this thread ends.
+struct Broker::RefreshScope
+{
+  explicit RefreshScope(Broker& broker)
+    : broker(broker)
+  {
+    scopes.insert(&broker);
+  }
+  ~RefreshScope()
+  {
+    scopes.erase(scopes.find(&broker));
+    if (!scopes.contains(&broker)) {
+      broker.schedulePublish();
+    }
+  }
+  Broker& broker;
+};
 
 Broker::Broker(const std::string& url)
   : BrokerBase(url)
+  , _generation(0)
+  , _dirty(false)
+  , _forwarding(false)
+  , _publishing(false)
+  , _scheduled(false)
 {
   _connections.push_back(Connection{});
+  commit();
 }
 
 Broker::~Broker() = default;
 
+Broker::Lock Broker::lock() const
+{
+  return Lock(_mutex);
+}
+
+Connection Broker::peer(Source port) const
+{
+  auto guard = lock();
+  if (port >= _connections.size()) {
+    return Connection{};
+  }
+  return _connections.at(port);
+}
+
 Connection Broker::connect(Connection conn)
 {
+  RefreshScope scope(*this);
+  auto guard = lock();
   Connection out(stub());
 
   if (conn.source() == 0) {
@@ -38,53 +120,112 @@ Connection Broker::connect(Connection conn)
       return out;
     }
 
-    out.source() = _connections.size();
+    const Source port = _connections.size();
+    out.source() = port;
     _connections.push_back(conn);
-
-    auto& conn = _connections.at(out.source());
+    reroute(port, {}, conn.provides());
 
     auto data = stub();
-    data.source() = out.source();
-    data.clock() = clock();
-    data.provides() = UpdateProvides(sources(out.source()));
+    data.source() = port;
+    data.clock() = currentClock();
+    data.provides() = UpdateProvides(currentSources(port));
+    _advertised[port] = {data.clock(), data.provides()};
+    commit();
+    guard.unlock();
+
     conn.connect(data);
 
-    auto thisEntries = query(conn.clock(), out.source());
+    guard.lock();
+    auto& stored = _connections.at(port);
+    stored.source() = conn.source();
+    stored.clock() = conn.clock();
+    reroute(port, stored.provides(), conn.provides());
+    stored.provides() = conn.provides();
+    commit();
+    guard.unlock();
+
+    auto thisEntries = query(conn.clock(), port);
     auto brokerEntries = conn.query(clock());
 
     if (brokerEntries.size() > 0) {
-      BrokerBase::insert(brokerEntries, out.source());
+      BrokerBase::insert(brokerEntries, port);
     }
     if (thisEntries.size() > 0) {
-      conn.insert(thisEntries);
+      const auto version = conn.insert(thisEntries);
+      guard.lock();
+      delivered(port, version);
+      commit();
+      guard.unlock();
     }
 
-    refreshConnections(out.source());
+    guard.lock();
+    refreshConnections(port);
   } else {
     out.source() = _connections.size();
 
-    auto version = clock();
+    auto version = currentClock();
     for (auto& [id, info] : conn.provides()) {
       info.clock = info.clock.merge(version);
     }
 
     _connections.push_back(conn);
+    reroute(out.source(), {}, conn.provides());
     refreshConnections(out.source());
     out.clock() = version;
-    out.provides() = UpdateProvides(sources(out.source()));
+    out.provides() = UpdateProvides(currentSources(out.source()));
+    _advertised[out.source()] = {out.clock(), out.provides()};
+    commit();
   }
   return out;
 }
 
 bool Broker::refresh(const Connection& data, Source sender)
 {
+  RefreshScope scope(*this);
+  auto guard = lock();
   if (sender <= 0 || static_cast<size_t>(sender) >= _connections.size()) {
     return false;
   }
 
+  holdDown(
+    ProvidesChanges(_connections[sender].provides(), data.provides()), sender
+  );
   _connections[sender].source() = data.source();
   _connections[sender].clock() = data.clock();
+  reroute(sender, _connections[sender].provides(), data.provides());
   _connections[sender].provides() = data.provides();
+  commit();
+
+  refreshConnections(sender);
+  return true;
+}
+
+bool Broker::update(const Connection& changes, Source sender)
+{
+  RefreshScope scope(*this);
+  auto guard = lock();
+  if (sender <= 0 || static_cast<size_t>(sender) >= _connections.size()) {
+    return false;
+  }
+
+  holdDown(changes.provides(), sender);
+  auto& conn = _connections[sender];
+  conn.source() = changes.source();
+  conn.clock() = changes.clock();
+  for (const auto& [id, info] : changes.provides()) {
+    const auto it = conn.provides().find(id);
+    if (it == conn.provides().end()) {
+      reroute(sender, id, kUnreachable, info.distance);
+    } else {
+      reroute(sender, id, it->second.distance, info.distance);
+    }
+    if (info.distance == kUnreachable) {
+      conn.provides().erase(id);
+    } else {
+      conn.provides()[id] = info;
+    }
+  }
+  commit();
 
   refreshConnections(sender);
   return true;
@@ -92,84 +233,235 @@ bool Broker::refresh(const Connection& data, Source sender)
 
 Clock Broker::insert(const Entry& data, Source source)
 {
-  if (source < 0 || static_cast<size_t>(source) >= _connections.size()) {
+  auto guard = lock();
+  const auto clock = accept(data, source);
+  guard.unlock();
+
+  forward();
+  return clock;
+}
+
+Clock Broker::accept(const Entry& data, Source source)
+{
+  if (source >= _connections.size()) {
+    Metrics::Add(Counter::InsertsRejected);
     return Clock{{0, 0}};
   }
 
-  setClock(clock().merge(data.clock));
+  setClock(currentClock().merge(data.clock));
   auto& conn = _connections.at(source);
-  conn.provides()[data.entry.id].clock = clock();
+  const auto [it, inserted] =
+    conn.provides().try_emplace(data.entry.id, ConnectionInfo{0, {}});
+  if (inserted) {
+    reroute(source, data.entry.id, kUnreachable, 0);
+  }
+  it->second.clock = currentClock();
+  _dirty = true;
 
-  for (size_t i = 0; i < _connections.size(); ++i) {
-    if (i == static_cast<size_t>(source)) {
-      continue;
+  _outbox.push_back({data, source, Tracing::Current()});
+  Metrics::Adjust(Gauge::ReplicationQueue, 1);
+  Metrics::Add(Counter::InsertsAccepted);
+  return currentClock();
+}
+
+// The entries accepted while the queue is drained and their deliveries are
+// committed in a single snapshot once it is empty. Callers finding another
+// thread draining it commit what they accepted themselves.
+void Broker::forward()
+{
+  auto guard = lock();
+  if (_forwarding) {
+    if (_dirty) {
+      commit();
+    }
+    return;
+  }
+  _forwarding = true;
+  while (!_outbox.empty()) {
+    const auto next = std::move(_outbox.front());
+    _outbox.pop_front();
+    Metrics::Adjust(Gauge::ReplicationQueue, -1);
+
+    std::vector<std::pair<Source, Connection>> peers;
+    for (size_t i = 1; i < _connections.size(); ++i) {
+      if (i != static_cast<size_t>(next.sender) && _connections[i].valid()) {
+        peers.emplace_back(i, _connections[i]);
+      }
     }
-    auto& ctx = _connections[i];
-    ctx.insert(data);
+    guard.unlock();
+    Metrics::Record(Histogram::FanOut, peers.size());
+    Metrics::Add(Counter::EntriesForwarded, peers.size());
+
+    ScopedSpan fanOut("broker.fanout", next.trace);
+    for (const auto& [port, peer] : peers) {
+      ScopedSpan send("broker.send");
+      const auto version = peer.insert(next.data);
+      if (version.valid()) {
+        guard.lock();
+        _dirty |= delivered(port, version);
+        guard.unlock();
+      }
+    }
+    guard.lock();
+  }
+  _forwarding = false;
+  if (_dirty) {
+    commit();
   }
-  return clock();
+}
+
+// Peers are only known to hold what they acked, which may leave out the entry
+// just sent to them, e.g. when their stub batches it.
+bool Broker::delivered(Source port, const Clock& clock)
+{
+  auto& conn = _connections.at(port);
+  // Peers that could not be reached return an empty clock.
+  if (!conn.valid() || clock.empty() || !clock.valid()) {
+    return false;
+  }
+  conn.clock() = clock;
+  for (auto& [id, info] : conn.provides()) {
+    info.clock = info.clock.merge(clock);
+  }
+  return true;
 }
 
 SourcesMap Broker::sources(Source sender) const
+{
+  auto out = snapshot()->sources;
+  if (sender > 0) {
+    out.erase(sender);
+  }
+  return out;
+}
+
+SourcesMap Broker::currentSources(Source sender) const
 {
   SourcesMap out;
-  for (size_t i = 0; i < _connections.size(); i++) {
-    if (i > 0 && i == static_cast<size_t>(sender)) {
+  if (auto self = provided(); !self.empty()) {
+    out[0] = std::move(self);
+  }
+  for (size_t i = 1; i < _connections.size(); i++) {
+    if (i == static_cast<size_t>(sender)) {
       continue;
     }
     const auto& conn = _connections[i];
-    if (!conn.valid()) {
-      continue;
-    }
-    const auto& sources = conn.provides();
-    if (sources.empty()) {
+    if (!conn.valid() || conn.provides().empty()) {
       continue;
     }
-    out[i] = _connections[i].provides();
+    out[i] = conn.provides();
   }
   return out;
 }
 
+IdConnectionInfoMap Broker::provided() const
+{
+  return {};
+}
+
+BrokerStatePtr Broker::snapshot() const
+{
+  return _snapshot.load(std::memory_order_acquire);
+}
+
+void Broker::commit()
+{
+  _dirty = false;
+  const auto previous = snapshot();
+  const auto now = std::chrono::system_clock::now();
+  auto state = std::make_shared<BrokerState>();
+  state->generation = ++_generation;
+  state->clock = currentClock();
+  state->sources = currentSources();
+  for (const auto& conn : _connections) {
+    for (const auto& [id, data] : conn.provides()) {
+      state->versions[id] = state->versions[id].merge(data.clock);
+    }
+  }
+  // Peers keep the time of the previous snapshot while their clock stays.
+  for (const auto& [port, ids] : state->sources) {
+    for (const auto& [id, info] : ids) {
+      auto& time = state->progress[{port, id}] = now;
+      if (!previous) {
+        continue;
+      }
+      const auto before = previous->sources.find(port);
+      if (before == previous->sources.cend()) {
+        continue;
+      }
+      const auto seen = before->second.find(id);
+      if (seen != before->second.cend() && seen->second.clock == info.clock) {
+        time = previous->progress.at({port, id});
+      }
+    }
+  }
+  _snapshot.store(std::move(state), std::memory_order_release);
+}
+
 EntryList Broker::query(const Clock& from, Source sender) const
 {
+  EntryList list;
+  scan(from, sender, [&list](const Entry& entry) {
+    list.push_back(entry);
+    return true;
+  });
+  return list;
+}
+
+bool Broker::scan(
+  const Clock& from, Source sender, const EntryVisitor& visit,
+  const Entry* after
+) const
+{
+  auto guard = lock();
   for (size_t i = 1; i < _connections.size(); i++) {
     auto conn = _connections[i];
     if (i == static_cast<size_t>(sender) || conn.provides().empty()) {
       continue;
     }
     if (conn.valid()) {
-      return conn.query(from);
+      guard.unlock();
+      return conn.scan(from, visit, after);
     }
   }
-  return {};
+  return true;
 }
 
 IdClockMap Broker::versions() const
 {
-  IdClockMap out;
-  for (auto& conn : _connections) {
-    for (auto& [id, data] : conn.provides()) {
-      out[id] = out[id].merge(data.clock);
-    }
-  }
-  return out;
+  return snapshot()->versions;
 }
 
 Source Broker::disconnect(Source source)
 {
-  if (source < 0 || _connections.size() <= static_cast<size_t>(source)) {
+  RefreshScope scope(*this);
+  auto guard = lock();
+  if (source >= _connections.size()) {
     return -1;
   }
-  auto& conn = _connections.at(source);
-  if (conn.valid()) {
-    conn.disconnect();
-    refreshConnections(source);
-    return source;
+  auto conn = _connections.at(source);
+  if (!conn.valid()) {
+    return -1;
   }
-  return -1;
+  holdDown(ProvidesChanges(conn.provides(), {}), source);
+  reroute(source, conn.provides(), {});
+  _connections.at(source).reset();
+  _advertised.erase(source);
+  _outdated.erase(source);
+  commit();
+  refreshConnections(source);
+  guard.unlock();
+
+  conn.disconnect();
+  return source;
 }
 
 Clock Broker::clock() const
+{
+  return snapshot()->clock;
+}
+
+const Clock& Broker::currentClock() const
 {
   return _connections.front().clock();
 }
@@ -179,20 +471,75 @@ void Broker::setClock(const Clock& clock)
   _connections.front().clock() = clock;
 }
 
-IdConnectionInfoMap UpdateProvides(SourcesMap provides)
+RoutingTable RoutesFrom(const SourcesMap& sources)
+{
+  RoutingTable table;
+  for (const auto& [port, infoMap] : sources) {
+    for (const auto& [id, info] : infoMap) {
+      const int16_t distance = info.distance + 1;
+      if (distance > kMaxDistance) {
+        continue;
+      }
+      const Route route{port, {distance, info.clock}};
+      auto [it, inserted] = table.try_emplace(id, Routes{route, {}});
+      if (inserted) {
+        continue;
+      }
+      auto& routes = it->second;
+      if (distance < routes.best.info.distance) {
+        routes.next = routes.best;
+        routes.best = route;
+      } else if (!routes.next || distance < routes.next->info.distance) {
+        routes.next = route;
+      }
+    }
+  }
+  return table;
+}
+
+IdConnectionInfoMap Advertisement(const RoutingTable& table, Source port)
+{
+  IdConnectionInfoMap out;
+  for (const auto& [id, routes] : table) {
+    if (routes.best.port != port) {
+      out.emplace_hint(out.end(), id, routes.best.info);
+    } else if (routes.next) {
+      out.emplace_hint(out.end(), id, routes.next->info);
+    }
+  }
+  return out;
+}
+
+IdConnectionInfoMap UpdateProvides(const SourcesMap& provides)
+{
+  IdConnectionInfoMap out;
+  for (const auto& [id, routes] : RoutesFrom(provides)) {
+    out.emplace_hint(out.end(), id, routes.best.info);
+  }
+  return out;
+}
+
+IdConnectionInfoMap
+ProvidesChanges(const IdConnectionInfoMap& from, const IdConnectionInfoMap& to)
 {
   IdConnectionInfoMap out;
-  for (auto& [source, infoMap] : provides) {
-    for (auto& [id, data] : infoMap) {
-      ++data.distance;
+  for (const auto& [id, info] : to) {
+    const auto it = from.find(id);
+    if (it == from.cend() || it->second != info) {
+      out[id] = info;
+    }
+  }
+  for (const auto& [id, info] : from) {
+    if (to.find(id) == to.cend()) {
+      out[id] = {kUnreachable, {}};
     }
-    out.merge(infoMap);
   }
   return out;
 }
 
 std::set<Source> Broker::connectedPorts() const
 {
+  auto guard = lock();
   std::set<Source> connected;
   for (size_t i = 1; i < _connections.size(); i++) {
     connected.insert(i);
@@ -202,44 +549,202 @@ std::set<Source> Broker::connectedPorts() const
 
 void Broker::refreshConnections(Source ignore)
 {
+  size_t ports = 0;
   for (size_t i = 1; i < _connections.size(); i++) {
-    if (i == static_cast<size_t>(ignore)) {
-      continue;
+    if (i != static_cast<size_t>(ignore)) {
+      ports += _outdated.insert(i).second;
     }
-    auto& conn = _connections.at(i);
-    auto data = stub();
-    data.source() = static_cast<Source>(i);
-    data.clock() = clock();
-    data.provides() = UpdateProvides(sources(i));
-    conn.refresh(data);
   }
+  Metrics::Add(Counter::Refreshes);
+  Metrics::Record(Histogram::RefreshedPorts, ports);
 }
 
-Clock Broker::relay(const Data& entry, Source sender)
+void Broker::schedulePublish()
+{
+  if (cascade.running) {
+    auto guard = lock();
+    if (!_scheduled) {
+      _scheduled = true;
+      cascade.pending.push_back(weak_from_this());
+    }
+    return;
+  }
+  cascade.running = true;
+  publish();
+  do {
+    while (!cascade.pending.empty()) {
+      const auto broker =
+        std::static_pointer_cast<Broker>(cascade.pending.front().lock());
+      cascade.pending.pop_front();
+      if (broker) {
+        auto guard = broker->lock();
+        broker->_scheduled = false;
+        guard.unlock();
+        broker->publish();
+      }
+    }
+    // Lost routes are gone everywhere by now, alternative ones held down
+    // meanwhile can be advertised.
+    for (const auto& weak : std::exchange(cascade.holding, {})) {
+      if (const auto broker = std::static_pointer_cast<Broker>(weak.lock())) {
+        auto guard = broker->lock();
+        broker->_heldDown.clear();
+        broker->refreshConnections();
+        guard.unlock();
+        broker->schedulePublish();
+      }
+    }
+  } while (!cascade.pending.empty());
+  cascade.running = false;
+}
+
+void Broker::holdDown(const IdConnectionInfoMap& changes, Source sender)
 {
-  long distance = std::numeric_limits<long>::max();
-  Source shortestDistancePort = -1;
-  for (const auto& [source, infoMap] : sources()) {
-    if (sender > 0 && source == sender) {
+  const auto& provides = _connections[sender].provides();
+  for (const auto& [id, info] : changes) {
+    const auto it = provides.find(id);
+    if (it == provides.cend()) {
       continue;
     }
-    for (const auto& [id, info] : infoMap) {
-      if (id == entry.id) {
-        if (info.distance == 0) {
-          return insert({clock().tick(id), entry});
-        } else if (info.distance < distance) {
-          distance = info.distance;
-          shortestDistancePort = source;
-        }
+    if (info.distance == kUnreachable || info.distance > it->second.distance) {
+      if (_heldDown.empty()) {
+        cascade.holding.push_back(weak_from_this());
+      }
+      auto [held, inserted] = _heldDown.try_emplace(id, it->second.distance);
+      if (!inserted && it->second.distance < held->second) {
+        held->second = it->second.distance;
+      }
+    }
+  }
+}
+
+void Broker::publish()
+{
+  auto guard = lock();
+  // Changes made while the peers are being refreshed, from this or from
+  // other threads, are picked up by the loop below.
+  if (_publishing) {
+    return;
+  }
+  _publishing = true;
+  while (!_outdated.empty()) {
+    const auto routes = RoutesFrom(currentSources());
+    std::vector<std::tuple<Connection, Connection, Connection>> messages;
+    for (const auto port : std::exchange(_outdated, {})) {
+      const auto& peer = _connections.at(port);
+      if (!peer.valid()) {
+        continue;
+      }
+      if (auto message = advertise(port, Advertisement(routes, port))) {
+        messages.emplace_back(peer, message->first, message->second);
+      }
+    }
+    guard.unlock();
+
+    Metrics::Add(Counter::TopologyMessages, messages.size());
+    for (const auto& [peer, changes, data] : messages) {
+      if (!peer.update(changes)) {
+        peer.refresh(data);
+      }
+    }
+    guard.lock();
+  }
+  _publishing = false;
+}
+
+std::optional<std::pair<Connection, Connection>>
+Broker::advertise(Source port, IdConnectionInfoMap provides)
+{
+  for (const auto& [id, distance] : _heldDown) {
+    const auto it = provides.find(id);
+    if (it != provides.cend() && it->second.distance > distance + 1) {
+      provides.erase(it);
+    }
+  }
+
+  auto data = stub();
+  data.source() = port;
+  data.clock() = currentClock();
+  data.provides() = std::move(provides);
+
+  auto& advertised = _advertised[port];
+  if (advertised.clock == data.clock() &&
+      advertised.provides == data.provides()) {
+    return {};
+  }
+
+  auto changes = data;
+  changes.provides() = ProvidesChanges(advertised.provides, data.provides());
+  advertised = {data.clock(), data.provides()};
+  return std::make_pair(std::move(changes), std::move(data));
+}
+
+void Broker::reroute(Source port, Id id, int16_t from, int16_t to)
+{
+  if (port == 0 || from == to) {
+    return;
+  }
+  if (from != kUnreachable) {
+    if (const auto it = _routes.find(id); it != _routes.end()) {
+      it->second.erase({from, port});
+      if (it->second.empty()) {
+        _routes.erase(it);
       }
     }
   }
+  if (to != kUnreachable) {
+    _routes[id].emplace(to, port);
+  }
+}
 
-  if (distance == std::numeric_limits<long>::max()) {
+void Broker::reroute(
+  Source port, const IdConnectionInfoMap& from, const IdConnectionInfoMap& to
+)
+{
+  for (const auto& [id, info] : from) {
+    const auto it = to.find(id);
+    reroute(
+      port, id, info.distance,
+      it == to.cend() ? kUnreachable : it->second.distance
+    );
+  }
+  for (const auto& [id, info] : to) {
+    if (!from.contains(id)) {
+      reroute(port, id, kUnreachable, info.distance);
+    }
+  }
+}
+
+Clock Broker::relay(const Data& entry, Source sender)
+{
+  ScopedSpan span("broker.relay");
+  auto guard = lock();
+  const auto it = _routes.find(entry.id);
+  if (it == _routes.cend()) {
     return {{0, 0}};
   }
+  std::vector<Source> ports;
+  ports.reserve(it->second.size());
+  for (const auto& [distance, port] : it->second) {
+    if (port != sender) {
+      ports.push_back(port);
+    }
+  }
+  guard.unlock();
 
-  return _connections.at(shortestDistancePort).relay(entry);
+  // Routes are tried from the shortest one, the longer ones are taken when a
+  // peer fails to relay the entry.
+  for (const auto port : ports) {
+    const auto conn = peer(port);
+    if (!conn.valid()) {
+      continue;
+    }
+    Metrics::Add(Counter::RelayHops);
+    if (const auto clock = conn.relay(entry); clock.valid()) {
+      return clock;
+    }
+  }
+  return {{0, 0}};
 }
 
 std::string Broker::schema() const
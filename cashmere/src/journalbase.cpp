@@ -14,6 +14,8 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "cashmere/journalbase.h"
+#include "cashmere/metrics.h"
+#include "cashmere/tracing.h"
 
 namespace Cashmere
 {
@@ -22,6 +24,8 @@ JournalBase::JournalBase(const std::string& url)
   : Broker(url)
   , _bookId(0)
 {
+  auto guard = lock();
+  commit();
 }
 
 JournalBase::~JournalBase() {}
@@ -31,40 +35,144 @@ Id JournalBase::bookId() const
   return _bookId;
 }
 
+// Whether everything the entry was created on top of, but itself, is known.
+bool CausallyReady(const Entry& data, const Clock& current)
+{
+  for (const auto& [id, time] : data.clock) {
+    if (id == data.entry.id) {
+      continue;
+    }
+    const auto it = current.find(id);
+    if (time > (it == current.cend() ? 0 : it->second)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 Clock JournalBase::insert(const Entry& data, Source source)
 {
-  if (!data.clock.isNext(clock(), data.entry.id)) {
+  ScopedSpan span("journal.insert");
+  const auto clock = Broker::insert(data, source);
+  const auto time = data.clock.find(data.entry.id);
+  if (clock.valid() || time == data.clock.cend()) {
+    return clock;
+  }
+  const auto sender = peer(source);
+  const auto current = this->clock();
+  const auto known = current.find(data.entry.id);
+  const Time next = known == current.cend() ? 1 : known->second + 1;
+  if (!sender.valid() || time->second < next ||
+      (time->second == next && CausallyReady(data, current))) {
+    return clock;
+  }
+
+  // Peers forwarding from several threads may deliver entries out of order,
+  // the ones missing in between are fetched from the sender.
+  Metrics::Add(Counter::GapFetches);
+  auto missing = sender.query(current);
+  const auto order = [](const Entry& entry) {
+    const auto it = entry.clock.find(entry.entry.id);
+    return std::pair(entry.entry.id, it == entry.clock.cend() ? 0 : it->second);
+  };
+  missing.sort([&order](const Entry& lhs, const Entry& rhs) {
+    return order(lhs) < order(rhs);
+  });
+  for (bool progress = true; progress;) {
+    progress = false;
+    for (auto it = missing.begin(); it != missing.end();) {
+      if (Broker::insert(*it, source).valid()) {
+        it = missing.erase(it);
+        progress = true;
+      } else {
+        ++it;
+      }
+    }
+  }
+  return Broker::insert(data, source);
+}
+
+Clock JournalBase::accept(const Entry& data, Source source)
+{
+  const auto& current = currentClock();
+  if (!data.clock.isNext(current, data.entry.id) ||
+      !CausallyReady(data, current)) {
+    Metrics::Add(Counter::InsertsRejected);
     return Clock{{0, 0}};
   }
-  if (save(data)) {
-    return Broker::insert(data, source);
+  bool saved;
+  {
+    ScopedSpan span("journal.save");
+    ScopedTimer timer(Histogram::SaveNs);
+    saved = save(data);
+  }
+  if (saved) {
+    return Broker::accept(data, source);
   }
+  Metrics::Add(Counter::InsertsRejected);
   return Clock{{0, 0}};
 }
 
-EntryList JournalBase::query(const Clock& from, Source) const
+bool JournalBase::append(const Data& entry)
 {
+  ScopedSpan span("journal.append");
+  auto guard = lock();
+  const auto clock = accept({currentClock().tick(entry.id), entry}, 0);
+  guard.unlock();
+
+  forward();
+  return clock.valid();
+}
+
+EntryList JournalBase::query(const Clock& from, Source source) const
+{
+  ScopedTimer timer(Histogram::QueryNs);
   EntryList list;
-  for (const auto& [clock, entry] : entries()) {
-    if (clock.concurrent(from) || from.smallerThan(clock)) {
-      list.push_back({clock, entry});
-    }
-  }
+  scan(from, source, [&list](const Entry& entry) {
+    list.push_back(entry);
+    return true;
+  });
+  Metrics::Add(Counter::Queries);
+  Metrics::Add(Counter::QueriedEntries, list.size());
   return list;
 }
 
-SourcesMap JournalBase::sources(Source sender) const
+bool JournalBase::scan(
+  const Clock& from, Source, const EntryVisitor& visit, const Entry* after
+) const
+{
+  auto guard = lock();
+  return forEach(
+    [&from, &visit](const Entry& entry) {
+      if (entry.clock.concurrent(from) || from.smallerThan(entry.clock)) {
+        return visit(entry);
+      }
+      return true;
+    },
+    after
+  );
+}
+
+IdConnectionInfoMap JournalBase::provided() const
 {
-  auto out = Broker::sources(sender);
-  out[0] = {{id(), {0, clock()}}};
-  return out;
+  return {{id(), {0, currentClock()}}};
 }
 
 Clock JournalBase::relay(const Data& data, Source sender)
 {
-  if (data.id == 0) {
-    return Broker::relay({id(), data.value, data.alters}, sender);
+  if (data.id != 0 && data.id != id()) {
+    return Broker::relay(data, sender);
+  }
+  ScopedSpan span("journal.relay");
+  auto guard = lock();
+  const auto clock =
+    accept({currentClock().tick(id()), {id(), data.value, data.alters}}, 0);
+  guard.unlock();
+
+  if (clock.valid()) {
+    Metrics::Add(Counter::RelaysDelivered);
   }
-  return Broker::relay(data, sender);
+  forward();
+  return clock;
 }
 }
@@ -0,0 +1,268 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "cashmere/metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <mutex>
+#include <set>
+
+namespace Cashmere
+{
+
+namespace
+{
+
+constexpr std::array<std::string_view, kCounters> kCounterNames = {
+  "inserts_accepted",
+  "inserts_rejected",
+  "gap_fetches",
+  "entries_forwarded",
+  "refreshes",
+  "topology_messages",
+  "relay_hops",
+  "relays_delivered",
+  "queries",
+  "queried_entries",
+  "file_writes",
+  "file_entries_read",
+  "replicate_frames_dropped",
+};
+
+constexpr std::array<std::string_view, kHistograms> kHistogramNames = {
+  "save_ns",
+  "fan_out",
+  "refreshed_ports",
+  "query_ns",
+  "file_write_ns",
+  "file_read_ns",
+};
+
+constexpr std::array<std::string_view, kGauges> kGaugeNames = {
+  "replication_queue",
+};
+
+// Only the owning thread writes a cell, so it is read and written back
+// rather than incremented atomically; snapshots read it from other threads.
+using Cell = std::atomic<uint64_t>;
+
+void Bump(Cell& cell, uint64_t value)
+{
+  cell.store(
+    cell.load(std::memory_order_relaxed) + value, std::memory_order_relaxed
+  );
+}
+
+struct Cells
+{
+  std::array<Cell, kCounters> counters = {};
+  std::array<std::array<Cell, kHistogramBuckets>, kHistograms> buckets = {};
+  std::array<Cell, kHistograms> sums = {};
+  // Raised by one thread and lowered by another, each cell may wrap around
+  // but their sum does not.
+  std::array<Cell, kGauges> gauges = {};
+
+  void addTo(MetricsSnapshot& out) const
+  {
+    for (size_t i = 0; i < kCounters; ++i) {
+      out.counters[i] += counters[i].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < kHistograms; ++i) {
+      auto& histogram = out.histograms[i];
+      for (size_t j = 0; j < kHistogramBuckets; ++j) {
+        histogram.buckets[j] += buckets[i][j].load(std::memory_order_relaxed);
+      }
+      histogram.sum += sums[i].load(std::memory_order_relaxed);
+    }
+    for (size_t i = 0; i < kGauges; ++i) {
+      out.gauges[i] += gauges[i].load(std::memory_order_relaxed);
+    }
+  }
+};
+
+struct Registry
+{
+  std::mutex mutex;
+  std::set<const Cells*> threads;
+  // What the threads already gone recorded.
+  MetricsSnapshot retired;
+};
+
+// Never destroyed: threads may still record while the process exits.
+Registry& GetRegistry()
+{
+  static auto* registry = new Registry;
+  return *registry;
+}
+
+struct ThreadCells
+{
+  ThreadCells()
+  {
+    auto& registry = GetRegistry();
+    std::lock_guard guard(registry.mutex);
+    registry.threads.insert(&cells);
+  }
+
+  ~ThreadCells()
+  {
+    auto& registry = GetRegistry();
+    std::lock_guard guard(registry.mutex);
+    cells.addTo(registry.retired);
+    registry.threads.erase(&cells);
+  }
+
+  Cells cells;
+};
+
+Cells& Local()
+{
+  thread_local ThreadCells local;
+  return local.cells;
+}
+
+}
+
+size_t HistogramData::Bucket(uint64_t value)
+{
+  return std::min<size_t>(std::bit_width(value), kHistogramBuckets - 1);
+}
+
+uint64_t HistogramData::UpperBound(size_t bucket)
+{
+  if (bucket + 1 >= kHistogramBuckets) {
+    return UINT64_MAX;
+  }
+  return (uint64_t{1} << bucket) - 1;
+}
+
+uint64_t HistogramData::count() const
+{
+  uint64_t total = 0;
+  for (const auto value : buckets) {
+    total += value;
+  }
+  return total;
+}
+
+uint64_t HistogramData::percentile(double fraction) const
+{
+  const auto total = count();
+  if (total == 0) {
+    return 0;
+  }
+  const auto rank = std::max<uint64_t>(1, fraction * total);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kHistogramBuckets; ++i) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return UpperBound(i);
+    }
+  }
+  return UpperBound(kHistogramBuckets - 1);
+}
+
+uint64_t MetricsSnapshot::operator[](Counter counter) const
+{
+  return counters.at(static_cast<size_t>(counter));
+}
+
+const HistogramData& MetricsSnapshot::operator[](Histogram histogram) const
+{
+  return histograms.at(static_cast<size_t>(histogram));
+}
+
+int64_t MetricsSnapshot::operator[](Gauge gauge) const
+{
+  return gauges.at(static_cast<size_t>(gauge));
+}
+
+MetricsSnapshot MetricsSnapshot::operator-(const MetricsSnapshot& before) const
+{
+  auto out = *this;
+  for (size_t i = 0; i < kCounters; ++i) {
+    out.counters[i] -= before.counters[i];
+  }
+  for (size_t i = 0; i < kHistograms; ++i) {
+    for (size_t j = 0; j < kHistogramBuckets; ++j) {
+      out.histograms[i].buckets[j] -= before.histograms[i].buckets[j];
+    }
+    out.histograms[i].sum -= before.histograms[i].sum;
+  }
+  return out;
+}
+
+void Metrics::Add(Counter counter, uint64_t value)
+{
+  Bump(Local().counters[static_cast<size_t>(counter)], value);
+}
+
+void Metrics::Record(Histogram histogram, uint64_t value)
+{
+  auto& cells = Local();
+  const auto i = static_cast<size_t>(histogram);
+  Bump(cells.buckets[i][HistogramData::Bucket(value)], 1);
+  Bump(cells.sums[i], value);
+}
+
+void Metrics::Adjust(Gauge gauge, int64_t delta)
+{
+  Bump(Local().gauges[static_cast<size_t>(gauge)], delta);
+}
+
+MetricsSnapshot Metrics::Snapshot()
+{
+  auto& registry = GetRegistry();
+  std::lock_guard guard(registry.mutex);
+  auto out = registry.retired;
+  for (const auto* cells : registry.threads) {
+    cells->addTo(out);
+  }
+  return out;
+}
+
+std::string_view Metrics::Name(Counter counter)
+{
+  return kCounterNames.at(static_cast<size_t>(counter));
+}
+
+std::string_view Metrics::Name(Histogram histogram)
+{
+  return kHistogramNames.at(static_cast<size_t>(histogram));
+}
+
+std::string_view Metrics::Name(Gauge gauge)
+{
+  return kGaugeNames.at(static_cast<size_t>(gauge));
+}
+
+ScopedTimer::ScopedTimer(Histogram histogram)
+  : _histogram(histogram)
+  , _start(std::chrono::steady_clock::now())
+{
+}
+
+ScopedTimer::~ScopedTimer()
+{
+  const auto elapsed = std::chrono::steady_clock::now() - _start;
+  Metrics::Record(
+    _histogram,
+    std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()
+  );
+}
+
+}
@@ -0,0 +1,117 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "plugins.h"
+
+#include <dlfcn.h>
+
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+namespace Cashmere
+{
+
+namespace
+{
+
+constexpr std::string_view kPrefix = "lib";
+constexpr std::string_view kSuffix = ".so";
+
+struct Directories
+{
+  std::mutex mutex;
+  std::map<std::string, std::shared_ptr<Plugins>> plugins;
+};
+
+// Never destroyed, as the libraries it opened are never closed.
+Directories& GetDirectories()
+{
+  static auto* directories = new Directories;
+  return *directories;
+}
+
+}
+
+Plugins::Plugins(const std::string& path)
+{
+  std::error_code error;
+  for (const auto& entry : fs::directory_iterator(path, error)) {
+    const auto filename = entry.path().filename().string();
+    if (filename.size() <= kPrefix.size() + kSuffix.size() ||
+        !filename.starts_with(kPrefix) || !filename.ends_with(kSuffix)) {
+      continue;
+    }
+    const auto schema = filename.substr(
+      kPrefix.size(), filename.size() - kPrefix.size() - kSuffix.size()
+    );
+    _libraries[schema] = {entry.path().string(), nullptr, false};
+  }
+}
+
+std::shared_ptr<Plugins> Plugins::Of(const std::string& path)
+{
+  auto& directories = GetDirectories();
+  std::lock_guard guard(directories.mutex);
+  auto& plugins = directories.plugins[path];
+  if (!plugins) {
+    plugins = std::make_shared<Plugins>(path);
+  }
+  return plugins;
+}
+
+std::vector<std::string> Plugins::schemas() const
+{
+  std::lock_guard guard(_mutex);
+  std::vector<std::string> out;
+  for (const auto& [schema, library] : _libraries) {
+    out.push_back(schema);
+  }
+  return out;
+}
+
+void* Plugins::create(const std::string& schema)
+{
+  std::lock_guard guard(_mutex);
+  const auto it = _libraries.find(schema);
+  if (it == _libraries.end()) {
+    return nullptr;
+  }
+  auto& library = it->second;
+  if (library.opened) {
+    return library.create;
+  }
+  library.opened = true;
+  void* handle = dlopen(library.path.c_str(), RTLD_LAZY);
+  if (!handle) {
+    return nullptr;
+  }
+  dlerror();
+  library.create = dlsym(handle, "create");
+  if (dlerror() != nullptr) {
+    library.create = nullptr;
+    dlclose(handle);
+  }
+  return library.create;
+}
+
+bool Plugins::loaded(const std::string& schema) const
+{
+  std::lock_guard guard(_mutex);
+  const auto it = _libraries.find(schema);
+  return it != _libraries.end() && it->second.create != nullptr;
+}
+
+}
@@ -0,0 +1,83 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef CASHMERE_PLUGINS_H
+#define CASHMERE_PLUGINS_H
+
+#include <cashmere/cashmere_export.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Cashmere
+{
+
+template <class T>
+using CreatorMap = std::map<std::string, std::function<T*(const std::string&)>>;
+
+// Plugins of a directory, one per lib<schema>.so file. Schemas are known from
+// the file names alone: a library is only opened once something of its schema
+// is created, and then stays loaded until the process exits.
+class CASHMERE_EXPORT Plugins
+{
+public:
+  explicit Plugins(const std::string& path);
+
+  // The plugins of `path`, listed once and shared by the whole process.
+  static std::shared_ptr<Plugins> Of(const std::string& path);
+  // Creator of each schema of `path`, opening its library on the first call.
+  // Creators of libraries that cannot be loaded return null.
+  template <class T>
+  static CreatorMap<T> CreatorsOf(const std::string& path);
+
+  std::vector<std::string> schemas() const;
+  // The `create` function of the library of `schema`, null if it has none.
+  void* create(const std::string& schema);
+  bool loaded(const std::string& schema) const;
+
+private:
+  struct Library
+  {
+    std::string path;
+    void* create;
+    bool opened;
+  };
+
+  mutable std::mutex _mutex;
+  std::map<std::string, Library> _libraries;
+};
+
+template <class T>
+CreatorMap<T> Plugins::CreatorsOf(const std::string& path)
+{
+  CreatorMap<T> creators;
+  auto plugins = Of(path);
+  for (const auto& schema : plugins->schemas()) {
+    creators[schema] = [plugins, schema](const std::string& url) -> T* {
+      auto create =
+        reinterpret_cast<T* (*)(const std::string&)>(plugins->create(schema));
+      return create ? create(url) : nullptr;
+    };
+  }
+  return creators;
+}
+
+}
+
+#endif
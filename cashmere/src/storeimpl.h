@@ -17,41 +17,73 @@
 #define CASHEMERE_BROKER_STORE_IMPL_H
 
 #include "cashmere/brokerstore.h"
-#include <functional>
-#include <filesystem>
-#include <dlfcn.h>
+#include "cashmere/utils/url.h"
+#include "plugins.h"
 
-namespace fs = std::filesystem;
+#include <array>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
 
 namespace Cashmere
 {
 
 using BrokerCreator = std::function<BrokerBase*(const std::string&)>;
-using SchemaFunctorMap = std::map<std::string, BrokerCreator>;
+using SchemaFunctorMap = CreatorMap<BrokerBase>;
 
 struct BrokerStore::Impl {
   static SchemaFunctorMap LoadPlugins(const std::string& path)
   {
-    SchemaFunctorMap result;
-    for (auto& entry : fs::directory_iterator(path)) {
-      void* handle = dlopen(entry.path().c_str(), RTLD_LAZY);
-      if (!handle) {
-        continue;
-      }
-      dlerror();
-      auto func = dlsym(handle, "create");
-      char* error = dlerror();
-      if (error != nullptr) {
-        dlclose(handle);
-        continue;
+    return Plugins::CreatorsOf<BrokerBase>(path);
+  }
+
+  // Brokers by the key of their url, the url in its canonical spelling, and
+  // the keys of the spellings of their urls looked up so far, spread over
+  // shards guarded by a lock each, so that peers connecting at once mostly
+  // look up and create brokers in parallel.
+  static constexpr size_t kShards = 16;
+  // Spellings come from peers, so each shard forgets the ones it has once
+  // it holds that many.
+  static constexpr size_t kMaxSpellings = 256;
+  struct Shard
+  {
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, BrokerBasePtr> store;
+    // The key of each spelling, parsed, as it is the url of the broker.
+    std::unordered_map<std::string, Url> keys;
+  };
+
+  Shard& shardOf(const std::string& text)
+  {
+    return shards[std::hash<std::string>{}(text) % kShards];
+  }
+
+  // Key of the broker of a url, and whether the spelling was known.
+  std::pair<Url, bool> keyOf(const std::string& url)
+  {
+    auto& shard = shardOf(url);
+    {
+      std::shared_lock lock(shard.mutex);
+      const auto it = shard.keys.find(url);
+      if (it != shard.keys.end()) {
+        return {it->second, true};
       }
-      auto filename = entry.path().filename().string();
-      auto schema = filename.substr(3, filename.size() - 6);
-      result[schema] = reinterpret_cast<BrokerBase* (*)(const std::string&)>(func);
     }
-    return result;
+    return {ParseUrl(ParseUrl(url).key()), false};
   }
-  std::unordered_map<std::string, BrokerBasePtr> store;
+
+  // Only called for the urls of brokers in the store.
+  void remember(const std::string& url, const Url& key)
+  {
+    auto& shard = shardOf(url);
+    std::unique_lock lock(shard.mutex);
+    if (shard.keys.size() >= kMaxSpellings) {
+      shard.keys.clear();
+    }
+    shard.keys.try_emplace(url, key);
+  }
+
+  std::array<Shard, kShards> shards;
   SchemaFunctorMap builders;
 };
 
@@ -0,0 +1,249 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "cashmere/tracing.h"
+#include "cashmere/utils/random.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <unordered_set>
+
+namespace Cashmere
+{
+
+namespace
+{
+
+// Spans kept until the tracing stops, the ones past it are dropped.
+constexpr size_t kMaxSpans = size_t{1} << 20;
+
+std::atomic<bool> gEnabled = false;
+
+struct Recorder
+{
+  std::mutex mutex;
+  std::string path;
+  std::vector<SpanRecord> spans;
+};
+
+// Never destroyed: threads may still end spans while the process exits.
+Recorder& GetRecorder()
+{
+  static auto* recorder = new Recorder;
+  return *recorder;
+}
+
+thread_local SpanRecord* tCurrent = nullptr;
+
+uint64_t NextId()
+{
+  thread_local Random random;
+  uint64_t id;
+  do {
+    id = random.next();
+  } while (id == 0);
+  return id;
+}
+
+uint32_t ThreadIndex()
+{
+  static std::atomic<uint32_t> next = 1;
+  thread_local const uint32_t index = next++;
+  return index;
+}
+
+double Microseconds(std::chrono::nanoseconds duration)
+{
+  return duration.count() / 1000.0;
+}
+
+}
+
+bool TraceContext::valid() const
+{
+  return trace != 0 && span != 0;
+}
+
+std::string TraceContext::str() const
+{
+  return std::format("{:016x}-{:016x}", trace, span);
+}
+
+TraceContext TraceContext::From(const std::string& text)
+{
+  const auto dash = text.find('-');
+  if (dash == text.npos) {
+    return {};
+  }
+  try {
+    return {
+      std::stoull(text.substr(0, dash), nullptr, 16),
+      std::stoull(text.substr(dash + 1), nullptr, 16)
+    };
+  } catch (const std::exception&) {
+    return {};
+  }
+}
+
+void Tracing::Start(const std::string& path)
+{
+  auto& recorder = GetRecorder();
+  std::lock_guard guard(recorder.mutex);
+  recorder.path = path;
+  recorder.spans.clear();
+  gEnabled.store(true, std::memory_order_relaxed);
+}
+
+bool Tracing::Stop()
+{
+  gEnabled.store(false, std::memory_order_relaxed);
+  auto& recorder = GetRecorder();
+  std::string path;
+  {
+    std::lock_guard guard(recorder.mutex);
+    path = std::move(recorder.path);
+  }
+  return path.empty() || Write(path);
+}
+
+bool Tracing::Enabled()
+{
+  return gEnabled.load(std::memory_order_relaxed);
+}
+
+TraceContext Tracing::Current()
+{
+  return tCurrent ? tCurrent->context : TraceContext{};
+}
+
+TraceContext Tracing::Propagate()
+{
+  if (!tCurrent) {
+    return {};
+  }
+  tCurrent->sent = true;
+  return tCurrent->context;
+}
+
+std::vector<SpanRecord> Tracing::Spans()
+{
+  auto& recorder = GetRecorder();
+  std::lock_guard guard(recorder.mutex);
+  return recorder.spans;
+}
+
+// Spans are complete events. Hand-offs to other threads and processes are
+// flow events, from the parent span to the ones continuing it.
+bool Tracing::Write(const std::string& path)
+{
+  std::ofstream out(path, std::ios::trunc);
+  if (!out) {
+    return false;
+  }
+  const auto spans = Spans();
+  std::unordered_set<uint64_t> handedOff;
+  for (const auto& span : spans) {
+    if (span.remoteParent) {
+      handedOff.insert(span.parent);
+    }
+  }
+  const auto pid = getpid();
+  const char* separator = "";
+  out << "{\"traceEvents\":[";
+  for (const auto& span : spans) {
+    const auto start = Microseconds(span.start.time_since_epoch());
+    out << std::format(
+      "{}\n{{\"name\":\"{}\",\"cat\":\"cashmere\",\"ph\":\"X\",\"ts\":{:.3f},"
+      "\"dur\":{:.3f},\"pid\":{},\"tid\":{},\"args\":{{\"trace\":\"{:x}\","
+      "\"span\":\"{:x}\",\"parent\":\"{:x}\"}}}}",
+      separator, span.name, start, Microseconds(span.duration), pid,
+      span.thread, span.context.trace, span.context.span, span.parent
+    );
+    separator = ",";
+    if (span.sent || handedOff.contains(span.context.span)) {
+      out << std::format(
+        ",\n{{\"name\":\"rpc\",\"cat\":\"cashmere\",\"ph\":\"s\",\"id\":"
+        "\"{:x}\",\"ts\":{:.3f},\"pid\":{},\"tid\":{}}}",
+        span.context.span, start, pid, span.thread
+      );
+    }
+    if (span.remoteParent) {
+      out << std::format(
+        ",\n{{\"name\":\"rpc\",\"cat\":\"cashmere\",\"ph\":\"f\",\"bp\":\"e\","
+        "\"id\":\"{:x}\",\"ts\":{:.3f},\"pid\":{},\"tid\":{}}}",
+        span.parent, start, pid, span.thread
+      );
+    }
+  }
+  out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return out.good();
+}
+
+ScopedSpan::ScopedSpan(const char* name)
+  : _outer(nullptr)
+  , _recording(Tracing::Enabled())
+{
+  if (_recording) {
+    open(name, tCurrent ? tCurrent->context : TraceContext{}, false);
+  }
+}
+
+ScopedSpan::ScopedSpan(const char* name, const TraceContext& parent)
+  : _outer(nullptr)
+  , _recording(Tracing::Enabled())
+{
+  if (_recording) {
+    const auto local = tCurrent && tCurrent->context == parent;
+    open(name, parent, parent.valid() && !local);
+  }
+}
+
+void ScopedSpan::open(const char* name, const TraceContext& parent, bool remote)
+{
+  _record.name = name;
+  _record.context.trace = parent.valid() ? parent.trace : NextId();
+  _record.context.span = NextId();
+  _record.parent = parent.valid() ? parent.span : 0;
+  _record.start = std::chrono::system_clock::now();
+  _record.duration = {};
+  _record.thread = ThreadIndex();
+  _record.remoteParent = remote;
+  _record.sent = false;
+  _outer = tCurrent;
+  tCurrent = &_record;
+}
+
+ScopedSpan::~ScopedSpan()
+{
+  if (!_recording) {
+    return;
+  }
+  tCurrent = _outer;
+  _record.duration = std::chrono::system_clock::now() - _record.start;
+  if (!Tracing::Enabled()) {
+    return;
+  }
+  auto& recorder = GetRecorder();
+  std::lock_guard guard(recorder.mutex);
+  if (recorder.spans.size() < kMaxSpans) {
+    recorder.spans.push_back(_record);
+  }
+}
+
+}
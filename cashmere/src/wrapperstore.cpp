@@ -1,9 +1,7 @@
 #include "cashmere/utils/url.h"
 #include "cashmere/utils/file.h"
 #include "cashmere/brokerwrapper.h"
-#include <dlfcn.h>
-
-namespace fs = std::filesystem;
+#include "plugins.h"
 
 namespace Cashmere {
 
@@ -12,30 +10,7 @@ std::string WrappersDirectory()
   return InstallDirectory() / "lib/cashmere/wrappers";
 }
 
-using BrokerCreator = std::function<WrapperBase*(const std::string&)>;
-using SchemaFunctorMap = std::map<std::string, BrokerCreator>;
-
-SchemaFunctorMap LoadWrapperPlugins(const std::string& path)
-{
-  SchemaFunctorMap result;
-  for (auto& entry : fs::directory_iterator(path)) {
-    void* handle = dlopen(entry.path().c_str(), RTLD_LAZY);
-    if (!handle) {
-      continue;
-    }
-    dlerror();
-    auto func = dlsym(handle, "create");
-    char* error = dlerror();
-    if (error != nullptr) {
-      dlclose(handle);
-      continue;
-    }
-    auto filename = entry.path().filename().string();
-    auto schema = filename.substr(3, filename.size() - 6);
-    result[schema] = reinterpret_cast<WrapperBase* (*)(const std::string&)>(func);
-  }
-  return result;
-}
+using SchemaFunctorMap = CreatorMap<WrapperBase>;
 
 struct WrapperStore::Impl {
     std::unordered_map<std::string, WrapperBasePtr> store;
@@ -53,7 +28,11 @@ WrapperBasePtr WrapperStore::getOrCreate(const std::string& url)
   if (builderIt == _impl->builders.end()) {
     return nullptr;
   }
-  return _impl->store[url] = std::shared_ptr<WrapperBase>(builderIt->second(url));
+  auto wrapper = std::shared_ptr<WrapperBase>(builderIt->second(url));
+  if (!wrapper) {
+    return nullptr;
+  }
+  return _impl->store[url] = wrapper;
 }
 
 std::size_t WrapperStore::size() const
@@ -70,6 +49,6 @@ WrapperStore::WrapperStore(Private)
   : WrapperStoreBase()
   , _impl(std::make_unique<Impl>())
 {
-  _impl->builders = LoadWrapperPlugins(WrappersDirectory());
+  _impl->builders = Plugins::CreatorsOf<WrapperBase>(WrappersDirectory());
 }
 }
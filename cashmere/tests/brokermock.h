@@ -41,6 +41,9 @@ public:
   MOCK_METHOD(
     bool, refresh, (const Connection& data, Source source), (override)
   );
+  MOCK_METHOD(
+    bool, update, (const Connection& changes, Source source), (override)
+  );
   MOCK_METHOD(Connection, stub, (), (override));
   MOCK_METHOD(Clock, relay, (const Data& data, Source source), (override));
   MOCK_METHOD(std::string, schema, (), (const, override));
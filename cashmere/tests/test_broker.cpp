@@ -19,8 +19,13 @@
 #include "brokermock.h"
 #include "cashmere/brokerstore.h"
 
+#include <chrono>
+#include <thread>
+
 using namespace Cashmere;
 
+using ::testing::_;
+using ::testing::An;
 using ::testing::Return;
 
 struct BrokerTest : public ::testing::Test
@@ -33,6 +38,16 @@ struct BrokerTest : public ::testing::Test
   BrokerBasePtr hub0;
 };
 
+bool Provides(const BrokerBasePtr& broker, Id id)
+{
+  for (const auto& [source, infoMap] : broker->sources()) {
+    if (infoMap.contains(id)) {
+      return true;
+    }
+  }
+  return false;
+}
+
 TEST_F(BrokerTest, ConnectIgnoresNullptr)
 {
   const auto conn = hub0->connect(Connection{});
@@ -325,3 +340,307 @@ TEST_F(BrokerTest, PropagatesProvidedConnections)
   hub0->connect(Connection{hub});
   hub0->connect(Connection{journal});
 }
+
+TEST_F(BrokerTest, UnchangedTopologyIsNotPropagated)
+{
+  const auto aa = std::make_shared<BrokerMock>();
+  const auto bb = std::make_shared<BrokerMock>();
+  const auto aaProvides = IdConnectionInfoMap{{0xAA, {0, {}}}};
+
+  EXPECT_CALL(*aa, connect(_))
+    .WillOnce(Return(Connection(aa, 1, {}, aaProvides)));
+  EXPECT_CALL(*bb, connect(_)).WillOnce(Return(Connection(bb, 1, {}, {})));
+  EXPECT_CALL(*bb, update(_, _)).Times(0);
+  EXPECT_CALL(*bb, refresh(_, _)).Times(0);
+
+  hub0->connect(Connection{aa});
+  hub0->connect(Connection{bb});
+
+  EXPECT_TRUE(hub0->refresh(Connection(aa, 1, {}, aaProvides), 1));
+}
+
+TEST_F(BrokerTest, TopologyUpdatesOnlyCarryChanges)
+{
+  const auto aa = std::make_shared<BrokerMock>();
+  const auto bb = std::make_shared<BrokerMock>();
+
+  EXPECT_CALL(*aa, connect(_))
+    .WillOnce(Return(Connection(aa, 1, {}, {{0xAA, {0, {}}}})));
+  EXPECT_CALL(*bb, connect(_)).WillOnce(Return(Connection(bb, 1, {}, {})));
+  EXPECT_CALL(
+    *bb, update(
+           Connection(
+             hub0, 2, Clock{},
+             IdConnectionInfoMap{{0xCC, {.distance = 2, .clock = {}}}}
+           ),
+           1
+         )
+  )
+    .WillOnce(Return(true));
+
+  hub0->connect(Connection{aa});
+  hub0->connect(Connection{bb});
+
+  const auto changes =
+    Connection(aa, 1, {}, IdConnectionInfoMap{{0xCC, {1, {}}}});
+  EXPECT_TRUE(hub0->update(changes, 1));
+  const auto expected = SourcesMap{
+    {1, {{0xAA, {0, {}}}, {0xCC, {1, {}}}}},
+  };
+  EXPECT_EQ(hub0->sources(), expected);
+}
+
+TEST_F(BrokerTest, TopologyUpdatesRemoveUnreachableIds)
+{
+  const auto aa = std::make_shared<BrokerMock>();
+  const auto bb = std::make_shared<BrokerMock>();
+
+  EXPECT_CALL(*aa, connect(_))
+    .WillOnce(Return(Connection(aa, 1, {}, {{0xAA, {0, {}}}, {0xCC, {1, {}}}}))
+    );
+  EXPECT_CALL(*bb, connect(_)).WillOnce(Return(Connection(bb, 1, {}, {})));
+  EXPECT_CALL(
+    *bb, update(
+           Connection(
+             hub0, 2, Clock{},
+             IdConnectionInfoMap{{0xCC, {.distance = kUnreachable, .clock = {}}}
+             }
+           ),
+           1
+         )
+  )
+    .WillOnce(Return(true));
+
+  hub0->connect(Connection{aa});
+  hub0->connect(Connection{bb});
+
+  const auto changes = Connection(aa, 1, {}, {{0xCC, {kUnreachable, {}}}});
+  EXPECT_TRUE(hub0->update(changes, 1));
+  EXPECT_EQ(hub0->sources(), SourcesMap({{1, {{0xAA, {0, {}}}}}}));
+}
+
+TEST_F(BrokerTest, CyclicTopologiesConverge)
+{
+  const auto aa = store->getOrCreate("cache://aa@localhost");
+  const auto bb = store->getOrCreate("cache://bb@localhost");
+  const auto cc = store->getOrCreate("cache://cc@localhost");
+
+  aa->connect("cache://bb@localhost");
+  bb->connect("cache://cc@localhost");
+  cc->connect("cache://aa@localhost");
+
+  aa->append(10);
+  bb->append(20);
+
+  const Clock expected{{0xAA, 1}, {0xBB, 1}};
+  EXPECT_EQ(aa->clock(), expected);
+  EXPECT_EQ(bb->clock(), expected);
+  EXPECT_EQ(cc->clock(), expected);
+}
+
+TEST_F(BrokerTest, DisconnectedIdsAreDroppedFromCyclicTopologies)
+{
+  const auto aa = store->getOrCreate("cache://aa@localhost");
+  const auto bb = store->getOrCreate("cache://bb@localhost");
+  const auto cc = store->getOrCreate("cache://cc@localhost");
+  const auto dd = store->getOrCreate("cache://dd@localhost");
+
+  aa->connect("cache://bb@localhost");
+  bb->connect("cache://cc@localhost");
+  cc->connect("cache://aa@localhost");
+
+  const auto port = dd->connect("cache://aa@localhost").source();
+  EXPECT_TRUE(Provides(bb, 0xDD));
+  EXPECT_EQ(dd->disconnect(port), port);
+
+  for (const auto& broker : {aa, bb, cc}) {
+    EXPECT_FALSE(Provides(broker, 0xDD));
+  }
+}
+
+TEST_F(BrokerTest, AlternativeRoutesSurviveDisconnections)
+{
+  const auto aa = store->getOrCreate("cache://aa@localhost");
+  const auto bb = store->getOrCreate("cache://bb@localhost");
+  const auto cc = store->getOrCreate("cache://cc@localhost");
+  const auto dd = store->getOrCreate("cache://dd@localhost");
+  const auto ee = store->getOrCreate("cache://ee@localhost");
+
+  aa->connect("cache://bb@localhost");
+  bb->connect("cache://cc@localhost");
+  cc->connect("cache://dd@localhost");
+  dd->connect("cache://aa@localhost");
+
+  const auto port = ee->connect("cache://aa@localhost").source();
+  ee->connect("cache://cc@localhost");
+  EXPECT_EQ(ee->disconnect(port), port);
+
+  for (const auto& broker : {aa, bb, cc, dd}) {
+    EXPECT_TRUE(Provides(broker, 0xEE));
+  }
+}
+
+TEST_F(BrokerTest, RelaysThroughTheShortestRoute)
+{
+  const auto aa = std::make_shared<BrokerMock>();
+  const auto bb = std::make_shared<BrokerMock>();
+  const Data data{0xDD, 10, {}};
+
+  EXPECT_CALL(*aa, connect(_))
+    .WillOnce(Return(Connection(aa, 1, {}, {{0xDD, {2, {}}}})));
+  EXPECT_CALL(*bb, connect(_))
+    .WillOnce(Return(Connection(bb, 1, {}, {{0xDD, {1, {}}}})));
+  EXPECT_CALL(*aa, relay(_, _)).Times(0);
+  EXPECT_CALL(*bb, relay(data, 1)).WillOnce(Return(Clock{{0xDD, 1}}));
+
+  hub0->connect(Connection{aa});
+  hub0->connect(Connection{bb});
+
+  EXPECT_EQ(hub0->relay(data, 0), Clock({{0xDD, 1}}));
+}
+
+TEST_F(BrokerTest, RelayFailsOverToLongerRoutes)
+{
+  const auto aa = std::make_shared<BrokerMock>();
+  const auto bb = std::make_shared<BrokerMock>();
+  const Data data{0xDD, 10, {}};
+
+  EXPECT_CALL(*aa, connect(_))
+    .WillOnce(Return(Connection(aa, 1, {}, {{0xDD, {2, {}}}})));
+  EXPECT_CALL(*bb, connect(_))
+    .WillOnce(Return(Connection(bb, 1, {}, {{0xDD, {1, {}}}})));
+  EXPECT_CALL(*bb, relay(data, 1)).WillOnce(Return(Clock{{0, 0}}));
+  EXPECT_CALL(*aa, relay(data, 1)).WillOnce(Return(Clock{{0xDD, 1}}));
+
+  hub0->connect(Connection{aa});
+  hub0->connect(Connection{bb});
+
+  EXPECT_EQ(hub0->relay(data, 0), Clock({{0xDD, 1}}));
+}
+
+TEST_F(BrokerTest, RelayIsNotSentBackToTheSender)
+{
+  const auto aa = std::make_shared<BrokerMock>();
+
+  EXPECT_CALL(*aa, connect(_))
+    .WillOnce(Return(Connection(aa, 1, {}, {{0xDD, {1, {}}}})));
+  EXPECT_CALL(*aa, relay(_, _)).Times(0);
+
+  const auto port = hub0->connect(Connection{aa}).source();
+
+  EXPECT_FALSE(hub0->relay({0xDD, 10, {}}, port).valid());
+}
+
+TEST_F(BrokerTest, RelayStopsUsingDisconnectedRoutes)
+{
+  const auto aa = std::make_shared<BrokerMock>();
+  const Data data{0xDD, 10, {}};
+
+  EXPECT_CALL(*aa, connect(_))
+    .WillOnce(Return(Connection(aa, 1, {}, {{0xDD, {1, {}}}})));
+  EXPECT_CALL(*aa, relay(_, _)).Times(0);
+
+  const auto port = hub0->connect(Connection{aa}).source();
+  hub0->disconnect(port);
+
+  EXPECT_FALSE(hub0->relay(data, 0).valid());
+}
+
+TEST_F(BrokerTest, LagCountsTheEntriesEachPeerHasNotSeen)
+{
+  const auto cc = store->getOrCreate("cache://cc@localhost");
+  const auto aa = std::make_shared<BrokerMock>();
+
+  EXPECT_CALL(*aa, connect(_))
+    .WillOnce(Return(Connection(aa, 1, {}, {{0xAA, {0, {}}}})));
+  EXPECT_CALL(*aa, insert(An<const Entry&>(), _))
+    .WillOnce(Return(Clock{}))
+    .WillOnce(Return(Clock{{0xCC, 2}}));
+
+  const auto port = cc->connect(Connection{aa}).source();
+  cc->append(10);
+  const auto behind = cc->lag();
+  ASSERT_EQ(behind.size(), 1);
+  EXPECT_EQ(behind[0].port, port);
+  EXPECT_EQ(behind[0].id, 0xAA);
+  EXPECT_EQ(behind[0].behind, 1);
+  EXPECT_EQ(cc->lag(), behind);
+
+  cc->append(20);
+  const auto caughtUp = cc->lag();
+  ASSERT_EQ(caughtUp.size(), 1);
+  EXPECT_EQ(caughtUp[0].behind, 0);
+  EXPECT_GE(caughtUp[0].progress, behind[0].progress);
+}
+
+TEST_F(BrokerTest, LagTellsWhenThePeerAckedRatherThanWhenItWasAsked)
+{
+  const auto cc = store->getOrCreate("cache://cc@localhost");
+  const auto aa = std::make_shared<BrokerMock>();
+
+  EXPECT_CALL(*aa, connect(_))
+    .WillOnce(Return(Connection(aa, 1, {}, {{0xAA, {0, {}}}})));
+  EXPECT_CALL(*aa, insert(An<const Entry&>(), _))
+    .WillOnce(Return(Clock{{0xCC, 1}}));
+
+  cc->connect(Connection{aa});
+  const auto connected = std::chrono::system_clock::now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  const auto before = cc->lag();
+  ASSERT_EQ(before.size(), 1);
+  EXPECT_LE(before[0].progress, connected);
+
+  cc->append(10);
+  const auto acked = std::chrono::system_clock::now();
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  const auto after = cc->lag();
+  ASSERT_EQ(after.size(), 1);
+  EXPECT_GT(after[0].progress, connected);
+  EXPECT_LE(after[0].progress, acked);
+  EXPECT_EQ(cc->lag(), after);
+}
+
+TEST_F(BrokerTest, LagCountsTheEntriesAPeerHasNotAcked)
+{
+  const auto cc = store->getOrCreate("cache://cc@localhost");
+  const auto aa = std::make_shared<BrokerMock>();
+
+  EXPECT_CALL(*aa, connect(_))
+    .WillOnce(Return(Connection(aa, 1, {}, {{0xAA, {0, {}}}})));
+  // A peer acking later than it is sent entries, as batching stubs do.
+  EXPECT_CALL(*aa, insert(An<const Entry&>(), _))
+    .WillOnce(Return(Clock{}))
+    .WillOnce(Return(Clock{{0xCC, 1}}));
+
+  cc->connect(Connection{aa});
+  cc->append(10);
+  cc->append(20);
+  const auto peers = cc->lag();
+  ASSERT_EQ(peers.size(), 1);
+  EXPECT_EQ(peers[0].behind, 1);
+}
+
+TEST_F(BrokerTest, ScanResumesAfterAnEntryWithoutQueryingAgain)
+{
+  const auto aa = std::make_shared<BrokerMock>();
+  const EntryList entries{
+    {Clock{{0xAA, 1}}, Data{0xAA, 1, {}}},
+    {Clock{{0xAA, 2}}, Data{0xAA, 2, {}}},
+    {Clock{{0xAA, 3}}, Data{0xAA, 3, {}}},
+  };
+  EXPECT_CALL(*aa, clock()).WillRepeatedly(Return(Clock{{0xAA, 3}}));
+  EXPECT_CALL(*aa, query(Clock{}, 0)).Times(2).WillRepeatedly(Return(entries));
+
+  EntryList visited;
+  const auto visit = [&visited](const Entry& entry) {
+    visited.push_back(entry);
+    return visited.size() != 2;
+  };
+  EXPECT_FALSE(aa->scan({}, 0, visit));
+  EXPECT_TRUE(aa->scan({}, 0, visit, &visited.back()));
+  EXPECT_EQ(visited, entries);
+
+  const Entry unknown{Clock{{0xBB, 1}}, Data{0xBB, 1, {}}};
+  EXPECT_TRUE(aa->scan({}, 0, visit, &unknown));
+  EXPECT_EQ(visited, entries);
+}
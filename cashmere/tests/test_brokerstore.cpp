@@ -13,6 +13,7 @@
 //
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <cctype>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
@@ -65,3 +66,27 @@ TEST_F(BrokerStoreTest, GetPreviouslyCreatedBroker)
   const auto retrieved = store->getOrCreate("hub://aa@localhost");
   ASSERT_EQ(retrieved->url(), "hub://aa@localhost");
 }
+
+TEST_F(BrokerStoreTest, SpellingsOfTheSameUrlShareABroker)
+{
+  const auto hub = store->getOrCreate("hub://aa@localhost?a=1&b=2");
+  EXPECT_EQ(store->getOrCreate("HUB://AA@LocalHost?b=2&a=1"), hub);
+  EXPECT_NE(store->getOrCreate("hub://aa@localhost?a=1"), hub);
+  ASSERT_EQ(store->size(), 2);
+}
+
+TEST_F(BrokerStoreTest, ManySpellingsOfAUrlShareABroker)
+{
+  const auto hub = store->getOrCreate("hub://aa@localhost");
+  for (int spelling = 0; spelling < 1 << 9; ++spelling) {
+    std::string host = "localhost";
+    for (size_t i = 0; i < host.size(); ++i) {
+      if (spelling & (1 << i)) {
+        host[i] = std::toupper(host[i]);
+      }
+    }
+    EXPECT_EQ(store->getOrCreate("hub://aa@" + host), hub);
+  }
+  EXPECT_EQ(store->getOrCreate("unknown://aa@localhost"), nullptr);
+  ASSERT_EQ(store->size(), 1);
+}
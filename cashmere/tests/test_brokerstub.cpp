@@ -17,6 +17,9 @@
 #include <gtest/gtest.h>
 
 #include "cashmere/brokerbase.h"
+#include "cashmere/brokerstore.h"
+
+#include <utility>
 
 using namespace Cashmere;
 
@@ -25,3 +28,42 @@ TEST(Connection, DefaultCreatedStubIsInvalid)
   const Connection stub;
   ASSERT_THAT(stub.valid(), false);
 }
+
+TEST(Connection, CopiesShareTheirStateUntilOneChangesIt)
+{
+  Connection conn(nullptr, 1, Clock{{0xAA, 1}}, {{0xAA, {0, {{0xAA, 1}}}}});
+  Connection copy = conn;
+  EXPECT_EQ(&std::as_const(copy).provides(), &std::as_const(conn).provides());
+
+  copy.clock() = Clock{{0xAA, 2}};
+  EXPECT_EQ(std::as_const(conn).clock(), Clock({{0xAA, 1}}));
+  EXPECT_NE(&std::as_const(copy).provides(), &std::as_const(conn).provides());
+  EXPECT_EQ(std::as_const(copy).provides(), std::as_const(conn).provides());
+}
+
+TEST(Connection, FetchesOnlyWhenThePeerChanged)
+{
+  auto store = BrokerStore::create();
+  auto hub = store->getOrCreate("hub://ff@localhost");
+  auto aa = store->getOrCreate("cache://aa@localhost");
+  aa->connect(Connection{hub});
+
+  Connection conn(hub, 2);
+  EXPECT_TRUE(conn.fetch());
+  EXPECT_FALSE(conn.fetch());
+
+  aa->append(1);
+  EXPECT_TRUE(conn.fetch());
+  EXPECT_EQ(std::as_const(conn).clock(), hub->clock());
+  EXPECT_TRUE(std::as_const(conn).provides().contains(0xAA));
+
+  aa->append(2);
+  EXPECT_TRUE(conn.fetch());
+  EXPECT_EQ(std::as_const(conn).provides().at(0xAA).clock, aa->clock());
+
+  for (const auto port : hub->connectedPorts()) {
+    hub->disconnect(port);
+  }
+  EXPECT_TRUE(conn.fetch());
+  EXPECT_FALSE(std::as_const(conn).provides().contains(0xAA));
+}
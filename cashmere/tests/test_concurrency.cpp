@@ -0,0 +1,199 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "cashmere/brokerstore.h"
+
+#include <array>
+#include <atomic>
+#include <format>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace Cashmere;
+
+constexpr Time kEntries = 200;
+
+// Brokers are all created upfront, except by the tests of the store itself.
+struct ConcurrencyTest : public ::testing::Test
+{
+  void SetUp() override
+  {
+    store = BrokerStore::create();
+    for (const auto& url : kUrls) {
+      journals.push_back(store->getOrCreate(url));
+    }
+  }
+  static constexpr std::array kUrls{
+    "cache://aa@localhost", "cache://bb@localhost", "cache://cc@localhost",
+    "cache://dd@localhost", "cache://ee@localhost",
+  };
+  BrokerStoreBasePtr store;
+  std::vector<BrokerBasePtr> journals;
+};
+
+TEST_F(ConcurrencyTest, ConcurrentInsertQueryAndConnectConverge)
+{
+  const auto& [aa, bb, cc, dd, ee] =
+    std::tie(journals[0], journals[1], journals[2], journals[3], journals[4]);
+  aa->connect(kUrls[1]);
+  bb->connect(kUrls[2]);
+
+  std::atomic<size_t> writing = 3;
+  std::vector<std::thread> threads;
+  for (const auto& writer : {aa, bb, cc}) {
+    threads.emplace_back([&writing, writer] {
+      for (Time i = 0; i < kEntries; ++i) {
+        writer->append(1);
+      }
+      --writing;
+    });
+  }
+  threads.emplace_back([this, &writing] {
+    while (writing > 0) {
+      for (const auto& journal : journals) {
+        journal->query(journal->clock());
+        journal->versions();
+        journal->sources();
+      }
+    }
+  });
+  threads.emplace_back([&] {
+    dd->connect(kUrls[2]);
+    ee->connect(kUrls[3]);
+    ee->connect(kUrls[0]);
+  });
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  const Clock expected{{0xAA, kEntries}, {0xBB, kEntries}, {0xCC, kEntries}};
+  for (const auto& journal : journals) {
+    EXPECT_EQ(journal->clock(), expected) << journal->url();
+    EXPECT_EQ(journal->entries().size(), 3 * kEntries) << journal->url();
+  }
+}
+
+TEST_F(ConcurrencyTest, ConcurrentAppendsToTheSameJournalAreAllKept)
+{
+  const auto& aa = journals[0];
+  const auto& bb = journals[1];
+  aa->connect(kUrls[1]);
+
+  std::atomic<size_t> appended = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([&appended, aa] {
+      for (Time i = 0; i < kEntries; ++i) {
+        appended += aa->append(1);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(appended, 4 * kEntries);
+  EXPECT_EQ(aa->clock(), Clock({{0xAA, 4 * kEntries}}));
+  EXPECT_EQ(bb->clock(), aa->clock());
+}
+
+TEST_F(ConcurrencyTest, ConcurrentGetOrCreateKeepsASingleBrokerPerUrl)
+{
+  constexpr size_t kThreads = 8;
+  constexpr size_t kBrokers = 500;
+  std::vector<std::vector<BrokerBasePtr>> seen(
+    kThreads, std::vector<BrokerBasePtr>(kBrokers)
+  );
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < kThreads; ++t) {
+    threads.emplace_back([this, t, &seen] {
+      // Threads walk the same urls, each one from a different offset.
+      for (size_t i = 0; i < kBrokers; ++i) {
+        const auto n = (i + t * kBrokers / kThreads) % kBrokers;
+        const auto url = std::format("hub://{:x}@localhost", 0x1000 + n);
+        seen[t][n] = store->getOrCreate(url);
+        std::ignore = store->size();
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(store->size(), kUrls.size() + kBrokers);
+  for (size_t n = 0; n < kBrokers; ++n) {
+    ASSERT_NE(seen[0][n], nullptr);
+    for (size_t t = 1; t < kThreads; ++t) {
+      EXPECT_EQ(seen[t][n], seen[0][n]);
+    }
+  }
+}
+
+TEST_F(ConcurrencyTest, SnapshotsAreNotChangedByLaterWrites)
+{
+  const auto& aa = journals[0];
+  const auto& bb = journals[1];
+  aa->connect(kUrls[1]);
+
+  const auto before = aa->snapshot();
+  EXPECT_EQ(aa->snapshot(), before);
+  aa->append(1);
+  const auto after = aa->snapshot();
+
+  EXPECT_EQ(before->clock, Clock{});
+  EXPECT_EQ(after->clock, Clock({{0xAA, 1}}));
+  EXPECT_EQ(after->clock, aa->clock());
+  EXPECT_EQ(after->sources, aa->sources());
+  EXPECT_EQ(after->versions, aa->versions());
+  EXPECT_EQ(bb->snapshot()->clock, after->clock);
+}
+
+TEST_F(ConcurrencyTest, AnEntryAndItsDeliveriesAreCommittedOnce)
+{
+  const auto& aa = journals[0];
+  aa->connect(kUrls[1]);
+
+  const auto before = aa->snapshot();
+  aa->append(1);
+  const auto after = aa->snapshot();
+
+  EXPECT_EQ(after->generation, before->generation + 1);
+  EXPECT_EQ(after->versions.at(0xAA), Clock({{0xAA, 1}}));
+}
+
+TEST_F(ConcurrencyTest, SnapshotsAreConsistentDuringWrites)
+{
+  const auto& aa = journals[0];
+  aa->connect(kUrls[1]);
+
+  std::thread writer([aa] {
+    for (Time i = 0; i < kEntries; ++i) {
+      aa->append(1);
+    }
+  });
+  Time last = 0;
+  while (last < kEntries) {
+    const auto state = aa->snapshot();
+    const auto time = state->clock.count(0xAA) ? state->clock.at(0xAA) : 0;
+    EXPECT_GE(time, last);
+    EXPECT_EQ(state->sources.at(0).at(0xAA).clock, state->clock);
+    last = time;
+  }
+  writer.join();
+}
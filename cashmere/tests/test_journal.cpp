@@ -142,6 +142,25 @@ TEST_F(JournalTest, QueryEntries)
   ASSERT_EQ(journal->query(Clock{{0xAA, 2}, {0xBB, 1}}), expected);
 }
 
+TEST_F(JournalTest, ScanResumesAfterTheGivenEntry)
+{
+  testInsertEntries({
+    {Clock{{0xAA, 1}}, Data{0xAA, 1, {}}},
+    {Clock{{0xBB, 1}}, Data{0xBB, 10, {}}},
+    {Clock{{0xAA, 2}, {0xBB, 1}}, Data{0xAA, 2, Clock{{0xBB, 1}}}},
+    {Clock{{0xCC, 1}}, Data{0xCC, 100, {}}},
+  });
+
+  EntryList visited;
+  const auto visit = [&visited](const Entry& entry) {
+    visited.push_back(entry);
+    return visited.size() != 2;
+  };
+  EXPECT_FALSE(journal->scan({}, 0, visit));
+  EXPECT_TRUE(journal->scan({}, 0, visit, &visited.back()));
+  ASSERT_EQ(visited, journal->query());
+}
+
 TEST_F(JournalTest, ReportsProvidesItsOwnData)
 {
   const auto expected = SourcesMap{
@@ -158,6 +177,14 @@ TEST_F(JournalTest, RefusesEntriesOutOfOrder)
   ASSERT_EQ(clock.valid(), false);
 }
 
+TEST_F(JournalTest, RefusesEntriesFromUnknownPorts)
+{
+  const Entry entry{{{0xBB, 1}}, {0xBB, 10, {}}};
+  EXPECT_FALSE(journal->insert(entry, 7).valid());
+  EXPECT_FALSE(journal->insert(entry, static_cast<Source>(-1)).valid());
+  EXPECT_EQ(journal->clock(), Clock{});
+}
+
 TEST_F(JournalTest, UpdatePreemptivellyTheLocalCacheOnConnect)
 {
   const auto bb = std::make_shared<BrokerMock>();
@@ -112,6 +112,34 @@ TEST_F(JournalFileWithEntriesTest, RetrieveAllEntries)
   ASSERT_EQ(journal->entries(), list);
 }
 
+TEST_F(JournalFileWithEntriesTest, ForEachResumesAfterTheGivenEntry)
+{
+  const Entry after = {{{kFixtureId, 2}}, {kFixtureId, 20, {}}};
+  const EntryList expected = {
+    {{{kFixtureId, 3}}, {kFixtureId, 30, {}}}
+  };
+
+  EntryList visited;
+  EXPECT_TRUE(journal->forEach(
+    [&visited](const Entry& entry) {
+      visited.push_back(entry);
+      return true;
+    },
+    &after
+  ));
+  ASSERT_EQ(visited, expected);
+}
+
+TEST_F(JournalFileWithEntriesTest, ScanStopsWhenTheVisitorReturnsFalse)
+{
+  EntryList visited;
+  EXPECT_FALSE(journal->scan({}, 0, [&visited](const Entry& entry) {
+    visited.push_back(entry);
+    return visited.size() < 2;
+  }));
+  ASSERT_EQ(visited.size(), 2);
+}
+
 TEST_F(JournalFileTest, SeparateFilesPerJournal)
 {
   const std::string bbFilename = fs::path(tmpdir) / "00000000000000bb";
@@ -0,0 +1,123 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "cashmere/brokerstore.h"
+#include "cashmere/metrics.h"
+
+#include <thread>
+#include <vector>
+
+using namespace Cashmere;
+
+TEST(Metrics, CountsOfEveryThreadAddUp)
+{
+  const auto before = Metrics::Snapshot();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.emplace_back([] {
+      for (int j = 0; j < 1000; ++j) {
+        Metrics::Add(Counter::RelayHops);
+      }
+      Metrics::Record(Histogram::FanOut, 3);
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  const auto delta = Metrics::Snapshot() - before;
+  EXPECT_EQ(delta[Counter::RelayHops], 4000);
+  EXPECT_EQ(delta[Histogram::FanOut].count(), 4);
+  EXPECT_EQ(delta[Histogram::FanOut].sum, 12);
+}
+
+TEST(Metrics, HistogramBucketsArePowersOfTwo)
+{
+  EXPECT_EQ(HistogramData::Bucket(0), 0);
+  EXPECT_EQ(HistogramData::Bucket(1), 1);
+  EXPECT_EQ(HistogramData::Bucket(5), 3);
+  EXPECT_EQ(HistogramData::Bucket(UINT64_MAX), kHistogramBuckets - 1);
+  EXPECT_EQ(HistogramData::UpperBound(3), 7);
+
+  HistogramData histogram;
+  for (const auto value : {1, 2, 3, 100}) {
+    histogram.buckets[HistogramData::Bucket(value)]++;
+  }
+  EXPECT_EQ(histogram.percentile(0.5), 3);
+  EXPECT_EQ(histogram.percentile(1.0), 127);
+}
+
+TEST(Metrics, CountersAndHistogramsAreNamed)
+{
+  EXPECT_EQ(Metrics::Name(Counter::InsertsAccepted), "inserts_accepted");
+  EXPECT_EQ(Metrics::Name(Counter::FileEntriesRead), "file_entries_read");
+  EXPECT_EQ(
+    Metrics::Name(Counter::ReplicateFramesDropped), "replicate_frames_dropped"
+  );
+  EXPECT_EQ(Metrics::Name(Histogram::SaveNs), "save_ns");
+  EXPECT_EQ(Metrics::Name(Histogram::FileReadNs), "file_read_ns");
+}
+
+TEST(Metrics, JournalsCountAcceptedAndRejectedInserts)
+{
+  auto store = BrokerStore::create();
+  auto journal = store->getOrCreate("cache://aa@localhost");
+
+  const auto before = Metrics::Snapshot();
+  journal->insert({{{0xAA, 1}}, {0xAA, 10, {}}});
+  journal->insert({{{0xAA, 1}}, {0xAA, 10, {}}});
+  journal->insert({{{0xAA, 3}}, {0xAA, 30, {}}});
+  journal->query();
+  const auto delta = Metrics::Snapshot() - before;
+
+  EXPECT_EQ(delta[Counter::InsertsAccepted], 1);
+  EXPECT_EQ(delta[Counter::InsertsRejected], 2);
+  EXPECT_EQ(delta[Histogram::SaveNs].count(), 1);
+  EXPECT_EQ(delta[Counter::Queries], 1);
+  EXPECT_EQ(delta[Counter::QueriedEntries], 1);
+}
+
+TEST(Metrics, EntriesAreForwardedToEveryOtherPeer)
+{
+  auto store = BrokerStore::create();
+  auto hub = store->getOrCreate("hub://cc@localhost");
+  auto aa = store->getOrCreate("cache://aa@localhost");
+  auto bb = store->getOrCreate("cache://bb@localhost");
+  aa->connect(Connection{hub});
+  bb->connect(Connection{hub});
+
+  const auto before = Metrics::Snapshot();
+  aa->append(10);
+  const auto delta = Metrics::Snapshot() - before;
+
+  // aa sends it to the hub, the hub to bb, which has no other peer.
+  EXPECT_EQ(delta[Counter::InsertsAccepted], 3);
+  EXPECT_EQ(delta[Counter::EntriesForwarded], 2);
+  EXPECT_EQ(delta[Histogram::FanOut].count(), 3);
+}
+
+TEST(Metrics, GaugesKeepTheirLevelAcrossThreads)
+{
+  const auto before = Metrics::Snapshot()[Gauge::ReplicationQueue];
+  std::thread([] { Metrics::Adjust(Gauge::ReplicationQueue, 3); }).join();
+  Metrics::Adjust(Gauge::ReplicationQueue, -1);
+
+  const auto after = Metrics::Snapshot();
+  EXPECT_EQ(after[Gauge::ReplicationQueue] - before, 2);
+  EXPECT_EQ((after - after)[Gauge::ReplicationQueue], before + 2);
+  Metrics::Adjust(Gauge::ReplicationQueue, -2);
+}
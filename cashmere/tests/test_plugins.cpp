@@ -19,6 +19,10 @@
 #include "storeimpl.h"
 #include "cashmere/utils/file.h"
 
+#include <filesystem>
+#include <fstream>
+
+using testing::ElementsAre;
 using testing::IsSupersetOf;
 using testing::ResultOf;
 
@@ -40,3 +44,29 @@ TEST(Plugin, LoadPlugins)
     )
   );
 }
+
+TEST(Plugin, LibrariesAreOpenedOnFirstUse)
+{
+  namespace fs = std::filesystem;
+  const TempDir temp;
+  const fs::path directory = temp.directory;
+  fs::copy_file(
+    InstallDirectory() / "lib/cashmere/plugins/libcache.so",
+    directory / "libcopy.so", fs::copy_options::overwrite_existing
+  );
+  std::ofstream(directory / "libbroken.so") << "not a library";
+  std::ofstream(directory / "README") << "not a plugin";
+
+  auto plugins = Plugins::Of(directory);
+  EXPECT_EQ(Plugins::Of(directory), plugins);
+  EXPECT_THAT(plugins->schemas(), ElementsAre("broken", "copy"));
+  EXPECT_FALSE(plugins->loaded("copy"));
+
+  auto creators = Plugins::CreatorsOf<BrokerBase>(directory);
+  EXPECT_FALSE(plugins->loaded("copy"));
+  std::unique_ptr<BrokerBase> broker(creators["copy"]("copy://aa@localhost"));
+  ASSERT_NE(broker, nullptr);
+  EXPECT_TRUE(plugins->loaded("copy"));
+  EXPECT_EQ(creators["broken"]("broken://aa@localhost"), nullptr);
+  EXPECT_FALSE(plugins->loaded("broken"));
+}
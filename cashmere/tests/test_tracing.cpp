@@ -0,0 +1,153 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "cashmere/brokerstore.h"
+#include "cashmere/tracing.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string_view>
+#include <thread>
+
+using namespace Cashmere;
+
+namespace
+{
+
+const SpanRecord*
+Find(const std::vector<SpanRecord>& spans, std::string_view name)
+{
+  for (const auto& span : spans) {
+    if (span.name == name) {
+      return &span;
+    }
+  }
+  return nullptr;
+}
+
+}
+
+TEST(Tracing, SpansAreOnlyRecordedWhileStarted)
+{
+  {
+    ScopedSpan span("before");
+  }
+  Tracing::Start();
+  {
+    ScopedSpan span("during");
+  }
+  Tracing::Stop();
+  {
+    ScopedSpan span("after");
+  }
+
+  const auto spans = Tracing::Spans();
+  ASSERT_EQ(spans.size(), 1);
+  EXPECT_STREQ(spans[0].name, "during");
+  EXPECT_TRUE(spans[0].context.valid());
+  EXPECT_EQ(spans[0].parent, 0);
+}
+
+TEST(Tracing, NestedSpansAreChildrenOfTheCurrentOne)
+{
+  Tracing::Start();
+  TraceContext outer;
+  {
+    ScopedSpan span("outer");
+    outer = Tracing::Current();
+    ScopedSpan inner("inner");
+    EXPECT_EQ(Tracing::Current().trace, outer.trace);
+  }
+  EXPECT_FALSE(Tracing::Current().valid());
+  Tracing::Stop();
+
+  const auto spans = Tracing::Spans();
+  const auto* inner = Find(spans, "inner");
+  ASSERT_NE(inner, nullptr);
+  EXPECT_EQ(inner->context.trace, outer.trace);
+  EXPECT_EQ(inner->parent, outer.span);
+  EXPECT_FALSE(inner->remoteParent);
+}
+
+TEST(Tracing, SpansContinueTheContextOfAnotherThread)
+{
+  const TraceContext remote{0xAA, 0xBB};
+  EXPECT_EQ(TraceContext::From(remote.str()), remote);
+  EXPECT_FALSE(TraceContext::From("garbage").valid());
+
+  Tracing::Start();
+  std::thread([&remote] { ScopedSpan span("handler", remote); }).join();
+  Tracing::Stop();
+
+  const auto spans = Tracing::Spans();
+  ASSERT_EQ(spans.size(), 1);
+  EXPECT_EQ(spans[0].context.trace, 0xAA);
+  EXPECT_EQ(spans[0].parent, 0xBB);
+  EXPECT_TRUE(spans[0].remoteParent);
+}
+
+TEST(Tracing, AppendsAreTracedThroughTheFanOut)
+{
+  auto store = BrokerStore::create();
+  auto hub = store->getOrCreate("hub://cc@localhost");
+  auto aa = store->getOrCreate("cache://aa@localhost");
+  auto bb = store->getOrCreate("cache://bb@localhost");
+  aa->connect(Connection{hub});
+  bb->connect(Connection{hub});
+
+  Tracing::Start();
+  aa->append(10);
+  Tracing::Stop();
+
+  const auto spans = Tracing::Spans();
+  const auto* append = Find(spans, "journal.append");
+  ASSERT_NE(append, nullptr);
+  size_t inserts = 0;
+  for (const auto& span : spans) {
+    EXPECT_EQ(span.context.trace, append->context.trace) << span.name;
+    inserts += std::string_view(span.name) == "journal.insert";
+  }
+  EXPECT_EQ(inserts, 1);
+  EXPECT_NE(Find(spans, "journal.save"), nullptr);
+  EXPECT_NE(Find(spans, "broker.fanout"), nullptr);
+  EXPECT_NE(Find(spans, "broker.send"), nullptr);
+}
+
+TEST(Tracing, SpansAreWrittenAsChromeTraceEvents)
+{
+  const auto path =
+    std::filesystem::temp_directory_path() / "cashmere_test_trace.json";
+  Tracing::Start(path);
+  std::thread([] {
+    ScopedSpan span("remote", {0xAA, 0xBB});
+  }).join();
+  ASSERT_TRUE(Tracing::Stop());
+
+  std::ifstream in(path);
+  std::stringstream json;
+  json << in.rdbuf();
+  std::filesystem::remove(path);
+  EXPECT_THAT(json.str(), ::testing::StartsWith("{\"traceEvents\":["));
+  EXPECT_THAT(json.str(), ::testing::HasSubstr("\"name\":\"remote\""));
+  EXPECT_THAT(json.str(), ::testing::HasSubstr("\"ph\":\"X\""));
+  EXPECT_THAT(json.str(), ::testing::HasSubstr("\"trace\":\"aa\""));
+  EXPECT_THAT(
+    json.str(), ::testing::HasSubstr("\"ph\":\"f\",\"bp\":\"e\",\"id\":\"bb\"")
+  );
+}
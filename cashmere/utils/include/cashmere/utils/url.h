@@ -30,8 +30,16 @@ struct CASHMERE_EXPORT Url
   std::string id;
   std::string hostport;
   std::string path;
+  std::string query;
 
   bool valid() const;
+  std::string option(const std::string& key, const std::string& otherwise = {})
+    const;
+  // The url spelled the same way as every other one of the same endpoint and
+  // options: schema, id and host in lower case and options sorted by name,
+  // without the empty ones between two separators. Options of the same name,
+  // and options without a value like `a=`, are kept as they were.
+  std::string key() const;
   auto operator<=>(const Url&) const = default;
 };
 
@@ -15,21 +15,64 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "cashmere/utils/url.h"
 
-#include <regex>
+#include <algorithm>
+#include <cctype>
+#include <string_view>
+#include <vector>
 
 namespace Cashmere
 {
 
-constexpr char const* kRegexStr = "([^:]*):/{2}(([^/][^@]*)@){0,1}([^/]*){0,1}(/.*){0,1}";
+namespace
+{
+
+std::string Lower(std::string_view text)
+{
+  std::string out(text);
+  std::ranges::transform(out, out.begin(), [](unsigned char c) {
+    return std::tolower(c);
+  });
+  return out;
+}
+
+}
+
+// <schema>://[<id>@]<hostport>[<path>][?<query>], split by hand rather than
+// by a regex, which would have to be compiled on every call.
 Url ParseUrl(const std::string& url)
 {
-  auto regex = std::regex(kRegexStr);
-  std::smatch matches;
-  std::regex_search(url, matches, regex);
-  if (matches.size() > 5) {
-    return {url, matches[1], matches[3], matches[4], matches[5]};
+  const std::string_view text = url;
+  const size_t separator = text.find("://");
+  if (separator == text.npos) {
+    return {url, "", "", "", "", ""};
+  }
+  auto schema = text.substr(0, separator);
+  schema.remove_prefix(schema.rfind(':') + 1);
+
+  auto rest = text.substr(separator + 3);
+  std::string_view query;
+  if (const size_t mark = rest.find('?'); mark != rest.npos) {
+    query = rest.substr(mark + 1);
+    rest = rest.substr(0, mark);
   }
-  return {url, "", "", "", ""};
+  std::string_view path;
+  if (const size_t slash = rest.find('/'); slash != rest.npos) {
+    path = rest.substr(slash);
+    rest = rest.substr(0, slash);
+  }
+  std::string_view id;
+  if (const size_t at = rest.find('@'); at != rest.npos) {
+    id = rest.substr(0, at);
+    rest = rest.substr(at + 1);
+  }
+  return {
+    url,
+    std::string(schema),
+    std::string(id),
+    std::string(rest),
+    std::string(path),
+    std::string(query)
+  };
 }
 
 bool Url::valid() const
@@ -37,10 +80,66 @@ bool Url::valid() const
   return url.size() > 0 && schema.size() > 0 && (id.size() > 0 || hostport.size() > 0);
 }
 
+std::string Url::option(const std::string& key, const std::string& otherwise)
+  const
+{
+  size_t begin = 0;
+  while (begin < query.size()) {
+    size_t end = query.find('&', begin);
+    if (end == std::string::npos) {
+      end = query.size();
+    }
+    const auto item = query.substr(begin, end - begin);
+    const size_t equal = item.find('=');
+    if (item.substr(0, equal) == key) {
+      return equal == std::string::npos ? "" : item.substr(equal + 1);
+    }
+    begin = end + 1;
+  }
+  return otherwise;
+}
+
+std::string Url::key() const
+{
+  if (schema.empty()) {
+    return url;
+  }
+  std::string out = Lower(schema) + "://";
+  if (!id.empty()) {
+    out += Lower(id) + "@";
+  }
+  out += Lower(hostport) + path;
+
+  std::vector<std::string_view> options;
+  const std::string_view items = query;
+  size_t begin = 0;
+  while (begin < items.size()) {
+    size_t end = items.find('&', begin);
+    if (end == items.npos) {
+      end = items.size();
+    }
+    if (end > begin) {
+      options.push_back(items.substr(begin, end - begin));
+    }
+    begin = end + 1;
+  }
+  // By name only, for option() to find the same one of a repeated name.
+  std::ranges::stable_sort(options, {}, [](std::string_view option) {
+    return option.substr(0, option.find('='));
+  });
+  char separator = '?';
+  for (const auto& option : options) {
+    out += separator;
+    out += option;
+    separator = '&';
+  }
+  return out;
+}
+
 std::ostream& operator<<(std::ostream& os, const Url& data)
 {
   return os << "{" << data.url << ", " << data.id << ", " << data.hostport
-            << ", " << data.path << "}";
+            << ", " << data.path << ", " << data.query << "}";
 }
 
 }
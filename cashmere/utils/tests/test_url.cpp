@@ -34,12 +34,46 @@ TEST_P(StringToUrlTest, FromString)
 INSTANTIATE_TEST_SUITE_P(
   Url, StringToUrlTest,
   ::testing::Values(
-    std::tuple<std::string, Url>{"ssh://localhost", Url{"ssh://localhost", "ssh", "", "localhost", "" }},
-    std::tuple<std::string, Url>{"ssh://localhost", Url{"ssh://localhost", "ssh", "", "localhost", "" }},
-    std::tuple<std::string, Url>{"ssh://user@host", Url{"ssh://user@host", "ssh", "user", "host", "" }},
-    std::tuple<std::string, Url>{"ssh://u:p@h:p", Url{"ssh://u:p@h:p", "ssh", "u:p", "h:p", "" }},
-    std::tuple<std::string, Url>{"ssh://u:p@h:p/pa/th", Url{"ssh://u:p@h:p/pa/th", "ssh", "u:p", "h:p", "/pa/th" }},
-    std::tuple<std::string, Url>{"ssh://", Url{"ssh://", "ssh", "", "", "" }},
-    std::tuple<std::string, Url>{"invalidurl", Url{"invalidurl", "", "", "", "" }}
+    std::tuple<std::string, Url>{"ssh://localhost", Url{"ssh://localhost", "ssh", "", "localhost", "", "" }},
+    std::tuple<std::string, Url>{"ssh://localhost", Url{"ssh://localhost", "ssh", "", "localhost", "", "" }},
+    std::tuple<std::string, Url>{"ssh://user@host", Url{"ssh://user@host", "ssh", "user", "host", "", "" }},
+    std::tuple<std::string, Url>{"ssh://u:p@h:p", Url{"ssh://u:p@h:p", "ssh", "u:p", "h:p", "", "" }},
+    std::tuple<std::string, Url>{"ssh://u:p@h:p/pa/th", Url{"ssh://u:p@h:p/pa/th", "ssh", "u:p", "h:p", "/pa/th", "" }},
+    std::tuple<std::string, Url>{"ssh://h:p?a=1", Url{"ssh://h:p?a=1", "ssh", "", "h:p", "", "a=1" }},
+    std::tuple<std::string, Url>{"ssh://u@h/pa/th?a=1&b", Url{"ssh://u@h/pa/th?a=1&b", "ssh", "u", "h", "/pa/th", "a=1&b" }},
+    std::tuple<std::string, Url>{"ssh://h?a=u@h", Url{"ssh://h?a=u@h", "ssh", "", "h", "", "a=u@h" }},
+    std::tuple<std::string, Url>{"ssh://", Url{"ssh://", "ssh", "", "", "", "" }},
+    std::tuple<std::string, Url>{"invalidurl", Url{"invalidurl", "", "", "", "", "" }}
   )
 );
+
+TEST(Url, OptionsAreReadFromTheQuery)
+{
+  const auto url = ParseUrl("grpc://localhost:5000?batch=256&flush_ms=2&flag");
+  EXPECT_EQ(url.option("batch"), "256");
+  EXPECT_EQ(url.option("flush_ms"), "2");
+  EXPECT_EQ(url.option("flag", "unset"), "");
+  EXPECT_EQ(url.option("missing", "unset"), "unset");
+}
+
+TEST(Url, KeyIsTheSameForEverySpelling)
+{
+  const auto key = ParseUrl("grpc://aa@localhost:5000/p?a=1&b=2").key();
+  EXPECT_EQ(key, "grpc://aa@localhost:5000/p?a=1&b=2");
+  EXPECT_EQ(ParseUrl("GRPC://AA@LocalHost:5000/p?b=2&&a=1").key(), key);
+  EXPECT_NE(ParseUrl("grpc://aa@localhost:5000/P?a=1&b=2").key(), key);
+  EXPECT_EQ(ParseUrl("hub://").key(), "hub://");
+  EXPECT_EQ(ParseUrl("invalidurl").key(), "invalidurl");
+}
+
+TEST(Url, KeyKeepsTheOrderOfRepeatedOptions)
+{
+  const auto first =
+    ParseUrl(ParseUrl("grpc://localhost:5000?b=1&a=2&a=1").key());
+  EXPECT_EQ(first.url, "grpc://localhost:5000?a=2&a=1&b=1");
+  EXPECT_EQ(first.option("a"), "2");
+  EXPECT_NE(ParseUrl("grpc://localhost:5000?a=1&a=2").key(), first.url);
+  EXPECT_EQ(
+    ParseUrl("grpc://localhost:5000?b=1&a=").key(), "grpc://localhost:5000?a=&b=1"
+  );
+}
@@ -0,0 +1,139 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <benchmark/benchmark.h>
+
+#include "cashmere/brokerstore.h"
+#include "cashmere/brokerwrapper.h"
+
+#include <format>
+#include <thread>
+#include <vector>
+
+using namespace Cashmere;
+
+namespace
+{
+
+constexpr uint16_t kBasePort = 50710;
+constexpr int64_t kEntries = 1000;
+
+// In-process chain of cache journals, each served by its own gRPC runner on
+// the loopback interface and connected to the next one through a gRPC stub.
+class Chain
+{
+public:
+  Chain(size_t size, const std::string& options)
+    : _store(BrokerStore::create())
+    , _wrappers(WrapperStore::create())
+  {
+    for (size_t i = 0; i < size; ++i) {
+      auto journal =
+        _store->getOrCreate(std::format("cache://{:x}@localhost", 0xa0 + i));
+      auto runner = _wrappers->getOrCreate(address(i));
+      _threads.push_back(runner->start(journal));
+      _journals.push_back(journal);
+      _runners.push_back(runner);
+    }
+    for (size_t i = 0; i + 1 < size; ++i) {
+      _journals[i]->connect(address(i + 1) + options);
+    }
+  }
+
+  ~Chain()
+  {
+    for (auto& runner : _runners) {
+      runner->stop();
+    }
+    for (auto& thread : _threads) {
+      thread.join();
+    }
+  }
+
+  BrokerBasePtr front() const
+  {
+    return _journals.front();
+  }
+
+  BrokerBasePtr back() const
+  {
+    return _journals.back();
+  }
+
+private:
+  static std::string address(size_t i)
+  {
+    return std::format("grpc://127.0.0.1:{}", kBasePort + i);
+  }
+
+  BrokerStoreBasePtr _store;
+  WrapperStoreBasePtr _wrappers;
+  std::vector<BrokerBasePtr> _journals;
+  std::vector<WrapperBasePtr> _runners;
+  std::vector<std::thread> _threads;
+};
+
+// Appends kEntries to the head of a 3-node chain and waits until they reach
+// the tail. The relay to the tail flushes every pending batch on its way, so
+// it returns only once the tail holds all the appended entries.
+void AppendThroughChain(benchmark::State& state, const std::string& options)
+{
+  Chain chain(3, options);
+  const auto head = chain.front();
+  const Id tail = chain.back()->id();
+
+  for (auto _ : state) {
+    for (int64_t i = 0; i < kEntries; ++i) {
+      head->append(1);
+    }
+    if (!head->relay({tail, 0, {}}, 0).valid()) {
+      state.SkipWithError("relay to the tail of the chain failed");
+      break;
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kEntries);
+}
+
+void BM_ChainAppend(benchmark::State& state)
+{
+  const auto batch = state.range(0);
+  AppendThroughChain(
+    state,
+    batch > 1 ? std::format("?batch={}&flush_ms=2", batch) : std::string{}
+  );
+}
+
+// Entries sent as frames of a Replicate stream, with up to `window` of them
+// waiting for their ack.
+void BM_ChainReplicate(benchmark::State& state)
+{
+  AppendThroughChain(state, std::format("?replicate={}", state.range(0)));
+}
+
+}
+
+BENCHMARK(BM_ChainAppend)
+  ->ArgName("batch")
+  ->Arg(1)
+  ->Arg(256)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
+
+BENCHMARK(BM_ChainReplicate)
+  ->ArgName("window")
+  ->Arg(1)
+  ->Arg(64)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
@@ -0,0 +1,131 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <benchmark/benchmark.h>
+
+#include "cashmere/brokerstore.h"
+#include "cashmere/brokerwrapper.h"
+#include "cashmere/utils/grpc.h"
+
+#include <ctime>
+#include <format>
+#include <string>
+#include <thread>
+#include <zlib.h>
+
+using namespace Cashmere;
+
+namespace
+{
+
+constexpr uint16_t kPort = 50730;
+constexpr int64_t kEntries = 10000;
+// Entries per message of a QueryStream, as sent by the runner.
+constexpr size_t kChunkSize = 256;
+
+const char* const kAlgorithms[] = {"none", "deflate", "gzip"};
+
+// Size of the message once compressed the way gRPC does, with zlib at its
+// default level, in the gzip or zlib format.
+size_t CompressedSize(const std::string& message, bool gzip)
+{
+  z_stream stream{};
+  deflateInit2(
+    &stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 | (gzip ? 16 : 0), 8,
+    Z_DEFAULT_STRATEGY
+  );
+  std::string out(deflateBound(&stream, message.size()), '\0');
+  stream.next_in =
+    reinterpret_cast<Bytef*>(const_cast<char*>(message.data()));
+  stream.avail_in = message.size();
+  stream.next_out = reinterpret_cast<Bytef*>(out.data());
+  stream.avail_out = out.size();
+  deflate(&stream, Z_FINISH);
+  const size_t size = stream.total_out;
+  deflateEnd(&stream);
+  return size;
+}
+
+// Bytes the entries take on the wire, sent in chunks of packed entries.
+size_t WireBytes(const EntryList& entries, int64_t algorithm)
+{
+  size_t bytes = 0;
+  auto begin = entries.begin();
+  while (begin != entries.end()) {
+    auto end = begin;
+    for (size_t i = 0; i < kChunkSize && end != entries.end(); ++i) {
+      ++end;
+    }
+    Grpc::QueryResponse chunk;
+    Utils::SetEntries(
+      chunk.mutable_entries(), chunk.mutable_base(), EntryList(begin, end),
+      Grpc::PACKED_CLOCKS
+    );
+    const auto message = chunk.SerializeAsString();
+    bytes += algorithm == 0 ? message.size()
+                            : CompressedSize(message, algorithm == 2);
+    begin = end;
+  }
+  return bytes;
+}
+
+// Catch-up of a peer: a stub queries every entry of a journal served by a
+// runner compressing its responses with the given algorithm. The wire bytes
+// are those of the chunks the runner sends, and the cpu time is the one of
+// the whole process, client and server.
+void BM_CatchUpQuery(benchmark::State& state)
+{
+  const auto algorithm = state.range(0);
+  const auto url = std::format(
+    "grpc://127.0.0.1:{}?compression={}&compression_min_bytes=1024", kPort,
+    kAlgorithms[algorithm]
+  );
+
+  auto store = BrokerStore::create();
+  auto wrappers = WrapperStore::create();
+  auto journal = store->getOrCreate("cache://aa@localhost");
+  for (int64_t i = 0; i < kEntries; ++i) {
+    journal->append(i * 100);
+  }
+  auto runner = wrappers->getOrCreate(url);
+  auto thread = runner->start(journal);
+  auto stub = store->getOrCreate(std::format("grpc://127.0.0.1:{}", kPort));
+
+  const auto cpu = std::clock();
+  for (auto _ : state) {
+    if (stub->query().size() != kEntries) {
+      state.SkipWithError("the query missed entries");
+      break;
+    }
+  }
+  const double cpuMs = 1000.0 * (std::clock() - cpu) / CLOCKS_PER_SEC;
+
+  state.SetItemsProcessed(state.iterations() * kEntries);
+  state.counters["wire_bytes_per_entry"] =
+    static_cast<double>(WireBytes(journal->entries(), algorithm)) / kEntries;
+  state.counters["cpu_ms_per_query"] =
+    state.iterations() > 0 ? cpuMs / state.iterations() : 0.0;
+
+  runner->stop();
+  thread.join();
+}
+
+}
+
+BENCHMARK(BM_CatchUpQuery)
+  ->ArgName("none_deflate_gzip")
+  ->DenseRange(0, 2)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
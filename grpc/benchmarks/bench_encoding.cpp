@@ -0,0 +1,120 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <benchmark/benchmark.h>
+
+#include "cashmere/utils/grpc.h"
+
+#include <optional>
+#include <string>
+
+using namespace Cashmere;
+
+namespace
+{
+
+constexpr size_t kBatchSize = 256;
+constexpr size_t kWriters = 8;
+
+// A batch as a journal of kWriters writers appending in turns would send it:
+// every clock holds all the writers, a few ticks apart from each other.
+EntryList Batch()
+{
+  EntryList entries;
+  Clock clock;
+  for (size_t i = 0; i < kBatchSize; ++i) {
+    const Id id = 0xc0ffee00 + i % kWriters;
+    clock[id] += 1;
+    entries.push_back({clock, {id, static_cast<int64_t>(i), {}}});
+  }
+  return entries;
+}
+
+Grpc::Encoding EncodingOf(const benchmark::State& state)
+{
+  return static_cast<Grpc::Encoding>(state.range(0));
+}
+
+void BM_EncodeEntries(benchmark::State& state)
+{
+  const auto entries = Batch();
+  const auto encoding = EncodingOf(state);
+  std::string bytes;
+  for (auto _ : state) {
+    Grpc::InsertBatchRequest request;
+    Utils::SetEntries(
+      request.mutable_entries(), request.mutable_base(), entries, encoding
+    );
+    request.SerializeToString(&bytes);
+    benchmark::DoNotOptimize(bytes);
+  }
+  state.SetItemsProcessed(state.iterations() * kBatchSize);
+  state.counters["bytes_per_entry"] =
+    static_cast<double>(bytes.size()) / kBatchSize;
+}
+
+void BM_DecodeEntries(benchmark::State& state)
+{
+  const auto encoding = EncodingOf(state);
+  Grpc::InsertBatchRequest encoded;
+  Utils::SetEntries(
+    encoded.mutable_entries(), encoded.mutable_base(), Batch(), encoding
+  );
+  const auto bytes = encoded.SerializeAsString();
+  for (auto _ : state) {
+    Grpc::InsertBatchRequest request;
+    request.ParseFromString(bytes);
+    benchmark::DoNotOptimize(
+      Utils::EntriesFrom(request.entries(), request.base())
+    );
+  }
+  state.SetItemsProcessed(state.iterations() * kBatchSize);
+  state.counters["bytes_per_entry"] =
+    static_cast<double>(bytes.size()) / kBatchSize;
+}
+
+// An entry sent on to the next peer, either encoded again or as the bytes it
+// was received as.
+void BM_ForwardEntry(benchmark::State& state)
+{
+  const auto entry = Batch().back();
+  std::string received;
+  Utils::SetEncoded(&received, entry, Grpc::PACKED_CLOCKS);
+  std::optional<Utils::Forwarded> forwarded;
+  if (state.range(0)) {
+    forwarded.emplace(entry, received, Grpc::PACKED_CLOCKS);
+  }
+
+  Grpc::InsertRequest request;
+  for (auto _ : state) {
+    Utils::SetEncoded(request.mutable_entry(), entry, Grpc::PACKED_CLOCKS);
+    benchmark::DoNotOptimize(request);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+}
+
+BENCHMARK(BM_EncodeEntries)
+  ->ArgName("encoding")
+  ->Arg(Grpc::MAP_CLOCKS)
+  ->Arg(Grpc::PACKED_CLOCKS);
+
+BENCHMARK(BM_DecodeEntries)
+  ->ArgName("encoding")
+  ->Arg(Grpc::MAP_CLOCKS)
+  ->Arg(Grpc::PACKED_CLOCKS);
+
+BENCHMARK(BM_ForwardEntry)->ArgName("forwarded")->Arg(0)->Arg(1);
@@ -0,0 +1,291 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <benchmark/benchmark.h>
+
+#include "cashmere/brokerstore.h"
+#include "cashmere/brokerwrapper.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <format>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace Cashmere;
+
+namespace
+{
+
+constexpr uint16_t kPort = 50720;
+constexpr uint16_t kStalledPort = 50721;
+constexpr size_t kStalledCalls = 256;
+
+// A cache journal served by a gRPC runner on the loopback interface, and a
+// stub to it shared by all the client threads.
+struct Server
+{
+  BrokerStoreBasePtr store;
+  WrapperStoreBasePtr wrappers;
+  WrapperBasePtr runner;
+  std::thread thread;
+  BrokerBasePtr stub;
+};
+
+Server server;
+
+// The first argument is the number of completion queue threads of the
+// runner, 0 selects the synchronous one.
+void StartServer(const benchmark::State& state)
+{
+  const auto threads = state.range(0);
+  const auto url =
+    threads > 0 ? std::format("grpc://127.0.0.1:{}?threads={}", kPort, threads)
+                : std::format("grpc://127.0.0.1:{}", kPort);
+
+  server.store = BrokerStore::create();
+  server.wrappers = WrapperStore::create();
+  server.runner = server.wrappers->getOrCreate(url);
+  server.thread =
+    server.runner->start(server.store->getOrCreate("cache://aa@localhost"));
+  server.stub = server.store->getOrCreate(std::format("grpc://127.0.0.1:{}", kPort));
+}
+
+void StopServer(const benchmark::State&)
+{
+  server.runner->stop();
+  server.thread.join();
+  server = {};
+}
+
+template <class Call>
+void Load(benchmark::State& state, Call call)
+{
+  using Clock = std::chrono::steady_clock;
+  std::vector<double> latencies;
+  for (auto _ : state) {
+    const auto start = Clock::now();
+    call();
+    latencies.push_back(
+      std::chrono::duration<double, std::micro>(Clock::now() - start).count()
+    );
+  }
+  std::sort(latencies.begin(), latencies.end());
+  const auto p99 = latencies.empty() ? 0.0 : latencies[latencies.size() * 99 / 100];
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["p99_us"] =
+    benchmark::Counter(p99, benchmark::Counter::kAvgThreads);
+}
+
+// Entries relayed to the journal, each one is appended and acknowledged.
+void BM_RunnerRelay(benchmark::State& state)
+{
+  Load(state, [] { server.stub->relay({0xAA, 1, {}}, 0); });
+}
+
+void BM_RunnerGetClock(benchmark::State& state)
+{
+  Load(state, [] { benchmark::DoNotOptimize(server.stub->clock()); });
+}
+
+// Broker whose relays wait until it is released, as if relaying them to a
+// peer that stopped answering. Everything else goes to its target.
+class Stalled : public BrokerBase
+{
+public:
+  explicit Stalled(BrokerBasePtr target)
+    : BrokerBase(target->url())
+    , _target(target)
+    , _released(false)
+    , _waiting(0)
+  {
+  }
+
+  std::string schema() const override
+  {
+    return _target->schema();
+  }
+
+  Connection connect(Connection conn) override
+  {
+    return _target->connect(conn);
+  }
+
+  bool refresh(const Connection& conn, Source sender) override
+  {
+    return _target->refresh(conn, sender);
+  }
+
+  Clock insert(const Entry& data, Source sender = 0) override
+  {
+    return _target->insert(data, sender);
+  }
+
+  EntryList query(const Clock& from = {}, Source sender = 0) const override
+  {
+    return _target->query(from, sender);
+  }
+
+  Clock clock() const override
+  {
+    return _target->clock();
+  }
+
+  IdClockMap versions() const override
+  {
+    return _target->versions();
+  }
+
+  SourcesMap sources(Source sender = 0) const override
+  {
+    return _target->sources(sender);
+  }
+
+  Clock relay(const Data& entry, Source sender) override
+  {
+    {
+      std::unique_lock lock(_mutex);
+      ++_waiting;
+      _changed.notify_all();
+      _changed.wait(lock, [this]() { return _released; });
+      --_waiting;
+    }
+    return _target->relay(entry, sender);
+  }
+
+  std::set<Source> connectedPorts() const override
+  {
+    return _target->connectedPorts();
+  }
+
+  Source disconnect(Source source) override
+  {
+    return _target->disconnect(source);
+  }
+
+  // Waits for `count` relays to be waiting, or for a second, returning how
+  // many are.
+  size_t waitFor(size_t count)
+  {
+    std::unique_lock lock(_mutex);
+    _changed.wait_for(lock, std::chrono::seconds(1), [this, count]() {
+      return _waiting >= count;
+    });
+    return _waiting;
+  }
+
+  void release(bool released)
+  {
+    std::lock_guard lock(_mutex);
+    _released = released;
+    _changed.notify_all();
+  }
+
+private:
+  BrokerBasePtr _target;
+  std::mutex _mutex;
+  std::condition_variable _changed;
+  bool _released;
+  size_t _waiting;
+};
+
+size_t ThreadCount()
+{
+  const std::filesystem::path tasks("/proc/self/task");
+  return std::distance(
+    std::filesystem::directory_iterator(tasks),
+    std::filesystem::directory_iterator()
+  );
+}
+
+// Sends a burst of relays to an asynchronous runner serving a stalled broker,
+// and reports how many of them were handled at once and how many threads the
+// process added, besides the clients, while they were stalled. The argument is
+// the `max_workers` option of the runner, which both have to stay within.
+void BM_RunnerStalledPeer(benchmark::State& state)
+{
+  const size_t maxWorkers = state.range(0);
+  auto store = BrokerStore::create();
+  auto wrappers = WrapperStore::create();
+  const auto stalled =
+    std::make_shared<Stalled>(store->getOrCreate("cache://aa@localhost"));
+  auto runner = wrappers->getOrCreate(std::format(
+    "grpc://127.0.0.1:{}?threads=4&max_workers={}", kStalledPort, maxWorkers
+  ));
+  auto thread = runner->start(stalled);
+  auto stub = store->getOrCreate(std::format("grpc://127.0.0.1:{}", kStalledPort));
+  stub->clock();
+
+  size_t handled = 0;
+  size_t added = 0;
+  for (auto _ : state) {
+    stalled->release(false);
+    const auto before = ThreadCount();
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < kStalledCalls; ++i) {
+      clients.emplace_back([&stub]() { stub->relay({0xAA, 1, {}}, 0); });
+    }
+    handled = std::max(handled, stalled->waitFor(kStalledCalls));
+    const auto during = ThreadCount();
+    added = std::max(added, during - std::min(during, before + kStalledCalls));
+    stalled->release(true);
+    for (auto& client : clients) {
+      client.join();
+    }
+  }
+
+  runner->stop();
+  thread.join();
+
+  state.counters["handled_at_once"] = handled;
+  state.counters["threads_added"] = added;
+  if (handled > maxWorkers) {
+    state.SkipWithError("more handlers ran at once than max_workers");
+  } else if (added > 2 * maxWorkers) {
+    state.SkipWithError("the runner added threads past max_workers");
+  }
+}
+
+}
+
+BENCHMARK(BM_RunnerRelay)
+  ->ArgName("cq_threads")
+  ->Arg(0)
+  ->Arg(4)
+  ->Setup(StartServer)
+  ->Teardown(StopServer)
+  ->ThreadRange(1, 32)
+  ->UseRealTime();
+
+BENCHMARK(BM_RunnerGetClock)
+  ->ArgName("cq_threads")
+  ->Arg(0)
+  ->Arg(4)
+  ->Setup(StartServer)
+  ->Teardown(StopServer)
+  ->ThreadRange(1, 32)
+  ->UseRealTime();
+
+BENCHMARK(BM_RunnerStalledPeer)
+  ->ArgName("max_workers")
+  ->Arg(8)
+  ->Arg(64)
+  ->Iterations(3)
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
@@ -17,7 +17,17 @@
 #define CASHMERE_BROKER_GRPC_STUB_H
 
 #include "cashmere/brokerbase.h"
+#include "cashmere/utils/grpc.h"
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <grpcpp/channel.h>
+#include <map>
+#include <mutex>
+#include <optional>
 #include <proto/cashmere.grpc.pb.h>
+#include <string>
+#include <vector>
 
 namespace Cashmere
 {
@@ -26,23 +36,129 @@ class BrokerGrpcStub;
 using BrokerGrpcStubPtr = std::shared_ptr<BrokerGrpcStub>;
 using BrokerGrpcStubWeakPtr = std::weak_ptr<BrokerGrpcStub>;
 
+// Inserts are coalesced and sent with a single InsertBatch call once
+// `entries` are pending or the oldest pending entry is `delay` old, or with
+// an Insert call each to peers that don't serve InsertBatch. Batching is
+// disabled unless `entries` is greater than one, and when the `batch` or
+// `flush_ms` options of the url are out of range: up to 65536 entries and
+// 60000 ms.
+struct BatchPolicy
+{
+  size_t entries = 0;
+  std::chrono::milliseconds delay = {};
+};
+
+// Arguments of the channel to the server, from the `keepalive_ms`,
+// `keepalive_timeout_ms` and `max_message_bytes` options of the url. Zero
+// values keep the gRPC defaults.
+struct ChannelPolicy
+{
+  std::chrono::milliseconds keepalive = {};
+  std::chrono::milliseconds keepaliveTimeout = {};
+  int maxMessageBytes = 0;
+
+  auto operator<=>(const ChannelPolicy&) const = default;
+};
+
+// Deadlines, retries and hedging of the calls, from the options of the url:
+// - `deadline_ms` bounds every call, `<method>_deadline_ms` the calls of one
+//   method: connect, insert, query, refresh, relay, clock, sources or lag.
+//   The Replicate stream waits for acks as long as the insert deadline, or
+//   10 seconds without one, before it is cancelled and opened again.
+// - `retries` is how many more times the idempotent calls (clock, query,
+//   sources and lag) are tried once they fail, waiting a random backoff of up
+//   to `backoff_ms` doubled on every retry, capped at `backoff_max_ms`.
+// - `hedge_ms` sends a query again to the next of the equivalent `peers`
+//   (host:port, separated by commas) every time that long passes without a
+//   response, and returns the first successful one.
+// - `compression` and `compression_min_bytes` select the requests and frames
+//   sent compressed, see Utils::Compression.
+// Zero values disable each of them.
+struct CallPolicy
+{
+  std::chrono::milliseconds deadline = {};
+  std::map<std::string, std::chrono::milliseconds> deadlines = {};
+  size_t retries = 0;
+  std::chrono::milliseconds backoff = std::chrono::milliseconds(20);
+  std::chrono::milliseconds maxBackoff = std::chrono::seconds(1);
+  std::chrono::milliseconds hedge = {};
+  std::vector<std::string> peers = {};
+  Utils::Compression compression = {};
+
+  std::chrono::milliseconds deadlineOf(const std::string& method) const;
+  // Time to wait before the given retry, starting at zero.
+  std::chrono::milliseconds backoffOf(size_t retry) const;
+
+  bool operator==(const CallPolicy&) const = default;
+};
+
+// Result of an asynchronous call, failed calls result in the same values the
+// synchronous ones return on failure. Cancelling a call makes it fail.
+template <class T>
+struct AsyncCall
+{
+  std::future<T> result;
+  std::shared_ptr<::grpc::ClientContext> context;
+
+  void cancel() const
+  {
+    context->TryCancel();
+  }
+};
+
 class CASHMERE_EXPORT BrokerGrpcStub : public BrokerBase
 {
 public:
   explicit BrokerGrpcStub(const std::string& url);
-  explicit BrokerGrpcStub(std::unique_ptr<Grpc::Broker::StubInterface>&& stub);
+  explicit BrokerGrpcStub(
+    std::unique_ptr<Grpc::Broker::StubInterface>&& stub,
+    const BatchPolicy& batch = {}, size_t inflight = 0, size_t window = 0,
+    const CallPolicy& calls = {},
+    std::vector<std::unique_ptr<Grpc::Broker::StubInterface>>&& peers = {}
+  );
+  ~BrokerGrpcStub() override;
 
   static BrokerBase* create(const std::string& url);
+  static BatchPolicy BatchPolicyFrom(const std::string& url);
+  // Number of inserts sent without waiting for their response, from the
+  // `inflight` option of the url. insert() blocks only once that many are
+  // pending. Pipelining is disabled unless it is greater than one. A server
+  // with several threads may take pipelined inserts out of order, journals
+  // then fetch the entries missing in between.
+  static size_t InflightFrom(const std::string& url);
+  // Number of frames sent without waiting for their ack, from the `replicate`
+  // option of the url. When set, inserts and refreshes are sent as frames of
+  // a single Replicate stream instead of one call each.
+  static size_t ReplicateWindowFrom(const std::string& url);
+  static ChannelPolicy ChannelPolicyFrom(const std::string& url);
+  // Channel shared by every stub to the same host and port with the same
+  // policy, whatever the rest of their urls and the name they give the host,
+  // which is resolved when the channel is looked up, so that their calls are
+  // multiplexed over a single connection. It is closed along with the last
+  // stub using it.
+  static std::shared_ptr<::grpc::Channel>
+  SharedChannel(const std::string& hostport, const ChannelPolicy& policy);
+  static CallPolicy CallPolicyFrom(const std::string& url);
 
   virtual Clock clock() const override;
   virtual IdClockMap versions() const override;
   virtual SourcesMap sources(Source sender = 0) const override;
+  // Lag of the peers of the remote broker.
+  virtual PeerLagList lag() const override;
   virtual Clock insert(const Entry& data, Source sender = 0) override;
+  virtual Clock insert(const EntryList& entries, Source sender = 0) override;
   virtual EntryList
   query(const Clock& from = {}, Source sender = 0) const override;
+  // Reads the entries from the QueryStream call, chunk by chunk as they
+  // arrive, cancelling it if the visit is stopped.
+  virtual bool scan(
+    const Clock& from, Source sender, const EntryVisitor& visit,
+    const Entry* after = nullptr
+  ) const override;
 
   virtual Connection connect(Connection conn) override;
   virtual bool refresh(const Connection& conn, Source sender) override;
+  virtual bool update(const Connection& changes, Source sender) override;
   virtual Clock relay(const Data& entry, Source sender) override;
 
   virtual std::string schema() const override {
@@ -55,9 +171,69 @@ public:
     return {};
   }
 
+  // Sends the inserts still pending and waits for their acks. Until then,
+  // insert() returns the clock the peer acked last, which may not hold the
+  // entry yet; this returns the one acking every entry sent.
+  Clock flush() const;
+
+  // Any number of these may be in flight at once on the channel. A zero
+  // deadline means the one of the call policy, if any.
+  AsyncCall<Clock> insertAsync(
+    const Entry& data, Source sender = 0,
+    std::chrono::milliseconds deadline = {}
+  ) const;
+  AsyncCall<EntryList> queryAsync(
+    const Clock& from = {}, Source sender = 0,
+    std::chrono::milliseconds deadline = {}
+  ) const;
+  AsyncCall<bool> refreshAsync(
+    const Connection& conn, Source sender, bool incremental = false,
+    std::chrono::milliseconds deadline = {}
+  ) const;
+  AsyncCall<Clock> relayAsync(
+    const Data& entry, Source sender, std::chrono::milliseconds deadline = {}
+  ) const;
+  AsyncCall<Clock> clockAsync(std::chrono::milliseconds deadline = {}) const;
+
 private:
+  bool refresh(const Connection& conn, Source sender, bool incremental);
+  Clock insertBatch(const EntryList& entries, Source sender) const;
+  Clock insertOne(const Entry& data, Source sender) const;
+  ::grpc::Status scanOnce(
+    const Clock& from, Source sender, const EntryVisitor& visit,
+    std::optional<Entry>& cursor, bool& stopped
+  ) const;
+  ::grpc::Status queryOnce(
+    const Grpc::QueryRequest& request, const EntryVisitor& visit,
+    std::optional<Entry>& cursor, bool& stopped
+  ) const;
+  EntryList hedgedQuery(const Clock& from, Source sender) const;
+
+  struct Batcher;
+  struct Pipeline;
+  struct Replicator;
+  Pipeline& pipeline() const;
+
   std::string _url;
   std::unique_ptr<Grpc::Broker::StubInterface> _stub;
+  size_t _inflight;
+  const CallPolicy _calls;
+  // Stubs to the peers equivalent to this one, that queries are hedged to.
+  std::vector<std::unique_ptr<Grpc::Broker::StubInterface>> _peers;
+  mutable std::once_flag _pipelineCreated;
+  mutable std::unique_ptr<Pipeline> _pipeline;
+  // Encoding of the entries, agreed on by connect().
+  std::atomic<Grpc::Encoding> _encoding;
+  // Whether the peer serves InsertBatch and QueryStream, until it answers it
+  // doesn't.
+  mutable std::atomic<bool> _batches;
+  mutable std::atomic<bool> _streams;
+  // Whether the peer applies incremental refreshes, as told by connect().
+  std::atomic<bool> _incremental;
+  // Last, so that they are flushed and closed while the members they send
+  // with are still alive.
+  std::unique_ptr<Replicator> _replicator;
+  std::unique_ptr<Batcher> _batcher;
 };
 
 }
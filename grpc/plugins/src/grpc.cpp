@@ -14,47 +14,1087 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "cashmere/plugins/grpc.h"
+#include "cashmere/metrics.h"
+#include "cashmere/tracing.h"
 #include "cashmere/utils/grpc.h"
+#include "cashmere/utils/random.h"
+#include "cashmere/utils/url.h"
 
+#include <netdb.h>
+#include <sys/socket.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <condition_variable>
+#include <deque>
+#include <format>
+#include <functional>
+#include <google/protobuf/arena.h>
 #include <google/protobuf/empty.pb.h>
 #include <grpc/grpc.h>
 #include <grpcpp/create_channel.h>
+#include <grpcpp/support/client_interceptor.h>
 #include <proto/cashmere.grpc.pb.h>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <proto/cashmere.pb.h>
+#include <thread>
 
 namespace Cashmere
 {
 
+namespace
+{
+using ::google::protobuf::Arena;
+
+const std::array<std::string, 8> kMethods = {
+  "connect", "insert", "query", "refresh", "relay", "clock", "sources", "lag"
+};
+constexpr size_t kMaxBatchEntries = 1 << 16;
+constexpr size_t kMaxFlushMs = 60000;
+constexpr std::chrono::milliseconds kReplicateAckTimeout =
+  std::chrono::seconds(10);
+constexpr size_t kMaxFrameRejections = 3;
+
+// The number in `text`, which stoul would wrap around if it were negative.
+size_t Bounded(const std::string& text, size_t max)
+{
+  const auto number = std::stoul(text);
+  if (text.find('-') != std::string::npos || number > max) {
+    throw std::out_of_range(text);
+  }
+  return number;
+}
+
+void SetDeadline(
+  ::grpc::ClientContext& context, std::chrono::milliseconds deadline
+)
+{
+  if (deadline.count() > 0) {
+    context.set_deadline(std::chrono::system_clock::now() + deadline);
+  }
+}
+
+// The given deadline, or the one of the policy if none was given.
+std::chrono::milliseconds
+Either(std::chrono::milliseconds given, std::chrono::milliseconds otherwise)
+{
+  return given.count() > 0 ? given : otherwise;
+}
+
+// Failures that may not happen again if the call is retried.
+bool Transient(const ::grpc::Status& status)
+{
+  switch (status.error_code()) {
+    case ::grpc::StatusCode::UNAVAILABLE:
+    case ::grpc::StatusCode::DEADLINE_EXCEEDED:
+    case ::grpc::StatusCode::RESOURCE_EXHAUSTED:
+    case ::grpc::StatusCode::ABORTED:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Makes the call until it succeeds, fails for good or runs out of retries.
+template <class Call>
+::grpc::Status Retry(const CallPolicy& policy, Call call)
+{
+  for (size_t retry = 0;; ++retry) {
+    const auto status = call();
+    if (status.ok() || retry >= policy.retries || !Transient(status)) {
+      return status;
+    }
+    std::this_thread::sleep_for(policy.backoffOf(retry));
+  }
+}
+
+// An asynchronous call in flight, tagged by its address on the completion
+// queue.
+struct Pending
+{
+  virtual ~Pending() = default;
+  virtual void complete() = 0;
+};
+
+template <class Response, class Result>
+struct PendingCall : public Pending
+{
+  using Convert =
+    std::function<Result(const ::grpc::Status&, const Response&)>;
+
+  void complete() override
+  {
+    promise.set_value(convert(status, *response));
+  }
+
+  std::shared_ptr<::grpc::ClientContext> context =
+    std::make_shared<::grpc::ClientContext>();
+  std::unique_ptr<::grpc::ClientAsyncResponseReaderInterface<Response>> reader;
+  Arena arena;
+  Response* response = Arena::CreateMessage<Response>(&arena);
+  ::grpc::Status status;
+  std::promise<Result> promise;
+  Convert convert;
+};
+
+template <class Response, class Result, class Prepare>
+AsyncCall<Result> Start(
+  ::grpc::CompletionQueue& queue, std::chrono::milliseconds deadline,
+  Prepare prepare, typename PendingCall<Response, Result>::Convert convert
+)
+{
+  auto call = std::make_unique<PendingCall<Response, Result>>();
+  SetDeadline(*call->context, deadline);
+  call->convert = std::move(convert);
+  AsyncCall<Result> out{call->promise.get_future(), call->context};
+
+  call->reader = prepare(call->context.get(), &queue);
+  call->reader->StartCall();
+  auto& pending = *call.release();
+  pending.reader->Finish(pending.response, &pending.status, &pending);
+  return out;
+}
+
+// Requests are built in place, so that the fields they hold are allocated on
+// the arena of the request, if any.
+void SetInsert(
+  Grpc::InsertRequest* request, const Entry& data, Source sender,
+  Grpc::Encoding encoding
+)
+{
+  request->set_sender(sender);
+  Utils::SetEncoded(request->mutable_entry(), data, encoding);
+}
+
+void SetInsertBatch(
+  Grpc::InsertBatchRequest* request, const EntryList& entries, Source sender,
+  Grpc::Encoding encoding
+)
+{
+  request->set_sender(sender);
+  Utils::SetEntries(
+    request->mutable_entries(), request->mutable_base(), entries, encoding
+  );
+}
+
+void SetQuery(
+  Grpc::QueryRequest* request, const Clock& from, Source sender,
+  Grpc::Encoding encoding
+)
+{
+  request->set_sender(sender);
+  request->set_encoding(encoding);
+  Utils::SetClock(request->mutable_clock(), from);
+}
+
+void SetRefresh(
+  Grpc::RefreshRequest* request, const Connection& conn, Source sender,
+  bool incremental
+)
+{
+  request->set_sender(sender);
+  request->set_source(conn.source());
+  request->set_incremental(incremental);
+  Utils::SetClock(request->mutable_clock(), conn.clock());
+  Utils::SetIdConnectionInfoMap(request->mutable_sources(), conn.provides());
+}
+
+void SetRelay(
+  Grpc::RelayInsertRequest* request, const Data& entry, Source sender,
+  Grpc::Encoding encoding
+)
+{
+  request->set_sender(sender);
+  Utils::SetEncoded(request->mutable_entry(), entry, encoding);
+}
+
+EntryList EntriesFrom(const Grpc::QueryResponse& response)
+{
+  return Utils::EntriesFrom(response.entries(), response.base());
+}
+
+// First complete response of the queries sent by a hedged query.
+struct Hedge
+{
+  std::mutex mutex;
+  std::condition_variable done;
+  std::optional<EntryList> entries;
+  size_t failed = 0;
+};
+
+// Compresses the request of the call if it is large enough. Responses are
+// compressed, or not, by the server.
+void SetCompression(
+  ::grpc::ClientContext& context, const ::google::protobuf::Message& request,
+  const Utils::Compression& compression
+)
+{
+  if (compression.algorithm != GRPC_COMPRESS_NONE &&
+      compression.compresses(request.ByteSizeLong())) {
+    context.set_compression_algorithm(compression.algorithm);
+  }
+}
+
+// Sends the context of the span the call is made from, if any, along with it.
+class TraceInterceptor : public ::grpc::experimental::Interceptor
+{
+public:
+  explicit TraceInterceptor(const TraceContext& trace)
+    : _trace(trace)
+  {
+  }
+
+  void Intercept(::grpc::experimental::InterceptorBatchMethods* methods
+  ) override
+  {
+    if (methods->QueryInterceptionHookPoint(
+          ::grpc::experimental::InterceptionHookPoints::
+            PRE_SEND_INITIAL_METADATA
+        )) {
+      methods->GetSendInitialMetadata()->insert(
+        {Utils::kTraceMetadata, _trace.str()}
+      );
+    }
+    methods->Proceed();
+  }
+
+private:
+  const TraceContext _trace;
+};
+
+// Interceptors are created by the thread making the call, the one whose
+// current span is the parent of the call.
+class TraceInterceptorFactory
+  : public ::grpc::experimental::ClientInterceptorFactoryInterface
+{
+public:
+  ::grpc::experimental::Interceptor*
+  CreateClientInterceptor(::grpc::experimental::ClientRpcInfo*) override
+  {
+    if (!Tracing::Enabled()) {
+      return nullptr;
+    }
+    const auto trace = Tracing::Propagate();
+    return trace.valid() ? new TraceInterceptor(trace) : nullptr;
+  }
+};
+
+std::shared_ptr<::grpc::Channel>
+CreateChannel(const std::string& hostport, const ChannelPolicy& policy)
+{
+  ::grpc::ChannelArguments args;
+  if (policy.keepalive.count() > 0) {
+    args.SetInt(GRPC_ARG_KEEPALIVE_TIME_MS, policy.keepalive.count());
+    args.SetInt(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+  }
+  if (policy.keepaliveTimeout.count() > 0) {
+    args.SetInt(
+      GRPC_ARG_KEEPALIVE_TIMEOUT_MS, policy.keepaliveTimeout.count()
+    );
+  }
+  if (policy.maxMessageBytes > 0) {
+    args.SetMaxReceiveMessageSize(policy.maxMessageBytes);
+    args.SetMaxSendMessageSize(policy.maxMessageBytes);
+  }
+  std::vector<
+    std::unique_ptr<::grpc::experimental::ClientInterceptorFactoryInterface>>
+    interceptors;
+  interceptors.push_back(std::make_unique<TraceInterceptorFactory>());
+  return ::grpc::experimental::CreateCustomChannelWithInterceptors(
+    hostport, ::grpc::InsecureChannelCredentials(), args,
+    std::move(interceptors)
+  );
+}
+
+// Address and port a host and port resolve to, the IPv4 one if there are
+// several, so that `localhost:5000` and `127.0.0.1:5000` name the same
+// peer. Hosts that don't resolve are only lowercased.
+std::string ResolvedHostPort(const std::string& hostport)
+{
+  std::string lowered = hostport;
+  std::transform(
+    lowered.begin(), lowered.end(), lowered.begin(),
+    [](unsigned char c) { return std::tolower(c); }
+  );
+  const auto colon = lowered.rfind(':');
+  if (colon == std::string::npos) {
+    return lowered;
+  }
+  std::string host = lowered.substr(0, colon);
+  const std::string port = lowered.substr(colon + 1);
+  if (host.size() > 1 && host.front() == '[' && host.back() == ']') {
+    host = host.substr(1, host.size() - 2);
+  }
+
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* found = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) {
+    return lowered;
+  }
+  const addrinfo* chosen = found;
+  for (auto* address = found; address; address = address->ai_next) {
+    if (address->ai_family == AF_INET) {
+      chosen = address;
+      break;
+    }
+  }
+  std::array<char, NI_MAXHOST> name{};
+  std::array<char, NI_MAXSERV> service{};
+  const bool named = getnameinfo(
+    chosen->ai_addr, chosen->ai_addrlen, name.data(), name.size(),
+    service.data(), service.size(), NI_NUMERICHOST | NI_NUMERICSERV
+  ) == 0;
+  const bool v6 = chosen->ai_family == AF_INET6;
+  freeaddrinfo(found);
+  if (!named) {
+    return lowered;
+  }
+  return v6 ? std::format("[{}]:{}", name.data(), service.data())
+            : std::format("{}:{}", name.data(), service.data());
+}
+
+// Channels in use, by the address and port they resolve to and policy.
+struct ChannelPool
+{
+  std::mutex mutex;
+  std::map<
+    std::pair<std::string, ChannelPolicy>, std::weak_ptr<::grpc::Channel>>
+    channels;
+};
+
+ChannelPool& Channels()
+{
+  static ChannelPool pool;
+  return pool;
+}
+}
+
+std::chrono::milliseconds CallPolicy::deadlineOf(const std::string& method
+) const
+{
+  const auto found = deadlines.find(method);
+  return found != deadlines.end() ? found->second : deadline;
+}
+
+std::chrono::milliseconds CallPolicy::backoffOf(size_t retry) const
+{
+  auto limit = backoff;
+  for (size_t i = 0; i < retry && limit < maxBackoff; ++i) {
+    limit *= 2;
+  }
+  limit = std::min(limit, maxBackoff);
+  if (limit.count() <= 0) {
+    return {};
+  }
+  thread_local Random random;
+  return std::chrono::milliseconds(random.next() % (limit.count() + 1));
+}
+
+// Completion queue of the asynchronous calls, with the thread completing
+// them, and the inserts pipelined by insert().
+struct BrokerGrpcStub::Pipeline
+{
+  Pipeline();
+  ~Pipeline();
+
+  Clock push(std::future<Clock> insert, size_t limit);
+  Clock drain();
+  void await(std::unique_lock<std::mutex>& lock, size_t pending);
+
+  ::grpc::CompletionQueue queue;
+  std::thread poller;
+
+  std::mutex mutex;
+  std::deque<std::future<Clock>> inflight;
+  Clock clock;
+};
+
+BrokerGrpcStub::Pipeline::Pipeline()
+  : poller([this]() {
+      void* tag = nullptr;
+      bool ok = false;
+      while (queue.Next(&tag, &ok)) {
+        std::unique_ptr<Pending>(static_cast<Pending*>(tag))->complete();
+      }
+    })
+{
+}
+
+BrokerGrpcStub::Pipeline::~Pipeline()
+{
+  drain();
+  queue.Shutdown();
+  poller.join();
+}
+
+// Returns the clock of the inserts completed so far, not the pushed one.
+Clock BrokerGrpcStub::Pipeline::push(std::future<Clock> insert, size_t limit)
+{
+  std::unique_lock lock(mutex);
+  await(lock, limit - 1);
+  inflight.push_back(std::move(insert));
+  Metrics::Adjust(Gauge::ReplicationQueue, 1);
+  return clock;
+}
+
+Clock BrokerGrpcStub::Pipeline::drain()
+{
+  std::unique_lock lock(mutex);
+  await(lock, 0);
+  return clock;
+}
+
+// Waits for the oldest inserts until only `pending` are left in flight.
+void BrokerGrpcStub::Pipeline::await(
+  std::unique_lock<std::mutex>& lock, size_t pending
+)
+{
+  while (inflight.size() > pending) {
+    auto oldest = std::move(inflight.front());
+    inflight.pop_front();
+    lock.unlock();
+    const auto remote = oldest.get();
+    Metrics::Adjust(Gauge::ReplicationQueue, -1);
+    lock.lock();
+    clock = clock.merge(remote);
+  }
+}
+
+struct BrokerGrpcStub::Batcher {
+  Batcher(const BrokerGrpcStub& stub, const BatchPolicy& policy);
+  ~Batcher();
+
+  Clock push(const Entry& entry, Source sender);
+  Clock flush();
+  void run();
+
+  const BrokerGrpcStub& stub;
+  const BatchPolicy policy;
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  EntryList pending;
+  Source sender;
+  Clock clock;
+  std::chrono::steady_clock::time_point since;
+  bool stopping;
+
+  std::mutex sending;
+  std::thread flusher;
+};
+
+BrokerGrpcStub::Batcher::Batcher(
+  const BrokerGrpcStub& stub, const BatchPolicy& policy
+)
+  : stub(stub)
+  , policy(policy)
+  , sender(0)
+  , stopping(false)
+  , flusher([this]() { run(); })
+{
+}
+
+BrokerGrpcStub::Batcher::~Batcher()
+{
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  changed.notify_one();
+  flusher.join();
+  flush();
+}
+
+Clock BrokerGrpcStub::Batcher::push(const Entry& entry, Source from)
+{
+  std::unique_lock lock(mutex);
+  while (!pending.empty() && sender != from) {
+    lock.unlock();
+    flush();
+    lock.lock();
+  }
+  if (pending.empty()) {
+    sender = from;
+    since = std::chrono::steady_clock::now();
+    changed.notify_one();
+  }
+  pending.push_back(entry);
+  Metrics::Adjust(Gauge::ReplicationQueue, 1);
+
+  // Entries are only acked once their batch is sent.
+  const auto out = clock;
+  const bool full = pending.size() >= policy.entries;
+  lock.unlock();
+
+  if (full) {
+    flush();
+  }
+  return out;
+}
+
+Clock BrokerGrpcStub::Batcher::flush()
+{
+  std::lock_guard send(sending);
+  EntryList entries;
+  Source from;
+  {
+    std::lock_guard lock(mutex);
+    entries.swap(pending);
+    from = sender;
+  }
+  if (entries.empty()) {
+    std::lock_guard lock(mutex);
+    return clock;
+  }
+  const auto remote = stub.insertBatch(entries, from);
+  Metrics::Adjust(
+    Gauge::ReplicationQueue, -static_cast<int64_t>(entries.size())
+  );
+  std::lock_guard lock(mutex);
+  clock = clock.merge(remote);
+  return clock;
+}
+
+void BrokerGrpcStub::Batcher::run()
+{
+  std::unique_lock lock(mutex);
+  while (!stopping) {
+    if (pending.empty()) {
+      changed.wait(lock);
+      continue;
+    }
+    const auto deadline = since + policy.delay;
+    if (std::chrono::steady_clock::now() < deadline) {
+      changed.wait_until(lock, deadline);
+      continue;
+    }
+    lock.unlock();
+    flush();
+    lock.lock();
+  }
+}
+
+// Long-lived Replicate stream carrying inserts and refreshes as frames, with
+// at most `window` frames waiting for their ack. A broken stream is reopened
+// by the next push, which first sends again the frames left without an ack.
+// A stream whose acks take longer than `timeout` is cancelled as broken, and
+// a frame the server rejected kMaxFrameRejections times is dropped.
+struct BrokerGrpcStub::Replicator
+{
+  using Stream = ::grpc::ClientReaderWriterInterface<
+    Grpc::ReplicateRequest, Grpc::ReplicateResponse>;
+
+  Replicator(
+    Grpc::Broker::StubInterface& stub, size_t window,
+    std::chrono::milliseconds timeout, const Utils::Compression& compression
+  );
+  ~Replicator();
+
+  std::optional<Clock> push(Grpc::ReplicateRequest frame);
+  Clock drain();
+  void settle(std::unique_lock<std::mutex>& lock);
+  void cancel();
+  bool open();
+  ::grpc::Status close();
+  void reject();
+  void read(Stream* stream);
+
+  Grpc::Broker::StubInterface& stub;
+  const size_t window;
+  const std::chrono::milliseconds timeout;
+  const Utils::Compression compression;
+
+  std::mutex sending;
+  std::unique_ptr<::grpc::ClientContext> context;
+  std::unique_ptr<Stream> stream;
+  std::thread reader;
+
+  std::mutex mutex;
+  std::condition_variable acked;
+  std::deque<Grpc::ReplicateRequest> unacked;
+  size_t rejections;
+  uint64_t sequence;
+  Clock clock;
+  bool broken;
+};
+
+BrokerGrpcStub::Replicator::Replicator(
+  Grpc::Broker::StubInterface& stub, size_t window,
+  std::chrono::milliseconds timeout, const Utils::Compression& compression
+)
+  : stub(stub)
+  , window(window)
+  , timeout(timeout)
+  , compression(compression)
+  , rejections(0)
+  , sequence(0)
+  , broken(false)
+{
+}
+
+BrokerGrpcStub::Replicator::~Replicator()
+{
+  std::lock_guard send(sending);
+  if (stream) {
+    std::unique_lock lock(mutex);
+    settle(lock);
+    lock.unlock();
+    stream->WritesDone();
+    close();
+  }
+  Metrics::Adjust(
+    Gauge::ReplicationQueue, -static_cast<int64_t>(unacked.size())
+  );
+}
+
+// Returns the clock of the last ack, which does not cover the frame yet.
+std::optional<Clock> BrokerGrpcStub::Replicator::push(
+  Grpc::ReplicateRequest frame
+)
+{
+  std::lock_guard send(sending);
+  std::unique_lock lock(mutex);
+  const auto room = acked.wait_for(lock, timeout, [this]() {
+    return broken || unacked.size() < window;
+  });
+  if (!room) {
+    cancel();
+    return std::nullopt;
+  }
+  if (!stream || broken) {
+    lock.unlock();
+    if (stream && close().error_code() == ::grpc::StatusCode::ABORTED) {
+      reject();
+    }
+    if (!open()) {
+      return std::nullopt;
+    }
+    lock.lock();
+  }
+  frame.set_sequence(++sequence);
+  if (const auto trace = Tracing::Propagate(); trace.valid()) {
+    frame.set_trace(trace.str());
+  }
+  unacked.push_back(frame);
+  Metrics::Adjust(Gauge::ReplicationQueue, 1);
+  const auto out = clock;
+  lock.unlock();
+
+  if (!stream->Write(frame, compression.options(frame.ByteSizeLong()))) {
+    return std::nullopt;
+  }
+  return out;
+}
+
+Clock BrokerGrpcStub::Replicator::drain()
+{
+  std::lock_guard send(sending);
+  std::unique_lock lock(mutex);
+  settle(lock);
+  return clock;
+}
+
+// Waits for the acks of the frames sent, cancelling the stream if they take
+// longer than the timeout.
+void BrokerGrpcStub::Replicator::settle(std::unique_lock<std::mutex>& lock)
+{
+  if (!acked.wait_for(lock, timeout, [this]() {
+        return broken || unacked.empty();
+      })) {
+    cancel();
+  }
+}
+
+// Marks the stream broken and ends its reader, as a stream whose server stops
+// acking is never finished by it. Called holding both locks.
+void BrokerGrpcStub::Replicator::cancel()
+{
+  broken = true;
+  if (context) {
+    context->TryCancel();
+  }
+}
+
+// Starts a new stream and sends it the frames the previous one left without
+// an ack. Those stay queued for the next stream if this one fails as well.
+bool BrokerGrpcStub::Replicator::open()
+{
+  context = std::make_unique<::grpc::ClientContext>();
+  if (compression.algorithm != GRPC_COMPRESS_NONE) {
+    context->set_compression_algorithm(compression.algorithm);
+  }
+  stream = stub.Replicate(context.get());
+  std::deque<Grpc::ReplicateRequest> resend;
+  {
+    std::lock_guard lock(mutex);
+    broken = false;
+    resend = unacked;
+  }
+  reader = std::thread(&Replicator::read, this, stream.get());
+  for (const auto& frame : resend) {
+    if (!stream->Write(frame, compression.options(frame.ByteSizeLong()))) {
+      std::lock_guard lock(mutex);
+      broken = true;
+      return false;
+    }
+  }
+  return true;
+}
+
+// Waits for the stream to end, once the server finished it or it broke.
+::grpc::Status BrokerGrpcStub::Replicator::close()
+{
+  reader.join();
+  const auto status = stream->Finish();
+  stream.reset();
+  context.reset();
+  return status;
+}
+
+// The server ends the stream at the first frame it rejects, which is the
+// oldest one left without an ack. Sending it again would end every stream
+// that follows the same way, so it is dropped once rejected too many times.
+void BrokerGrpcStub::Replicator::reject()
+{
+  std::lock_guard lock(mutex);
+  if (unacked.empty() || ++rejections < kMaxFrameRejections) {
+    return;
+  }
+  unacked.pop_front();
+  rejections = 0;
+  Metrics::Adjust(Gauge::ReplicationQueue, -1);
+  Metrics::Add(Counter::ReplicateFramesDropped);
+}
+
+void BrokerGrpcStub::Replicator::read(Stream* stream)
+{
+  Grpc::ReplicateResponse ack;
+  while (stream->Read(&ack)) {
+    std::lock_guard lock(mutex);
+    while (!unacked.empty() && unacked.front().sequence() <= ack.sequence()) {
+      unacked.pop_front();
+      rejections = 0;
+      Metrics::Adjust(Gauge::ReplicationQueue, -1);
+    }
+    clock = Utils::ClockView(ack.clock()).merge(std::move(clock));
+    acked.notify_all();
+  }
+  std::lock_guard lock(mutex);
+  broken = true;
+  acked.notify_all();
+}
+
 BrokerGrpcStub::BrokerGrpcStub(
-  std::unique_ptr<Grpc::Broker::StubInterface>&& stub
+  std::unique_ptr<Grpc::Broker::StubInterface>&& stub, const BatchPolicy& batch,
+  size_t inflight, size_t window, const CallPolicy& calls,
+  std::vector<std::unique_ptr<Grpc::Broker::StubInterface>>&& peers
 )
   : BrokerBase()
   , _url()
   , _stub(std::move(stub))
+  , _inflight(inflight)
+  , _calls(calls)
+  , _peers(std::move(peers))
+  , _encoding(Grpc::MAP_CLOCKS)
+  , _batches(true)
+  , _streams(true)
+  , _incremental(false)
+  , _replicator(
+      window > 0
+        ? std::make_unique<Replicator>(
+            *_stub, window,
+            Either(_calls.deadlineOf("insert"), kReplicateAckTimeout),
+            _calls.compression
+          )
+        : nullptr
+    )
+  , _batcher(
+      batch.entries > 1 ? std::make_unique<Batcher>(*this, batch) : nullptr
+    )
 {
 }
 
 BrokerGrpcStub::BrokerGrpcStub(const std::string& url)
   : BrokerBase(url)
-  , _stub(Grpc::Broker::NewStub(
-      grpc::CreateChannel(std::format("{}:{}", hostname(), port()), grpc::InsecureChannelCredentials())
-    ))
+  , _stub(Grpc::Broker::NewStub(SharedChannel(
+      std::format("{}:{}", hostname(), port()), ChannelPolicyFrom(url)
+    )))
+  , _inflight(InflightFrom(url))
+  , _calls(CallPolicyFrom(url))
+  , _encoding(Grpc::MAP_CLOCKS)
+  , _batches(true)
+  , _streams(true)
+  , _incremental(false)
 {
+  const auto channel = ChannelPolicyFrom(url);
+  for (const auto& peer : _calls.peers) {
+    _peers.push_back(Grpc::Broker::NewStub(SharedChannel(peer, channel)));
+  }
+  const auto window = ReplicateWindowFrom(url);
+  if (window > 0) {
+    _replicator = std::make_unique<Replicator>(
+      *_stub, window,
+      Either(_calls.deadlineOf("insert"), kReplicateAckTimeout),
+      _calls.compression
+    );
+  }
+  const auto batch = BatchPolicyFrom(url);
+  if (batch.entries > 1) {
+    _batcher = std::make_unique<Batcher>(*this, batch);
+  }
 }
 
+BrokerGrpcStub::~BrokerGrpcStub() = default;
+
 BrokerBase* BrokerGrpcStub::create(const std::string& url)
 {
     return new BrokerGrpcStub(url);
 }
 
+BatchPolicy BrokerGrpcStub::BatchPolicyFrom(const std::string& url)
+{
+  const Url parsed = ParseUrl(url);
+  BatchPolicy policy;
+  try {
+    policy.entries = Bounded(parsed.option("batch", "0"), kMaxBatchEntries);
+    policy.delay = std::chrono::milliseconds(
+      Bounded(parsed.option("flush_ms", "2"), kMaxFlushMs)
+    );
+  } catch (const std::exception&) {
+    return {};
+  }
+  return policy;
+}
+
+size_t BrokerGrpcStub::InflightFrom(const std::string& url)
+{
+  try {
+    return std::stoul(ParseUrl(url).option("inflight", "0"));
+  } catch (const std::exception&) {
+    return 0;
+  }
+}
+
+size_t BrokerGrpcStub::ReplicateWindowFrom(const std::string& url)
+{
+  try {
+    return std::stoul(ParseUrl(url).option("replicate", "0"));
+  } catch (const std::exception&) {
+    return 0;
+  }
+}
+
+ChannelPolicy BrokerGrpcStub::ChannelPolicyFrom(const std::string& url)
+{
+  const Url parsed = ParseUrl(url);
+  ChannelPolicy policy;
+  try {
+    policy.keepalive = std::chrono::milliseconds(
+      std::stoul(parsed.option("keepalive_ms", "0"))
+    );
+    policy.keepaliveTimeout = std::chrono::milliseconds(
+      std::stoul(parsed.option("keepalive_timeout_ms", "0"))
+    );
+    policy.maxMessageBytes = std::stoi(parsed.option("max_message_bytes", "0"));
+  } catch (const std::exception&) {
+    return {};
+  }
+  return policy;
+}
+
+std::shared_ptr<::grpc::Channel> BrokerGrpcStub::SharedChannel(
+  const std::string& hostport, const ChannelPolicy& policy
+)
+{
+  // Keyed by the address resolved when the stub is created, while the channel
+  // dials the host as given, to follow it if its address changes later.
+  const auto key = std::make_pair(ResolvedHostPort(hostport), policy);
+
+  auto& pool = Channels();
+  std::lock_guard lock(pool.mutex);
+  std::erase_if(pool.channels, [](const auto& item) {
+    return item.second.expired();
+  });
+  auto& shared = pool.channels[key];
+  auto channel = shared.lock();
+  if (!channel) {
+    channel = CreateChannel(hostport, policy);
+    shared = channel;
+  }
+  return channel;
+}
+
+CallPolicy BrokerGrpcStub::CallPolicyFrom(const std::string& url)
+{
+  const Url parsed = ParseUrl(url);
+  CallPolicy policy;
+  try {
+    policy.deadline =
+      std::chrono::milliseconds(std::stoul(parsed.option("deadline_ms", "0")));
+    for (const auto& method : kMethods) {
+      const auto deadline = parsed.option(method + "_deadline_ms");
+      if (!deadline.empty()) {
+        policy.deadlines[method] =
+          std::chrono::milliseconds(std::stoul(deadline));
+      }
+    }
+    policy.retries = std::stoul(parsed.option("retries", "0"));
+    policy.backoff =
+      std::chrono::milliseconds(std::stoul(parsed.option("backoff_ms", "20")));
+    policy.maxBackoff = std::chrono::milliseconds(
+      std::stoul(parsed.option("backoff_max_ms", "1000"))
+    );
+    policy.hedge =
+      std::chrono::milliseconds(std::stoul(parsed.option("hedge_ms", "0")));
+  } catch (const std::exception&) {
+    return {};
+  }
+  policy.compression = Utils::CompressionFrom(url);
+  const auto peers = parsed.option("peers");
+  size_t begin = 0;
+  while (begin < peers.size()) {
+    const auto end = std::min(peers.find(',', begin), peers.size());
+    if (end > begin) {
+      policy.peers.push_back(peers.substr(begin, end - begin));
+    }
+    begin = end + 1;
+  }
+  return policy;
+}
+
+Clock BrokerGrpcStub::flush() const
+{
+  Clock acked;
+  if (_batcher) {
+    acked = acked.merge(_batcher->flush());
+  }
+  if (_replicator) {
+    acked = acked.merge(_replicator->drain());
+  }
+  if (_inflight > 1) {
+    acked = acked.merge(pipeline().drain());
+  }
+  return acked;
+}
+
+BrokerGrpcStub::Pipeline& BrokerGrpcStub::pipeline() const
+{
+  std::call_once(_pipelineCreated, [this]() {
+    _pipeline = std::make_unique<Pipeline>();
+  });
+  return *_pipeline;
+}
+
+AsyncCall<Clock> BrokerGrpcStub::insertAsync(
+  const Entry& data, Source sender, std::chrono::milliseconds deadline
+) const
+{
+  Arena arena;
+  auto request = Arena::CreateMessage<Grpc::InsertRequest>(&arena);
+  SetInsert(request, data, sender, _encoding);
+  return Start<Grpc::InsertResponse, Clock>(
+    pipeline().queue, Either(deadline, _calls.deadlineOf("insert")),
+    [&](auto context, auto queue) {
+      SetCompression(*context, *request, _calls.compression);
+      return _stub->PrepareAsyncInsert(context, *request, queue);
+    },
+    [](const auto& status, const auto& response) {
+      return status.ok() ? Utils::ClockFrom(response.clock()) : Clock{};
+    }
+  );
+}
+
+AsyncCall<EntryList> BrokerGrpcStub::queryAsync(
+  const Clock& from, Source sender, std::chrono::milliseconds deadline
+) const
+{
+  Arena arena;
+  auto request = Arena::CreateMessage<Grpc::QueryRequest>(&arena);
+  SetQuery(request, from, sender, _encoding);
+  return Start<Grpc::QueryResponse, EntryList>(
+    pipeline().queue, Either(deadline, _calls.deadlineOf("query")),
+    [&](auto context, auto queue) {
+      return _stub->PrepareAsyncQuery(context, *request, queue);
+    },
+    [](const auto& status, const auto& response) {
+      return status.ok() ? EntriesFrom(response) : EntryList{};
+    }
+  );
+}
+
+AsyncCall<bool> BrokerGrpcStub::refreshAsync(
+  const Connection& conn, Source sender, bool incremental,
+  std::chrono::milliseconds deadline
+) const
+{
+  Arena arena;
+  auto request = Arena::CreateMessage<Grpc::RefreshRequest>(&arena);
+  SetRefresh(request, conn, sender, incremental);
+  return Start<::google::protobuf::Empty, bool>(
+    pipeline().queue, Either(deadline, _calls.deadlineOf("refresh")),
+    [&](auto context, auto queue) {
+      SetCompression(*context, *request, _calls.compression);
+      return _stub->PrepareAsyncRefresh(context, *request, queue);
+    },
+    [](const auto& status, const auto&) { return status.ok(); }
+  );
+}
+
+AsyncCall<Clock> BrokerGrpcStub::relayAsync(
+  const Data& entry, Source sender, std::chrono::milliseconds deadline
+) const
+{
+  Arena arena;
+  auto request = Arena::CreateMessage<Grpc::RelayInsertRequest>(&arena);
+  SetRelay(request, entry, sender, _encoding);
+  return Start<Grpc::InsertResponse, Clock>(
+    pipeline().queue, Either(deadline, _calls.deadlineOf("relay")),
+    [&](auto context, auto queue) {
+      SetCompression(*context, *request, _calls.compression);
+      return _stub->PrepareAsyncRelay(context, *request, queue);
+    },
+    [](const auto& status, const auto& response) {
+      return status.ok() ? Utils::ClockFrom(response.clock()) : Clock{{0, 0}};
+    }
+  );
+}
+
+AsyncCall<Clock>
+BrokerGrpcStub::clockAsync(std::chrono::milliseconds deadline) const
+{
+  const ::google::protobuf::Empty request;
+  return Start<Grpc::ClockResponse, Clock>(
+    pipeline().queue, Either(deadline, _calls.deadlineOf("clock")),
+    [&](auto context, auto queue) {
+      return _stub->PrepareAsyncGetClock(context, request, queue);
+    },
+    [](const auto& status, const auto& response) {
+      return status.ok() ? Utils::ClockFrom(response.clock()) : Clock{{0, 0}};
+    }
+  );
+}
+
 
 Clock BrokerGrpcStub::clock() const
 {
-  ::grpc::ClientContext context;
-  ::google::protobuf::Empty empty;
-  Grpc::ClockResponse response;
-  if (_stub->GetClock(&context, empty, &response).ok()) {
-    return Utils::ClockFrom(response.clock());
+  flush();
+  Arena arena;
+  auto empty = Arena::CreateMessage<::google::protobuf::Empty>(&arena);
+  auto response = Arena::CreateMessage<Grpc::ClockResponse>(&arena);
+  const auto status = Retry(_calls, [&]() {
+    ::grpc::ClientContext context;
+    SetDeadline(context, _calls.deadlineOf("clock"));
+    response->Clear();
+    return _stub->GetClock(&context, *empty, response);
+  });
+  if (status.ok()) {
+    return Utils::ClockFrom(response->clock());
   }
   return {{0, 0}};
 }
@@ -66,71 +1106,346 @@ IdClockMap BrokerGrpcStub::versions() const
 
 SourcesMap BrokerGrpcStub::sources([[maybe_unused]] Source sender) const
 {
-  ::grpc::ClientContext context;
-  Grpc::SourcesRequest request;
-  Grpc::SourcesResponse response;
-  request.set_sender(sender);
-  if (_stub->Sources(&context, request, &response).ok()) {
-    return Utils::SourcesFrom(response.sources());
+  flush();
+  Arena arena;
+  auto request = Arena::CreateMessage<Grpc::SourcesRequest>(&arena);
+  auto response = Arena::CreateMessage<Grpc::SourcesResponse>(&arena);
+  request->set_sender(sender);
+  const auto status = Retry(_calls, [&]() {
+    ::grpc::ClientContext context;
+    SetDeadline(context, _calls.deadlineOf("sources"));
+    response->Clear();
+    return _stub->Sources(&context, *request, response);
+  });
+  if (status.ok()) {
+    return Utils::SourcesFrom(response->sources());
+  }
+  return {};
+}
+
+PeerLagList BrokerGrpcStub::lag() const
+{
+  Arena arena;
+  auto empty = Arena::CreateMessage<::google::protobuf::Empty>(&arena);
+  auto response = Arena::CreateMessage<Grpc::LagResponse>(&arena);
+  const auto status = Retry(_calls, [&]() {
+    ::grpc::ClientContext context;
+    SetDeadline(context, _calls.deadlineOf("lag"));
+    response->Clear();
+    return _stub->Lag(&context, *empty, response);
+  });
+  if (status.ok()) {
+    return Utils::LagFrom(response->peers());
   }
   return {};
 }
 
 Clock BrokerGrpcStub::insert(const Entry& data, Source sender)
 {
-  Grpc::InsertRequest request;
-  request.set_sender(sender);
-  Utils::SetEntry(request.mutable_entry(), data);
+  if (_batcher) {
+    return _batcher->push(data, sender);
+  }
+  if (_replicator) {
+    Grpc::ReplicateRequest frame;
+    frame.mutable_entries()->set_sender(sender);
+    Utils::SetEntry(
+      frame.mutable_entries()->add_entries(), data, _encoding
+    );
+    return _replicator->push(frame).value_or(Clock{});
+  }
+  if (_inflight > 1) {
+    return pipeline().push(insertAsync(data, sender).result, _inflight);
+  }
+  return insertOne(data, sender);
+}
 
-  Grpc::InsertResponse response;
+Clock BrokerGrpcStub::insertOne(const Entry& data, Source sender) const
+{
+  Arena arena;
+  auto request = Arena::CreateMessage<Grpc::InsertRequest>(&arena);
+  auto response = Arena::CreateMessage<Grpc::InsertResponse>(&arena);
+  SetInsert(request, data, sender, _encoding);
   ::grpc::ClientContext context;
-  if (_stub->Insert(&context, request, &response).ok()) {
-    Clock out = Utils::ClockFrom(response.clock());
+  SetDeadline(context, _calls.deadlineOf("insert"));
+  SetCompression(context, *request, _calls.compression);
+  if (_stub->Insert(&context, *request, response).ok()) {
+    Clock out = Utils::ClockFrom(response->clock());
     return out;
   }
   return {};
 }
 
-EntryList BrokerGrpcStub::query(const Clock& from, Source sender) const
+Clock BrokerGrpcStub::insert(const EntryList& entries, Source sender)
+{
+  flush();
+  return insertBatch(entries, sender);
+}
+
+Clock BrokerGrpcStub::insertBatch(const EntryList& entries, Source sender) const
 {
+  if (_replicator) {
+    Grpc::ReplicateRequest frame;
+    SetInsertBatch(frame.mutable_entries(), entries, sender, _encoding);
+    return _replicator->push(frame).value_or(Clock{});
+  }
+  if (!_batches) {
+    // Entries up to the first one rejected are acked.
+    Clock acked;
+    for (const auto& entry : entries) {
+      const auto remote = insertOne(entry, sender);
+      if (remote.empty()) {
+        break;
+      }
+      acked = acked.merge(remote);
+    }
+    return acked;
+  }
+
+  Arena arena;
+  auto request = Arena::CreateMessage<Grpc::InsertBatchRequest>(&arena);
+  auto response = Arena::CreateMessage<Grpc::InsertResponse>(&arena);
+  SetInsertBatch(request, entries, sender, _encoding);
   ::grpc::ClientContext context;
+  SetDeadline(context, _calls.deadlineOf("insert"));
+  SetCompression(context, *request, _calls.compression);
+  const auto status = _stub->InsertBatch(&context, *request, response);
+  if (status.ok()) {
+    return Utils::ClockFrom(response->clock());
+  }
+  if (status.error_code() == ::grpc::StatusCode::UNIMPLEMENTED) {
+    _batches = false;
+    return insertBatch(entries, sender);
+  }
+  return {};
+}
+
+EntryList BrokerGrpcStub::query(const Clock& from, Source sender) const
+{
+  if (_calls.hedge.count() > 0 && !_peers.empty()) {
+    return hedgedQuery(from, sender);
+  }
+  EntryList list;
+  const bool ok = scan(from, sender, [&list](const Entry& entry) {
+    list.push_back(entry);
+    return true;
+  });
+  return ok ? list : EntryList{};
+}
+
+// Sends the query to the next of the peers every time the hedging delay
+// passes without a response, or as soon as every query sent so far failed.
+// The queries still pending once one succeeds are cancelled. Each one is a
+// QueryStream read from its own thread. The peers are not sent the sender,
+// a port of this connection that means nothing to them.
+EntryList BrokerGrpcStub::hedgedQuery(const Clock& from, Source sender) const
+{
+  flush();
   Grpc::QueryRequest request;
+  SetQuery(&request, from, sender, _encoding);
+  auto anonymous = request;
+  anonymous.set_sender(0);
+
+  Hedge hedge;
+  std::vector<std::shared_ptr<::grpc::ClientContext>> contexts;
+  // Of the Query sent instead to the peers that don't serve QueryStream.
+  std::vector<std::shared_ptr<::grpc::ClientContext>> unaries;
+  std::vector<std::thread> streams;
+  const auto send = [&](
+                      Grpc::Broker::StubInterface& stub,
+                      const Grpc::QueryRequest& query
+                    ) {
+    auto context = std::make_shared<::grpc::ClientContext>();
+    SetDeadline(*context, _calls.deadlineOf("query"));
+    contexts.push_back(context);
+    auto unary = std::make_shared<::grpc::ClientContext>();
+    SetDeadline(*unary, _calls.deadlineOf("query"));
+    unaries.push_back(unary);
+    const bool streaming = &stub != _stub.get() || _streams;
+    streams.emplace_back([=, this, &stub, &query, &hedge]() {
+      EntryList entries;
+      ::grpc::Status status(::grpc::StatusCode::UNIMPLEMENTED, "");
+      if (streaming) {
+        auto reader = stub.QueryStream(context.get(), query);
+        Grpc::QueryResponse chunk;
+        while (reader->Read(&chunk)) {
+          entries.splice(entries.end(), EntriesFrom(chunk));
+        }
+        status = reader->Finish();
+      }
+      if (status.error_code() == ::grpc::StatusCode::UNIMPLEMENTED) {
+        if (&stub == _stub.get()) {
+          _streams = false;
+        }
+        Grpc::QueryResponse response;
+        status = stub.Query(unary.get(), query, &response);
+        entries = EntriesFrom(response);
+      }
+      std::lock_guard lock(hedge.mutex);
+      if (!status.ok()) {
+        ++hedge.failed;
+      } else if (!hedge.entries) {
+        hedge.entries = std::move(entries);
+      }
+      hedge.done.notify_all();
+    });
+  };
+
+  send(*_stub, request);
+  std::unique_lock lock(hedge.mutex);
+  const auto answered = [&]() {
+    return hedge.entries || hedge.failed == contexts.size();
+  };
+  while (true) {
+    if (contexts.size() > _peers.size()) {
+      hedge.done.wait(lock, answered);
+      break;
+    }
+    hedge.done.wait_for(lock, _calls.hedge, answered);
+    if (hedge.entries) {
+      break;
+    }
+    lock.unlock();
+    send(*_peers[contexts.size() - 1], anonymous);
+    lock.lock();
+  }
+  lock.unlock();
+  for (const auto& context : contexts) {
+    context->TryCancel();
+  }
+  for (const auto& unary : unaries) {
+    unary->TryCancel();
+  }
+  for (auto& stream : streams) {
+    stream.join();
+  }
+  return hedge.entries.value_or(EntryList{});
+}
 
-  request.set_sender(sender);
-  Utils::SetClock(request.mutable_clock(), from);
+// Failed streams are opened again, when retried, after the last entry
+// visited.
+bool BrokerGrpcStub::scan(
+  const Clock& from, Source sender, const EntryVisitor& visit,
+  const Entry* after
+) const
+{
+  flush();
+  std::optional<Entry> cursor;
+  if (after) {
+    cursor = *after;
+  }
+  bool stopped = false;
+  const auto status = Retry(_calls, [&]() {
+    return scanOnce(from, sender, visit, cursor, stopped);
+  });
+  return status.ok() && !stopped;
+}
+
+::grpc::Status BrokerGrpcStub::scanOnce(
+  const Clock& from, Source sender, const EntryVisitor& visit,
+  std::optional<Entry>& cursor, bool& stopped
+) const
+{
+  ::grpc::ClientContext context;
+  SetDeadline(context, _calls.deadlineOf("query"));
+  const auto encoding = _encoding.load();
+  Arena arena;
+  auto request = Arena::CreateMessage<Grpc::QueryRequest>(&arena);
+  SetQuery(request, from, sender, encoding);
+  if (cursor) {
+    Utils::SetEntry(request->mutable_after(), *cursor, encoding);
+  }
+  if (!_streams) {
+    return queryOnce(*request, visit, cursor, stopped);
+  }
+  auto reader = _stub->QueryStream(&context, *request);
 
-  Grpc::QueryResponse response;
+  // Chunks are read on their own arena, reset once their entries are visited.
+  Arena chunks;
+  auto chunk = Arena::CreateMessage<Grpc::QueryResponse>(&chunks);
+  while (reader->Read(chunk)) {
+    for (const auto& entry : EntriesFrom(*chunk)) {
+      if (!visit(entry)) {
+        context.TryCancel();
+        reader->Finish();
+        stopped = true;
+        return ::grpc::Status::OK;
+      }
+      if (_calls.retries > 0) {
+        cursor = entry;
+      }
+    }
+    chunks.Reset();
+    chunk = Arena::CreateMessage<Grpc::QueryResponse>(&chunks);
+  }
+  const auto status = reader->Finish();
+  if (status.error_code() == ::grpc::StatusCode::UNIMPLEMENTED) {
+    _streams = false;
+    return queryOnce(*request, visit, cursor, stopped);
+  }
+  return status;
+}
 
-  EntryList out;
-  if (_stub->Query(&context, request, &response).ok()) {
-    for (auto& entry : response.entries()) {
-      out.push_back(Utils::EntryFrom(entry));
+// Peers without QueryStream answer with every entry, ignoring the one to
+// resume after, so the ones up to it are skipped here.
+::grpc::Status BrokerGrpcStub::queryOnce(
+  const Grpc::QueryRequest& request, const EntryVisitor& visit,
+  std::optional<Entry>& cursor, bool& stopped
+) const
+{
+  ::grpc::ClientContext context;
+  SetDeadline(context, _calls.deadlineOf("query"));
+  Arena arena;
+  auto response = Arena::CreateMessage<Grpc::QueryResponse>(&arena);
+  const auto status = _stub->Query(&context, request, response);
+  if (!status.ok()) {
+    return status;
+  }
+  const auto entries = EntriesFrom(*response);
+  auto it = entries.cbegin();
+  if (cursor) {
+    it = std::find(entries.cbegin(), entries.cend(), *cursor);
+    it = it == entries.cend() ? entries.cbegin() : std::next(it);
+  }
+  for (; it != entries.cend(); ++it) {
+    if (!visit(*it)) {
+      stopped = true;
+      return ::grpc::Status::OK;
+    }
+    if (_calls.retries > 0) {
+      cursor = *it;
     }
-    return out;
   }
-  return {};
+  return ::grpc::Status::OK;
 }
 
 Connection BrokerGrpcStub::connect(Connection conn)
 {
+  flush();
   ::grpc::ClientContext context;
+  SetDeadline(context, _calls.deadlineOf("connect"));
+  Arena arena;
 
-  Grpc::ConnectionRequest request;
-  request.set_source(conn.source());
-  Utils::SetClock(request.mutable_clock(), conn.clock());
+  auto request = Arena::CreateMessage<Grpc::ConnectionRequest>(&arena);
+  request->set_source(conn.source());
+  request->set_encoding(Utils::kLatestEncoding);
+  Utils::SetClock(request->mutable_clock(), conn.clock());
 
-  request.mutable_broker()->set_url(conn.url());
+  request->mutable_broker()->set_url(conn.url());
 
-  Utils::SetIdConnectionInfoMap(request.mutable_sources(), conn.provides());
+  Utils::SetIdConnectionInfoMap(request->mutable_sources(), conn.provides());
 
-  Grpc::ConnectionResponse response;
+  auto response = Arena::CreateMessage<Grpc::ConnectionResponse>(&arena);
 
-  auto status = _stub->Connect(&context, request, &response);
+  SetCompression(context, *request, _calls.compression);
+  auto status = _stub->Connect(&context, *request, response);
   if (status.ok()) {
-    Clock clock = Utils::ClockFrom(response.clock());
+    _encoding = response->encoding();
+    _incremental = response->incremental();
+    Clock clock = Utils::ClockFrom(response->clock());
     Connection data = stub();
-    data.source() = response.source();
+    data.source() = response->source();
     data.clock() = clock;
+    data.provides() = Utils::IdConnectionInfoMapFrom(response->sources());
     return data;
   }
   return Connection{};
@@ -138,16 +1453,42 @@ Connection BrokerGrpcStub::connect(Connection conn)
 
 bool BrokerGrpcStub::refresh(const Connection& conn, Source sender)
 {
-  Grpc::RefreshRequest request;
-  request.set_sender(sender);
-  request.set_source(conn.source());
+  return refresh(conn, sender, false);
+}
 
-  Utils::SetClock(request.mutable_clock(), conn.clock());
-  Utils::SetIdConnectionInfoMap(request.mutable_sources(), conn.provides());
+// Peers that did not tell connect() they apply incremental refreshes would
+// take the changes for all their sources, so the caller refreshes them with
+// the whole map instead.
+bool BrokerGrpcStub::update(const Connection& changes, Source sender)
+{
+  if (!_incremental) {
+    return false;
+  }
+  return refresh(changes, sender, true);
+}
+
+bool BrokerGrpcStub::refresh(
+  const Connection& conn, Source sender, bool incremental
+)
+{
+  if (_replicator) {
+    if (_batcher) {
+      _batcher->flush();
+    }
+    Grpc::ReplicateRequest frame;
+    SetRefresh(frame.mutable_refresh(), conn, sender, incremental);
+    return _replicator->push(frame).has_value();
+  }
 
-  ::google::protobuf::Empty response;
+  flush();
+  Arena arena;
+  auto request = Arena::CreateMessage<Grpc::RefreshRequest>(&arena);
+  auto response = Arena::CreateMessage<::google::protobuf::Empty>(&arena);
+  SetRefresh(request, conn, sender, incremental);
   ::grpc::ClientContext context;
-  if (_stub->Refresh(&context, request, &response).ok()) {
+  SetDeadline(context, _calls.deadlineOf("refresh"));
+  SetCompression(context, *request, _calls.compression);
+  if (_stub->Refresh(&context, *request, response).ok()) {
     return true;
   }
 
@@ -156,14 +1497,17 @@ bool BrokerGrpcStub::refresh(const Connection& conn, Source sender)
 
 Clock BrokerGrpcStub::relay(const Data& entry, Source sender)
 {
+  flush();
   ::grpc::ClientContext context;
-  Grpc::RelayInsertRequest request;
-  Grpc::InsertResponse response;
-  request.set_sender(sender);
-  Utils::SetData(request.mutable_entry(), entry);
-  const auto status = _stub->Relay(&context, request, &response);
+  SetDeadline(context, _calls.deadlineOf("relay"));
+  Arena arena;
+  auto request = Arena::CreateMessage<Grpc::RelayInsertRequest>(&arena);
+  auto response = Arena::CreateMessage<Grpc::InsertResponse>(&arena);
+  SetRelay(request, entry, sender, _encoding);
+  SetCompression(context, *request, _calls.compression);
+  const auto status = _stub->Relay(&context, *request, response);
   if (status.ok()) {
-    return Utils::ClockFrom(response.clock());
+    return Utils::ClockFrom(response->clock());
   }
   return {{0, 0}};
 }
@@ -18,6 +18,8 @@
 
 #include "cashmere/brokerwrapper.h"
 #include "cashmere/cashmere.h"
+#include "cashmere/utils/grpc.h"
+#include "metricsendpoint.h"
 
 #include <google/protobuf/empty.pb.h>
 #include <grpc/grpc.h>
@@ -26,7 +28,12 @@
 #include <proto/cashmere.grpc.pb.h>
 #include <proto/cashmere.pb.h>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <thread>
+#include <type_traits>
+#include <vector>
 
 namespace Cashmere
 {
@@ -35,19 +42,86 @@ class GrpcRunner;
 using GrpcRunnerPtr = std::shared_ptr<GrpcRunner>;
 using GrpcRunnerWeakPtr = std::weak_ptr<GrpcRunner>;
 
+// Serves a broker through the synchronous gRPC API, unless the url sets the
+// `threads` option, e.g. grpc://0.0.0.0:5000?threads=4. Calls are then served
+// through the asynchronous API, by that many threads each polling its own
+// completion queue, which hand the handlers over to a pool of workers. Both
+// run the same handlers. The pool grows while handlers wait on the peers of the
+// broker, up to the `max_workers` option, 64 by default, past which calls are
+// queued. `threads` above 256 select the synchronous server.
+//
+// Responses are sent compressed as set by the `compression` (gzip or deflate)
+// and `compression_min_bytes` options, see Utils::Compression. Only entries,
+// connections and sources are worth it: clocks are always sent as they are.
+//
+// With the `metrics_port` option, e.g. grpc://0.0.0.0:5000?metrics_port=9100,
+// the metrics() of the runner are served over HTTP on that port, for
+// Prometheus to scrape. They aren't served if the port isn't a valid one.
+//
+// With the `trace_file` option, e.g. grpc://0.0.0.0:5000?trace_file=run.json,
+// the spans of the process are recorded from start() and written to that file
+// by stop(), see Tracing. Handlers continue the trace of their caller.
 class CASHMERE_EXPORT GrpcRunner : public WrapperBase, public Grpc::Broker::Service
 {
 public:
   GrpcRunner(const std::string& url);
+  ~GrpcRunner() override;
 
   static WrapperBasePtr create(const std::string& url);
+  static size_t ThreadsFrom(const std::string& url);
+  static size_t MaxWorkersFrom(const std::string& url);
+  static uint16_t MetricsPortFrom(const std::string& url);
 
   std::thread start(BrokerBasePtr broker) override;
   void stop() override;
 
   BrokerBasePtr broker();
+  // Calls served by the runner, the counters of the process and the size and
+  // lag of the broker, in the Prometheus text format.
+  std::string metrics();
 
 private:
+  class Call;
+  template <class Request, class Response>
+  class UnaryCall;
+  class QueryStreamCall;
+  class ReplicateCall;
+  class Workers;
+  template <class Request, class Response>
+  using Handler = ::grpc::Status (GrpcRunner::*)(
+    ::grpc::ServerContext*, const Request*, Response*
+  );
+  template <class Request, class Response>
+  using Requester = void (Grpc::Broker::AsyncService::*)(
+    ::grpc::ServerContext*, Request*,
+    ::grpc::ServerAsyncResponseWriter<Response>*, ::grpc::CompletionQueue*,
+    ::grpc::ServerCompletionQueue*, void*
+  );
+
+  template <class Request, class Response>
+  void serve(
+    ::grpc::ServerCompletionQueue* queue,
+    std::type_identity_t<Requester<Request, Response>> request,
+    Handler<Request, Response> handler
+  );
+  void poll(::grpc::ServerCompletionQueue* queue);
+  bool nextChunk(
+    const Grpc::QueryRequest& request, std::optional<Entry>& cursor,
+    Grpc::QueryResponse* chunk
+  );
+  bool insertBatch(
+    const Grpc::InsertBatchRequest& request, Grpc::InsertResponse* response
+  );
+  bool apply(
+    ::grpc::ServerContext* context, const Grpc::ReplicateRequest& frame,
+    Grpc::ReplicateResponse* ack
+  );
+  void compress(
+    ::grpc::ServerContext* context, const ::google::protobuf::Message& response
+  ) const;
+  bool track(::grpc::ServerContext* stream);
+  void untrack(::grpc::ServerContext* stream);
+
   BrokerBaseWeakPtr _broker;
   ::grpc::Status Connect(
     ::grpc::ServerContext* context,
@@ -59,11 +133,21 @@ private:
     const ::Cashmere::Grpc::QueryRequest* request,
     ::Cashmere::Grpc::QueryResponse* response
   ) override;
+  ::grpc::Status QueryStream(
+    ::grpc::ServerContext* context,
+    const ::Cashmere::Grpc::QueryRequest* request,
+    ::grpc::ServerWriter<::Cashmere::Grpc::QueryResponse>* writer
+  ) override;
   ::grpc::Status Insert(
     ::grpc::ServerContext* context,
     const ::Cashmere::Grpc::InsertRequest* request,
     ::Cashmere::Grpc::InsertResponse* response
   ) override;
+  ::grpc::Status InsertBatch(
+    ::grpc::ServerContext* context,
+    const ::Cashmere::Grpc::InsertBatchRequest* request,
+    ::Cashmere::Grpc::InsertResponse* response
+  ) override;
   ::grpc::Status Refresh(
     ::grpc::ServerContext* context,
     const ::Cashmere::Grpc::RefreshRequest* request,
@@ -83,7 +167,29 @@ private:
     const ::Cashmere::Grpc::SourcesRequest* request,
     ::Cashmere::Grpc::SourcesResponse* response
   ) override;
+  ::grpc::Status Lag(
+    ::grpc::ServerContext* context, const ::google::protobuf::Empty* request,
+    ::Cashmere::Grpc::LagResponse* response
+  ) override;
+  ::grpc::Status Replicate(
+    ::grpc::ServerContext* context,
+    ::grpc::ServerReaderWriter<
+      ::Cashmere::Grpc::ReplicateResponse, ::Cashmere::Grpc::ReplicateRequest>*
+      stream
+  ) override;
 
+  const size_t _threads;
+  const size_t _maxWorkers;
+  const Utils::Compression _compression;
+  Grpc::Broker::AsyncService _async;
+  std::vector<std::unique_ptr<::grpc::ServerCompletionQueue>> _queues;
+  std::unique_ptr<Workers> _workers;
+  std::mutex _mutex;
+  std::set<::grpc::ServerContext*> _streams;
+  bool _stopping;
+  bool _tracing;
+  RpcStats _rpcs;
+  std::unique_ptr<MetricsEndpoint> _endpoint;
   std::unique_ptr<grpc::Server> _server;
 };
 
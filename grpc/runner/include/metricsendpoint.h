@@ -0,0 +1,97 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef CASHMERE_GRPC_METRICS_ENDPOINT_H
+#define CASHMERE_GRPC_METRICS_ENDPOINT_H
+
+#include "cashmere/metrics.h"
+
+#include <grpcpp/support/server_interceptor.h>
+
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace Cashmere
+{
+
+// Name a metric is exposed with: cashmere_<name>, with `*_ns` metrics in
+// seconds as `*_seconds`.
+std::string MetricName(std::string_view name);
+
+// Writes the samples of a histogram in the Prometheus text format, in seconds
+// for `*_ns` ones. The TYPE line is left to the caller, once per metric.
+void WriteHistogram(
+  std::ostream& out, std::string_view name, std::string_view labels,
+  const HistogramData& histogram
+);
+
+// Latency and calls in flight of each method of the Broker service, recorded
+// by an interceptor of the server. Calls last from their arrival until their
+// context is released.
+class RpcStats
+{
+public:
+  static constexpr std::array<std::string_view, 11> kMethods = {
+    "Connect", "Query", "QueryStream", "Insert", "InsertBatch", "Refresh",
+    "Relay", "GetClock", "Sources", "Lag", "Replicate"
+  };
+
+  std::unique_ptr<::grpc::experimental::ServerInterceptorFactoryInterface>
+  interceptor();
+  void write(std::ostream& out) const;
+
+private:
+  class Interceptor;
+  struct Method
+  {
+    std::atomic<int64_t> inflight = 0;
+    std::array<std::atomic<uint64_t>, kHistogramBuckets> buckets = {};
+    std::atomic<uint64_t> sum = 0;
+  };
+
+  Method* find(std::string_view path);
+
+  std::array<Method, kMethods.size()> _methods;
+};
+
+// Serves the text `render` returns to any HTTP GET, for Prometheus to scrape,
+// one request at a time.
+class MetricsEndpoint
+{
+public:
+  explicit MetricsEndpoint(std::function<std::string()> render);
+  ~MetricsEndpoint();
+
+  bool start(const std::string& host, uint16_t port);
+  void stop();
+
+private:
+  void serve();
+  void respond(int client);
+
+  std::function<std::string()> _render;
+  int _socket;
+  std::thread _thread;
+};
+
+}
+
+#endif
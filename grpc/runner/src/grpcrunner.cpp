@@ -19,6 +19,7 @@
 #include "cashmere/utils/url.h"
 #include "grpcrunner.h"
 
+#include <google/protobuf/arena.h>
 #include <google/protobuf/empty.pb.h>
 #include <grpc/grpc.h>
 #include <grpcpp/create_channel.h>
@@ -26,19 +27,431 @@
 #include <proto/cashmere.grpc.pb.h>
 #include <proto/cashmere.pb.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <format>
+#include <functional>
+#include <limits>
+#include <list>
+#include <sstream>
+#include <stdexcept>
+
 namespace Cashmere
 {
 
+using ::google::protobuf::Arena;
+
+constexpr size_t kQueryChunkSize = 256;
+constexpr size_t kMaxThreads = 256;
+constexpr size_t kMaxWorkers = 4096;
+constexpr size_t kDefaultMaxWorkers = 64;
+// Workers beyond the `threads` ones stop after being idle for that long.
+constexpr auto kWorkerIdleTimeout = std::chrono::seconds(10);
+const ::grpc::Status kRejected(
+  ::grpc::StatusCode::ABORTED, "entries of the frame were rejected"
+);
+
+namespace
+{
+// Parent of the span of a handler: the span of the Replicate frame it applies,
+// if any, or the one the caller sent along with the call.
+TraceContext Caller(const ::grpc::ServerContext* context)
+{
+  const auto current = Tracing::Current();
+  return current.valid() ? current : Utils::TraceContextOf(*context);
+}
+
+// The number in `text`, which stoul would wrap around if it were negative.
+size_t Bounded(const std::string& text, size_t max)
+{
+  const auto number = std::stoul(text);
+  if (text.find('-') != std::string::npos || number > max) {
+    throw std::out_of_range(text);
+  }
+  return number;
+}
+}
+
+// Threads running the handlers of the asynchronous calls, so that the ones
+// polling the completion queues never block. Handlers wait on the calls their
+// broker makes to its peers, which may call back into this runner, so a thread
+// is added whenever a handler is queued with every thread busy, up to `max`.
+// Handlers queued past that wait for a thread to be done. Threads added that
+// way stop once idle for a while.
+class GrpcRunner::Workers
+{
+public:
+  Workers(size_t threads, size_t max)
+    : _min(threads)
+    , _max(std::max(threads, max))
+    , _idle(0)
+    , _stopping(false)
+  {
+    std::lock_guard lock(_mutex);
+    for (size_t i = 0; i < threads; ++i) {
+      spawn();
+    }
+  }
+
+  // Runs the handlers still queued before returning.
+  ~Workers()
+  {
+    {
+      std::lock_guard lock(_mutex);
+      _stopping = true;
+    }
+    _queued.notify_all();
+    for (auto& thread : _threads) {
+      thread.join();
+    }
+  }
+
+  void run(std::function<void()> handler)
+  {
+    std::lock_guard lock(_mutex);
+    reap();
+    _handlers.push_back(std::move(handler));
+    if (_idle < _handlers.size() && _threads.size() < _max) {
+      spawn();
+    } else {
+      _queued.notify_one();
+    }
+  }
+
+private:
+  // Counted as idle from the start, so that handlers queued before it runs
+  // don't add a thread each.
+  void spawn()
+  {
+    ++_idle;
+    _threads.emplace_back(&Workers::work, this);
+  }
+
+  // Joins the threads that stopped, which only have to return by then.
+  void reap()
+  {
+    for (const auto id : _stopped) {
+      const auto it = std::find_if(
+        _threads.begin(), _threads.end(),
+        [id](const std::thread& thread) { return thread.get_id() == id; }
+      );
+      it->join();
+      _threads.erase(it);
+    }
+    _stopped.clear();
+  }
+
+  void work()
+  {
+    std::unique_lock lock(_mutex);
+    while (true) {
+      const bool queued = _queued.wait_for(lock, kWorkerIdleTimeout, [this]() {
+        return _stopping || !_handlers.empty();
+      });
+      if (!queued) {
+        if (_threads.size() - _stopped.size() > _min) {
+          --_idle;
+          _stopped.push_back(std::this_thread::get_id());
+          return;
+        }
+        continue;
+      }
+      if (_handlers.empty()) {
+        return;
+      }
+      --_idle;
+      const auto handler = std::move(_handlers.front());
+      _handlers.pop_front();
+      lock.unlock();
+      handler();
+      lock.lock();
+      ++_idle;
+    }
+  }
+
+  const size_t _min;
+  const size_t _max;
+  std::mutex _mutex;
+  std::condition_variable _queued;
+  std::deque<std::function<void()>> _handlers;
+  std::list<std::thread> _threads;
+  std::vector<std::thread::id> _stopped;
+  size_t _idle;
+  bool _stopping;
+};
+
+// An asynchronous call waiting on a completion queue, which tags it by its
+// address.
+class GrpcRunner::Call
+{
+public:
+  virtual ~Call() = default;
+  virtual void proceed(bool ok) = 0;
+};
+
+// Waits for a call to one method, runs the synchronous handler on it from a
+// worker and sends the response. The next call to the method is requested as
+// soon as this one arrives. Its messages live on an arena freed with the call.
+template <class Request, class Response>
+class GrpcRunner::UnaryCall : public GrpcRunner::Call
+{
+public:
+  UnaryCall(
+    GrpcRunner& runner, ::grpc::ServerCompletionQueue* queue,
+    Requester<Request, Response> request, Handler<Request, Response> handler
+  )
+    : _runner(runner)
+    , _queue(queue)
+    , _request(request)
+    , _handler(handler)
+    , _message(Arena::CreateMessage<Request>(&_arena))
+    , _response(Arena::CreateMessage<Response>(&_arena))
+    , _writer(&_context)
+    , _finished(false)
+  {
+    (_runner._async.*_request)(
+      &_context, _message, &_writer, _queue, _queue, this
+    );
+  }
+
+  void proceed(bool ok) override
+  {
+    if (!ok || _finished) {
+      delete this;
+      return;
+    }
+    new UnaryCall(_runner, _queue, _request, _handler);
+
+    _runner._workers->run([this]() {
+      const auto status = (_runner.*_handler)(&_context, _message, _response);
+      _finished = true;
+      _writer.Finish(*_response, status, this);
+    });
+  }
+
+private:
+  GrpcRunner& _runner;
+  ::grpc::ServerCompletionQueue* _queue;
+  Requester<Request, Response> _request;
+  Handler<Request, Response> _handler;
+  ::grpc::ServerContext _context;
+  Arena _arena;
+  Request* _message;
+  Response* _response;
+  ::grpc::ServerAsyncResponseWriter<Response> _writer;
+  bool _finished;
+};
+
+// Streams the entries of a query, reading the next chunk from a worker each
+// time the last one is sent, so that no thread waits on a slow client. Each
+// chunk is built on an arena reset once it is sent.
+class GrpcRunner::QueryStreamCall : public GrpcRunner::Call
+{
+public:
+  QueryStreamCall(GrpcRunner& runner, ::grpc::ServerCompletionQueue* queue)
+    : _runner(runner)
+    , _queue(queue)
+    , _message(Arena::CreateMessage<Grpc::QueryRequest>(&_arena))
+    , _writer(&_context)
+    , _started(false)
+    , _finished(false)
+    , _more(true)
+  {
+    _runner._async.RequestQueryStream(
+      &_context, _message, &_writer, _queue, _queue, this
+    );
+  }
+
+  void proceed(bool ok) override
+  {
+    if (!ok || _finished) {
+      delete this;
+      return;
+    }
+    if (!_started) {
+      _started = true;
+      new QueryStreamCall(_runner, _queue);
+      if (_runner._compression.algorithm != GRPC_COMPRESS_NONE) {
+        _context.set_compression_algorithm(_runner._compression.algorithm);
+      }
+      if (_message->has_after()) {
+        _cursor = Utils::EntryFrom(_message->after());
+      }
+    }
+    _runner._workers->run([this]() { next(); });
+  }
+
+private:
+  void next()
+  {
+    _chunks.Reset();
+    auto chunk = Arena::CreateMessage<Grpc::QueryResponse>(&_chunks);
+    if (_more) {
+      _more = _runner.nextChunk(*_message, _cursor, chunk);
+    }
+    if (chunk->entries_size() > 0) {
+      _writer.Write(
+        *chunk, _runner._compression.options(chunk->ByteSizeLong()), this
+      );
+      return;
+    }
+    _finished = true;
+    _writer.Finish(::grpc::Status::OK, this);
+  }
+
+  GrpcRunner& _runner;
+  ::grpc::ServerCompletionQueue* _queue;
+  ::grpc::ServerContext _context;
+  Arena _arena;
+  Arena _chunks;
+  Grpc::QueryRequest* _message;
+  ::grpc::ServerAsyncWriter<Grpc::QueryResponse> _writer;
+  std::optional<Entry> _cursor;
+  bool _started;
+  bool _finished;
+  bool _more;
+};
+
+// Applies the frames of a Replicate stream one at a time, from a worker,
+// acking each one before reading the next. A frame and its ack share an arena
+// reset for the next frame.
+class GrpcRunner::ReplicateCall : public GrpcRunner::Call
+{
+public:
+  ReplicateCall(GrpcRunner& runner, ::grpc::ServerCompletionQueue* queue)
+    : _runner(runner)
+    , _queue(queue)
+    , _frame(nullptr)
+    , _ack(nullptr)
+    , _stream(&_context)
+    , _state(State::Waiting)
+  {
+    _runner._async.RequestReplicate(
+      &_context, &_stream, _queue, _queue, this
+    );
+  }
+
+  ~ReplicateCall() override
+  {
+    _runner.untrack(&_context);
+  }
+
+  void proceed(bool ok) override
+  {
+    switch (_state) {
+    case State::Waiting:
+      if (!ok) {
+        delete this;
+        return;
+      }
+      new ReplicateCall(_runner, _queue);
+      if (!_runner.track(&_context)) {
+        finish(::grpc::Status::CANCELLED);
+        return;
+      }
+      read();
+      return;
+    case State::Reading:
+      if (!ok) {
+        finish(::grpc::Status::OK);
+        return;
+      }
+      _runner._workers->run([this]() {
+        if (!_runner.apply(&_context, *_frame, _ack)) {
+          finish(kRejected);
+          return;
+        }
+        _state = State::Writing;
+        _stream.Write(*_ack, this);
+      });
+      return;
+    case State::Writing:
+      if (!ok) {
+        finish(::grpc::Status::CANCELLED);
+        return;
+      }
+      read();
+      return;
+    case State::Finishing:
+      delete this;
+      return;
+    }
+  }
+
+private:
+  enum class State { Waiting, Reading, Writing, Finishing };
+
+  void read()
+  {
+    _frames.Reset();
+    _frame = Arena::CreateMessage<Grpc::ReplicateRequest>(&_frames);
+    _ack = Arena::CreateMessage<Grpc::ReplicateResponse>(&_frames);
+    _state = State::Reading;
+    _stream.Read(_frame, this);
+  }
+
+  void finish(const ::grpc::Status& status)
+  {
+    _state = State::Finishing;
+    _stream.Finish(status, this);
+  }
+
+  GrpcRunner& _runner;
+  ::grpc::ServerCompletionQueue* _queue;
+  ::grpc::ServerContext _context;
+  Arena _frames;
+  Grpc::ReplicateRequest* _frame;
+  Grpc::ReplicateResponse* _ack;
+  ::grpc::ServerAsyncReaderWriter<Grpc::ReplicateResponse, Grpc::ReplicateRequest>
+    _stream;
+  State _state;
+};
+
 WrapperBasePtr GrpcRunner::create(const std::string& url)
 {
   return std::make_shared<GrpcRunner>(url);
 }
 
+size_t GrpcRunner::ThreadsFrom(const std::string& url)
+{
+  try {
+    return Bounded(ParseUrl(url).option("threads", "0"), kMaxThreads);
+  } catch (const std::exception&) {
+    return 0;
+  }
+}
+
+size_t GrpcRunner::MaxWorkersFrom(const std::string& url)
+{
+  try {
+    return Bounded(
+      ParseUrl(url).option("max_workers", std::to_string(kDefaultMaxWorkers)),
+      kMaxWorkers
+    );
+  } catch (const std::exception&) {
+    return kDefaultMaxWorkers;
+  }
+}
+
+uint16_t GrpcRunner::MetricsPortFrom(const std::string& url)
+{
+  try {
+    return Bounded(
+      ParseUrl(url).option("metrics_port", "0"),
+      std::numeric_limits<uint16_t>::max()
+    );
+  } catch (const std::exception&) {
+    return 0;
+  }
+}
+
 ::grpc::Status GrpcRunner::Connect(
-  [[maybe_unused]] ::grpc::ServerContext* context,
+  ::grpc::ServerContext* context,
   const Grpc::ConnectionRequest* request, Grpc::ConnectionResponse* response
 )
 {
+  ScopedSpan span("runner.connect", Caller(context));
   auto stub = Connection(broker()->store()->getOrCreate(request->broker().url()));
   if (request->source() == 0) {
     const auto conn = broker()->connect(stub);
@@ -58,92 +471,394 @@ WrapperBasePtr GrpcRunner::create(const std::string& url)
     Utils::SetClock(response->mutable_clock(), out.clock());
     Utils::SetIdConnectionInfoMap(response->mutable_sources(), out.provides());
   }
+  response->set_encoding(std::min(request->encoding(), Utils::kLatestEncoding));
+  response->set_incremental(true);
+  compress(context, *response);
 
   return ::grpc::Status::OK;
 }
 
 ::grpc::Status GrpcRunner::Query(
-  [[maybe_unused]] ::grpc::ServerContext* context,
+  ::grpc::ServerContext* context,
   const Grpc::QueryRequest* request, Grpc::QueryResponse* response
 )
 {
+  ScopedSpan span("runner.query", Caller(context));
   auto sender = request->sender();
   Clock clock = Utils::ClockFrom(request->clock());
 
-  for (auto& entry : broker()->query(clock, sender)) {
-    auto out = response->add_entries();
-    Utils::SetEntry(out, entry);
+  Utils::SetEntries(
+    response->mutable_entries(), response->mutable_base(),
+    broker()->query(clock, sender), request->encoding()
+  );
+  compress(context, *response);
+
+  return ::grpc::Status::OK;
+}
+
+::grpc::Status GrpcRunner::QueryStream(
+  ::grpc::ServerContext* context, const Grpc::QueryRequest* request,
+  ::grpc::ServerWriter<Grpc::QueryResponse>* writer
+)
+{
+  ScopedSpan span("runner.query_stream", Caller(context));
+  std::optional<Entry> cursor;
+  if (request->has_after()) {
+    cursor = Utils::EntryFrom(request->after());
+  }
+
+  if (_compression.algorithm != GRPC_COMPRESS_NONE) {
+    context->set_compression_algorithm(_compression.algorithm);
+  }
+  Arena arena;
+  bool more = true;
+  while (more && !context->IsCancelled()) {
+    arena.Reset();
+    auto chunk = Arena::CreateMessage<Grpc::QueryResponse>(&arena);
+    more = nextChunk(*request, cursor, chunk);
+    if (chunk->entries_size() > 0 &&
+        !writer->Write(*chunk, _compression.options(chunk->ByteSizeLong()))) {
+      return ::grpc::Status::CANCELLED;
+    }
   }
 
   return ::grpc::Status::OK;
 }
 
+// Reads the chunk of entries following the cursor and moves the cursor past
+// it, returning whether more may follow. The broker is only locked while
+// reading, never while the chunk is sent.
+bool GrpcRunner::nextChunk(
+  const Grpc::QueryRequest& request, std::optional<Entry>& cursor,
+  Grpc::QueryResponse* chunk
+)
+{
+  const Clock clock = Utils::ClockFrom(request.clock());
+  const Entry* after = cursor ? &*cursor : nullptr;
+  EntryList entries;
+  broker()->scan(
+    clock, request.sender(),
+    [&entries](const Entry& entry) {
+      entries.push_back(entry);
+      return entries.size() < kQueryChunkSize;
+    },
+    after
+  );
+
+  Utils::SetEntries(
+    chunk->mutable_entries(), chunk->mutable_base(), entries,
+    request.encoding()
+  );
+  if (entries.size() < kQueryChunkSize) {
+    return false;
+  }
+  cursor = entries.back();
+  return true;
+}
+
 ::grpc::Status GrpcRunner::Insert(
-  [[maybe_unused]] ::grpc::ServerContext* context,
+  ::grpc::ServerContext* context,
   const Grpc::InsertRequest* request, Grpc::InsertResponse* response
 )
 {
+  ScopedSpan span("runner.insert", Caller(context));
+  Arena arena;
+  auto proto = Arena::CreateMessage<Grpc::Entry>(&arena);
+  if (!proto->ParseFromString(request->entry())) {
+    return ::grpc::Status::CANCELLED;
+  }
   Source sender = request->sender();
-  Entry entry = Utils::EntryFrom(request->entry());
+  Entry entry = Utils::EntryFrom(*proto);
+  const Utils::Forwarded forwarded(
+    entry, request->entry(), Utils::EncodingOf(*proto)
+  );
 
   if (broker()->insert(entry, sender).valid()) {
-    Utils::SetClock(response->mutable_clock(), broker()->clock());
+    Utils::SetClock(response->mutable_clock(), broker()->snapshot()->clock);
     return ::grpc::Status::OK;
   }
 
   return ::grpc::Status::CANCELLED;
 }
 
+::grpc::Status GrpcRunner::InsertBatch(
+  ::grpc::ServerContext* context,
+  const Grpc::InsertBatchRequest* request, Grpc::InsertResponse* response
+)
+{
+  ScopedSpan span("runner.insert_batch", Caller(context));
+  insertBatch(*request, response);
+  return ::grpc::Status::OK;
+}
+
+// Inserts the entries of a batch, returning whether the broker holds every one
+// of them afterwards.
+bool GrpcRunner::insertBatch(
+  const Grpc::InsertBatchRequest& request, Grpc::InsertResponse* response
+)
+{
+  const auto entries = Utils::EntriesFrom(request.entries(), request.base());
+  const auto clock = broker()->insert(entries, request.sender());
+  Utils::SetClock(response->mutable_clock(), clock);
+  return std::ranges::all_of(entries, [&clock](const Entry& entry) {
+    return entry.clock.ahead(clock) == 0;
+  });
+}
+
 ::grpc::Status GrpcRunner::Refresh(
-  [[maybe_unused]] ::grpc::ServerContext* context,
+  ::grpc::ServerContext* context,
   const Grpc::RefreshRequest* request,
   [[maybe_unused]] ::google::protobuf::Empty* response
 )
 {
+  ScopedSpan span("runner.refresh", Caller(context));
   Connection conn;
   conn.source() = request->source();
   conn.clock() = Utils::ClockFrom(request->clock());
   conn.provides() = Utils::IdConnectionInfoMapFrom(request->sources());
-  broker()->refresh(conn, request->sender());
+  if (request->incremental()) {
+    broker()->update(conn, request->sender());
+  } else {
+    broker()->refresh(conn, request->sender());
+  }
   return ::grpc::Status::OK;
 }
 
 ::grpc::Status GrpcRunner::Relay(
-  [[maybe_unused]] ::grpc::ServerContext* context,
+  ::grpc::ServerContext* context,
   const Grpc::RelayInsertRequest* request, Grpc::InsertResponse* response
 )
 {
-  Clock clock =
-    broker()->relay(Utils::DataFrom(request->entry()), request->sender());
+  ScopedSpan span("runner.relay", Caller(context));
+  Arena arena;
+  auto proto = Arena::CreateMessage<Grpc::Data>(&arena);
+  if (!proto->ParseFromString(request->entry())) {
+    return ::grpc::Status::CANCELLED;
+  }
+  const Data data = Utils::DataFrom(*proto);
+  const Utils::Forwarded forwarded(
+    data, request->entry(), Utils::EncodingOf(*proto)
+  );
+
+  Clock clock = broker()->relay(data, request->sender());
   Utils::SetClock(response->mutable_clock(), clock);
   return ::grpc::Status::OK;
 }
 
 ::grpc::Status GrpcRunner::Sources(
-  [[maybe_unused]] ::grpc::ServerContext* context,
+  ::grpc::ServerContext* context,
   const ::Cashmere::Grpc::SourcesRequest* request,
   Grpc::SourcesResponse* response
 )
 {
   auto sources = broker()->sources(request->sender());
   Utils::SetSources(response->mutable_sources(), sources);
+  compress(context, *response);
+  return ::grpc::Status::OK;
+}
+
+::grpc::Status GrpcRunner::Lag(
+  [[maybe_unused]] ::grpc::ServerContext* context,
+  const ::google::protobuf::Empty*, Grpc::LagResponse* response
+)
+{
+  Utils::SetLag(response->mutable_peers(), broker()->lag());
   return ::grpc::Status::OK;
 }
 
+::grpc::Status GrpcRunner::Replicate(
+  ::grpc::ServerContext* context,
+  ::grpc::ServerReaderWriter<Grpc::ReplicateResponse, Grpc::ReplicateRequest>*
+    stream
+)
+{
+  if (!track(context)) {
+    return ::grpc::Status::CANCELLED;
+  }
+  auto status = ::grpc::Status::OK;
+  Arena arena;
+  auto frame = Arena::CreateMessage<Grpc::ReplicateRequest>(&arena);
+  while (stream->Read(frame)) {
+    auto ack = Arena::CreateMessage<Grpc::ReplicateResponse>(&arena);
+    if (!apply(context, *frame, ack)) {
+      status = kRejected;
+      break;
+    }
+    if (!stream->Write(*ack)) {
+      status = ::grpc::Status::CANCELLED;
+      break;
+    }
+    arena.Reset();
+    frame = Arena::CreateMessage<Grpc::ReplicateRequest>(&arena);
+  }
+  untrack(context);
+  return status;
+}
+
+void GrpcRunner::compress(
+  ::grpc::ServerContext* context, const ::google::protobuf::Message& response
+) const
+{
+  if (_compression.algorithm != GRPC_COMPRESS_NONE &&
+      _compression.compresses(response.ByteSizeLong())) {
+    context->set_compression_algorithm(_compression.algorithm);
+  }
+}
+
+// Replicate streams last as long as their clients keep them open, so they are
+// tracked to be cancelled on stop().
+bool GrpcRunner::track(::grpc::ServerContext* stream)
+{
+  std::lock_guard lock(_mutex);
+  if (_stopping) {
+    return false;
+  }
+  _streams.insert(stream);
+  return true;
+}
+
+void GrpcRunner::untrack(::grpc::ServerContext* stream)
+{
+  std::lock_guard lock(_mutex);
+  _streams.erase(stream);
+}
+
+// Runs the handler of the call a frame carries. The ack holds the broker clock
+// once applied, which covers the entries of every frame acked so far, so a
+// frame whose entries were not all taken is not acked: the stream ends
+// instead, for the client to send it again on the next one.
+bool GrpcRunner::apply(
+  ::grpc::ServerContext* context, const Grpc::ReplicateRequest& frame,
+  Grpc::ReplicateResponse* ack
+)
+{
+  const auto trace = TraceContext::From(frame.trace());
+  ScopedSpan span(
+    "runner.replicate", trace.valid() ? trace : Utils::TraceContextOf(*context)
+  );
+  if (frame.has_entries()) {
+    Grpc::InsertResponse response;
+    if (!insertBatch(frame.entries(), &response)) {
+      return false;
+    }
+  } else if (frame.has_refresh()) {
+    ::google::protobuf::Empty response;
+    Refresh(context, &frame.refresh(), &response);
+  }
+  ack->set_sequence(frame.sequence());
+  Utils::SetClock(ack->mutable_clock(), broker()->snapshot()->clock);
+  return true;
+}
+
 std::thread GrpcRunner::start(BrokerBasePtr broker)
 {
   _broker = broker;
+  const auto parsed = ParseUrl(url());
   grpc::ServerBuilder builder;
-  builder.AddListeningPort(ParseUrl(url()).hostport, grpc::InsecureServerCredentials());
+  builder.AddListeningPort(parsed.hostport, grpc::InsecureServerCredentials());
+
+  std::vector<
+    std::unique_ptr<::grpc::experimental::ServerInterceptorFactoryInterface>>
+    interceptors;
+  interceptors.push_back(_rpcs.interceptor());
+  builder.experimental().SetInterceptorCreators(std::move(interceptors));
+
+  const auto metricsPort = MetricsPortFrom(url());
+  if (metricsPort != 0) {
+    _endpoint = std::make_unique<MetricsEndpoint>([this]() {
+      return metrics();
+    });
+    const auto host = parsed.hostport.substr(0, parsed.hostport.rfind(':'));
+    _endpoint->start(host, metricsPort);
+  }
+
+  const auto traceFile = parsed.option("trace_file");
+  if (!traceFile.empty()) {
+    Tracing::Start(traceFile);
+    _tracing = true;
+  }
 
-  builder.RegisterService(this);
+  if (_threads == 0) {
+    builder.RegisterService(this);
+    _server = builder.BuildAndStart();
+    return std::thread([this]() { _server->Wait(); });
+  }
+
+  builder.RegisterService(&_async);
+  _workers = std::make_unique<Workers>(_threads, _maxWorkers);
+  for (size_t i = 0; i < _threads; ++i) {
+    _queues.push_back(builder.AddCompletionQueue());
+  }
   _server = builder.BuildAndStart();
-  return std::thread([this]() { _server->Wait(); });
+
+  using Service = Grpc::Broker::AsyncService;
+  for (const auto& queue : _queues) {
+    serve(queue.get(), &Service::RequestConnect, &GrpcRunner::Connect);
+    serve(queue.get(), &Service::RequestQuery, &GrpcRunner::Query);
+    new QueryStreamCall(*this, queue.get());
+    new ReplicateCall(*this, queue.get());
+    serve(queue.get(), &Service::RequestInsert, &GrpcRunner::Insert);
+    serve(queue.get(), &Service::RequestInsertBatch, &GrpcRunner::InsertBatch);
+    serve(queue.get(), &Service::RequestRefresh, &GrpcRunner::Refresh);
+    serve(queue.get(), &Service::RequestRelay, &GrpcRunner::Relay);
+    serve(queue.get(), &Service::RequestGetClock, &GrpcRunner::GetClock);
+    serve(queue.get(), &Service::RequestSources, &GrpcRunner::Sources);
+    serve(queue.get(), &Service::RequestLag, &GrpcRunner::Lag);
+  }
+
+  return std::thread([this]() {
+    std::vector<std::thread> pollers;
+    for (size_t i = 1; i < _queues.size(); ++i) {
+      pollers.emplace_back(&GrpcRunner::poll, this, _queues[i].get());
+    }
+    poll(_queues.front().get());
+    for (auto& poller : pollers) {
+      poller.join();
+    }
+  });
+}
+
+template <class Request, class Response>
+void GrpcRunner::serve(
+  ::grpc::ServerCompletionQueue* queue,
+  std::type_identity_t<Requester<Request, Response>> request,
+  Handler<Request, Response> handler
+)
+{
+  new UnaryCall<Request, Response>(*this, queue, request, handler);
+}
+
+void GrpcRunner::poll(::grpc::ServerCompletionQueue* queue)
+{
+  void* tag = nullptr;
+  bool ok = false;
+  while (queue->Next(&tag, &ok)) {
+    static_cast<Call*>(tag)->proceed(ok);
+  }
 }
 
 void GrpcRunner::stop()
 {
+  {
+    std::lock_guard lock(_mutex);
+    _stopping = true;
+    for (auto stream : _streams) {
+      stream->TryCancel();
+    }
+  }
+  if (_endpoint) {
+    _endpoint->stop();
+  }
+  // Calls in progress are done once the server is shut down, and so are the
+  // workers running them. The queues are then drained by the pollers.
   _server->Shutdown();
+  _workers.reset();
+  for (const auto& queue : _queues) {
+    queue->Shutdown();
+  }
+  if (_tracing) {
+    Tracing::Stop();
+  }
 }
 
 ::grpc::Status GrpcRunner::GetClock(
@@ -151,20 +866,84 @@ void GrpcRunner::stop()
   const ::google::protobuf::Empty*, Grpc::ClockResponse* response
 )
 {
-  Utils::SetClock(response->mutable_clock(), broker()->clock());
+  Utils::SetClock(response->mutable_clock(), broker()->snapshot()->clock);
   return ::grpc::Status::OK;
 }
 
 GrpcRunner::GrpcRunner(const std::string& url)
   : WrapperBase(url)
+  , _threads(ThreadsFrom(url))
+  , _maxWorkers(MaxWorkersFrom(url))
+  , _compression(Utils::CompressionFrom(url))
+  , _stopping(false)
+  , _tracing(false)
 {
 }
 
+GrpcRunner::~GrpcRunner() = default;
+
 BrokerBasePtr GrpcRunner::broker()
 {
   return _broker.lock();
 }
 
+std::string GrpcRunner::metrics()
+{
+  std::ostringstream out;
+  _rpcs.write(out);
+
+  const auto snapshot = Metrics::Snapshot();
+  for (size_t i = 0; i < kCounters; ++i) {
+    const auto name = MetricName(Metrics::Name(Counter(i))) + "_total";
+    out << std::format(
+      "# TYPE {0} counter\n{0} {1}\n", name, snapshot.counters[i]
+    );
+  }
+  for (size_t i = 0; i < kGauges; ++i) {
+    const auto name = MetricName(Metrics::Name(Gauge(i)));
+    out << std::format(
+      "# TYPE {0} gauge\n{0} {1}\n", name, snapshot.gauges[i]
+    );
+  }
+  for (size_t i = 0; i < kHistograms; ++i) {
+    const auto name = Metrics::Name(Histogram(i));
+    out << "# TYPE " << MetricName(name) << " histogram\n";
+    WriteHistogram(out, name, "", snapshot.histograms[i]);
+  }
+
+  const auto broker = this->broker();
+  if (!broker) {
+    return out.str();
+  }
+  const auto clock = broker->clock();
+  uint64_t entries = 0;
+  for (const auto& [id, time] : clock) {
+    entries += time;
+  }
+  out << "# TYPE cashmere_journal_entries gauge\n"
+      << "cashmere_journal_entries " << entries << "\n";
+  const auto peers = broker->lag();
+  out << "# TYPE cashmere_peer_lag_entries gauge\n";
+  for (const auto& peer : peers) {
+    out << std::format(
+      "cashmere_peer_lag_entries{{port=\"{}\",id=\"{:x}\"}} {}\n", peer.port,
+      peer.id, peer.behind
+    );
+  }
+  out << "# TYPE cashmere_peer_progress_timestamp_seconds gauge\n";
+  for (const auto& peer : peers) {
+    const auto progress = std::chrono::duration_cast<std::chrono::seconds>(
+      peer.progress.time_since_epoch()
+    );
+    out << std::format(
+      "cashmere_peer_progress_timestamp_seconds{{port=\"{}\",id=\"{:x}\"}} "
+      "{}\n",
+      peer.port, peer.id, progress.count()
+    );
+  }
+  return out.str();
+}
+
 extern "C" CASHMERE_EXPORT Cashmere::WrapperBase* create(const std::string& url)
 {
   return new Cashmere::GrpcRunner(url);
@@ -0,0 +1,306 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include "metricsendpoint.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <format>
+
+namespace Cashmere
+{
+
+namespace
+{
+
+constexpr int kBacklog = 16;
+constexpr size_t kMaxRequestSize = 8192;
+
+// Buckets written, the same on every scrape: from 1 us to 34 s for
+// nanoseconds, and up to a million for counts.
+constexpr size_t kFirstNsBucket = 10;
+constexpr size_t kLastNsBucket = 35;
+constexpr size_t kLastCountBucket = 20;
+
+bool EndsWith(std::string_view text, std::string_view suffix)
+{
+  return text.size() >= suffix.size() &&
+         text.substr(text.size() - suffix.size()) == suffix;
+}
+
+}
+
+std::string MetricName(std::string_view name)
+{
+  if (EndsWith(name, "_ns")) {
+    return std::format("cashmere_{}_seconds", name.substr(0, name.size() - 3));
+  }
+  return std::format("cashmere_{}", name);
+}
+
+void WriteHistogram(
+  std::ostream& out, std::string_view name, std::string_view labels,
+  const HistogramData& histogram
+)
+{
+  const bool ns = EndsWith(name, "_ns");
+  const auto metric = MetricName(name);
+  const double divisor = ns ? 1e9 : 1.0;
+  const auto separator = labels.empty() ? "" : ",";
+
+  uint64_t count = 0;
+  const size_t first = ns ? kFirstNsBucket : 0;
+  const size_t last = ns ? kLastNsBucket : kLastCountBucket;
+  for (size_t i = 0; i < first; ++i) {
+    count += histogram.buckets[i];
+  }
+  // Nanoseconds are not whole in seconds, their bounds are rounded up to the
+  // next one, 2^i, so that they read well.
+  for (size_t i = first; i <= last; ++i) {
+    count += histogram.buckets[i];
+    const double bound =
+      ns ? std::ldexp(1.0, i) / divisor : HistogramData::UpperBound(i);
+    out << std::format(
+      "{}_bucket{{{}{}le=\"{}\"}} {}\n", metric, labels, separator, bound,
+      count
+    );
+  }
+  out << std::format(
+    "{}_bucket{{{}{}le=\"+Inf\"}} {}\n", metric, labels, separator,
+    histogram.count()
+  );
+  const auto braced = labels.empty() ? "" : std::format("{{{}}}", labels);
+  out << std::format("{}_sum{} {}\n", metric, braced, histogram.sum / divisor);
+  out << std::format("{}_count{} {}\n", metric, braced, histogram.count());
+}
+
+class RpcStats::Interceptor : public ::grpc::experimental::Interceptor
+{
+public:
+  explicit Interceptor(Method* method)
+    : _method(method)
+    , _start(std::chrono::steady_clock::now())
+  {
+    if (_method) {
+      ++_method->inflight;
+    }
+  }
+
+  ~Interceptor() override
+  {
+    if (!_method) {
+      return;
+    }
+    const uint64_t elapsed =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - _start
+      )
+        .count();
+    ++_method->buckets[HistogramData::Bucket(elapsed)];
+    _method->sum += elapsed;
+    --_method->inflight;
+  }
+
+  void Intercept(::grpc::experimental::InterceptorBatchMethods* methods
+  ) override
+  {
+    methods->Proceed();
+  }
+
+private:
+  Method* _method;
+  std::chrono::steady_clock::time_point _start;
+};
+
+std::unique_ptr<::grpc::experimental::ServerInterceptorFactoryInterface>
+RpcStats::interceptor()
+{
+  class Factory
+    : public ::grpc::experimental::ServerInterceptorFactoryInterface
+  {
+  public:
+    explicit Factory(RpcStats& stats)
+      : _stats(stats)
+    {
+    }
+
+    ::grpc::experimental::Interceptor*
+    CreateServerInterceptor(::grpc::experimental::ServerRpcInfo* info) override
+    {
+      return new Interceptor(_stats.find(info->method()));
+    }
+
+  private:
+    RpcStats& _stats;
+  };
+  return std::make_unique<Factory>(*this);
+}
+
+// Methods are named /<package>.<service>/<method>.
+RpcStats::Method* RpcStats::find(std::string_view path)
+{
+  const auto slash = path.rfind('/');
+  const auto name = slash == path.npos ? path : path.substr(slash + 1);
+  for (size_t i = 0; i < kMethods.size(); ++i) {
+    if (kMethods[i] == name) {
+      return &_methods[i];
+    }
+  }
+  return nullptr;
+}
+
+void RpcStats::write(std::ostream& out) const
+{
+  out << "# TYPE cashmere_rpc_in_flight gauge\n";
+  for (size_t i = 0; i < kMethods.size(); ++i) {
+    out << std::format(
+      "cashmere_rpc_in_flight{{method=\"{}\"}} {}\n", kMethods[i],
+      _methods[i].inflight.load()
+    );
+  }
+  out << "# TYPE " << MetricName("rpc_duration_ns") << " histogram\n";
+  for (size_t i = 0; i < kMethods.size(); ++i) {
+    HistogramData histogram;
+    for (size_t j = 0; j < kHistogramBuckets; ++j) {
+      histogram.buckets[j] = _methods[i].buckets[j].load();
+    }
+    histogram.sum = _methods[i].sum.load();
+    WriteHistogram(
+      out, "rpc_duration_ns", std::format("method=\"{}\"", kMethods[i]),
+      histogram
+    );
+  }
+}
+
+MetricsEndpoint::MetricsEndpoint(std::function<std::string()> render)
+  : _render(std::move(render))
+  , _socket(-1)
+{
+}
+
+MetricsEndpoint::~MetricsEndpoint()
+{
+  stop();
+}
+
+bool MetricsEndpoint::start(const std::string& host, uint16_t port)
+{
+  addrinfo hints{};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  addrinfo* found = nullptr;
+  const auto service = std::to_string(port);
+  if (getaddrinfo(
+        host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &found
+      ) != 0) {
+    return false;
+  }
+  for (auto* address = found; address; address = address->ai_next) {
+    _socket =
+      socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (_socket < 0) {
+      continue;
+    }
+    const int yes = 1;
+    setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if (bind(_socket, address->ai_addr, address->ai_addrlen) == 0 &&
+        listen(_socket, kBacklog) == 0) {
+      break;
+    }
+    close(_socket);
+    _socket = -1;
+  }
+  freeaddrinfo(found);
+  if (_socket < 0) {
+    return false;
+  }
+  _thread = std::thread(&MetricsEndpoint::serve, this);
+  return true;
+}
+
+// Shutting the socket down wakes accept() up.
+void MetricsEndpoint::stop()
+{
+  if (_socket < 0) {
+    return;
+  }
+  shutdown(_socket, SHUT_RDWR);
+  _thread.join();
+  close(_socket);
+  _socket = -1;
+}
+
+void MetricsEndpoint::serve()
+{
+  while (true) {
+    const int client = accept(_socket, nullptr, nullptr);
+    if (client < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) {
+        continue;
+      }
+      return;
+    }
+    respond(client);
+    close(client);
+  }
+}
+
+// Reads the request up to its blank line, whatever it asks for, and writes
+// the metrics. Clients that send nothing are given up on after a second.
+void MetricsEndpoint::respond(int client)
+{
+  timeval timeout{1, 0};
+  setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  std::string request;
+  char buffer[1024];
+  while (request.find("\r\n\r\n") == request.npos &&
+         request.size() < kMaxRequestSize) {
+    const auto size = recv(client, buffer, sizeof(buffer), 0);
+    if (size <= 0) {
+      return;
+    }
+    request.append(buffer, size);
+  }
+
+  const auto body = _render();
+  const auto response = std::format(
+    "HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/plain; version=0.0.4\r\n"
+    "Content-Length: {}\r\n"
+    "Connection: close\r\n\r\n{}",
+    body.size(), body
+  );
+  size_t sent = 0;
+  while (sent < response.size()) {
+    const auto size = send(
+      client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL
+    );
+    if (size <= 0) {
+      return;
+    }
+    sent += size;
+  }
+}
+
+}
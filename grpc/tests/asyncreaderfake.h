@@ -0,0 +1,94 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2025 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef CASHMERE_GTESTS_ASYNCREADERFAKE_H
+#define CASHMERE_GTESTS_ASYNCREADERFAKE_H
+
+#include <grpcpp/alarm.h>
+#include <grpcpp/support/async_unary_call.h>
+
+#include <chrono>
+#include <mutex>
+
+namespace Cashmere
+{
+
+// Completes an asynchronous call on its completion queue with the given
+// response and status, as soon as it is finished or, if held, once released.
+template <class Response>
+class AsyncReaderFake : public grpc::ClientAsyncResponseReaderInterface<Response>
+{
+public:
+  AsyncReaderFake(
+    grpc::CompletionQueue* queue, const Response& response,
+    const grpc::Status& status = grpc::Status::OK, bool held = false
+  )
+    : _queue(queue)
+    , _response(response)
+    , _status(status)
+    , _held(held)
+  {
+  }
+
+  void StartCall() override {}
+  void ReadInitialMetadata(void*) override {}
+
+  void Finish(Response* response, grpc::Status* status, void* tag) override
+  {
+    std::unique_lock lock(_mutex);
+    _out = {response, status, tag};
+    if (!_held) {
+      complete(lock);
+    }
+  }
+
+  // Completes the call, after which the reader is destroyed by its owner.
+  void release()
+  {
+    std::unique_lock lock(_mutex);
+    _held = false;
+    if (_out.tag) {
+      complete(lock);
+    }
+  }
+
+private:
+  void complete(std::unique_lock<std::mutex>& lock)
+  {
+    *_out.response = _response;
+    *_out.status = _status;
+    lock.unlock();
+    _alarm.Set(_queue, std::chrono::system_clock::now(), _out.tag);
+  }
+
+  struct Out
+  {
+    Response* response = nullptr;
+    grpc::Status* status = nullptr;
+    void* tag = nullptr;
+  };
+
+  grpc::CompletionQueue* _queue;
+  const Response _response;
+  const grpc::Status _status;
+  bool _held;
+  Out _out;
+  std::mutex _mutex;
+  grpc::Alarm _alarm;
+};
+
+}
+
+#endif
@@ -0,0 +1,144 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#ifndef CASHMERE_GTESTS_REPLICATESTREAMFAKE_H
+#define CASHMERE_GTESTS_REPLICATESTREAMFAKE_H
+
+#include <grpcpp/support/sync_stream.h>
+#include <proto/cashmere.pb.h>
+
+#include "cashmere/utils/grpc.h"
+
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <vector>
+
+namespace Cashmere
+{
+
+// Server end of a Replicate stream. Records the frames written to it and acks
+// each one with the clock of the entries received so far, as soon as it is
+// written or, if held, once released. A rejecting stream ends at the first
+// frame written instead, as the runner does when its entries are rejected.
+class ReplicateStreamFake
+  : public grpc::ClientReaderWriterInterface<
+      Grpc::ReplicateRequest, Grpc::ReplicateResponse>
+{
+public:
+  explicit ReplicateStreamFake(bool held = false, bool rejecting = false)
+    : _held(held)
+    , _rejecting(rejecting)
+    , _done(false)
+  {
+  }
+
+  void WaitForInitialMetadata() override {}
+
+  bool NextMessageSize(uint32_t* size) override
+  {
+    *size = std::numeric_limits<uint32_t>::max();
+    return true;
+  }
+
+  bool Write(const Grpc::ReplicateRequest& frame, grpc::WriteOptions) override
+  {
+    std::lock_guard lock(_mutex);
+    if (_done) {
+      return false;
+    }
+    _frames.push_back(frame);
+    if (_rejecting) {
+      _status = ::grpc::Status(::grpc::StatusCode::ABORTED, "rejected");
+      _done = true;
+      _changed.notify_all();
+      return true;
+    }
+    for (const auto& entry : frame.entries().entries()) {
+      _clock = _clock.merge(Utils::ClockFrom(entry.clock()));
+    }
+    Grpc::ReplicateResponse ack;
+    ack.set_sequence(frame.sequence());
+    Utils::SetClock(ack.mutable_clock(), _clock);
+    (_held ? _pending : _acks).push_back(ack);
+    _changed.notify_all();
+    return true;
+  }
+
+  bool WritesDone() override
+  {
+    close();
+    return true;
+  }
+
+  bool Read(Grpc::ReplicateResponse* ack) override
+  {
+    std::unique_lock lock(_mutex);
+    _changed.wait(lock, [this]() { return !_acks.empty() || _done; });
+    if (_acks.empty()) {
+      return false;
+    }
+    *ack = _acks.front();
+    _acks.pop_front();
+    return true;
+  }
+
+  grpc::Status Finish() override
+  {
+    std::lock_guard lock(_mutex);
+    return _status;
+  }
+
+  // Sends the acks held so far and those of the frames written from now on.
+  void release()
+  {
+    std::lock_guard lock(_mutex);
+    _held = false;
+    _acks.insert(_acks.end(), _pending.begin(), _pending.end());
+    _pending.clear();
+    _changed.notify_all();
+  }
+
+  // Ends the stream, as a server going away would, dropping the held acks.
+  void close()
+  {
+    std::lock_guard lock(_mutex);
+    _done = true;
+    _changed.notify_all();
+  }
+
+  std::vector<Grpc::ReplicateRequest> frames() const
+  {
+    std::lock_guard lock(_mutex);
+    return _frames;
+  }
+
+private:
+  bool _held;
+  bool _rejecting;
+  bool _done;
+  grpc::Status _status;
+  Clock _clock;
+  std::vector<Grpc::ReplicateRequest> _frames;
+  std::deque<Grpc::ReplicateResponse> _acks;
+  std::deque<Grpc::ReplicateResponse> _pending;
+  mutable std::mutex _mutex;
+  std::condition_variable _changed;
+};
+
+}
+
+#endif
@@ -15,12 +15,20 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <grpcpp/test/mock_stream.h>
 #include <proto/cashmere_mock.grpc.pb.h>
 
 #include "cashmere/brokerstore.h"
+#include "cashmere/metrics.h"
 #include "cashmere/plugins/grpc.h"
+#include "cashmere/utils/grpc.h"
 
+#include "asyncreaderfake.h"
 #include "brokermock.h"
+#include "replicatestreamfake.h"
+
+#include <future>
+#include <vector>
 
 using namespace ::Cashmere;
 using namespace ::testing;
@@ -29,12 +37,42 @@ constexpr int32_t kSource = 10;
 constexpr char const* kTestGrpcUrl = "grpc://test:123";
 
 using StubInterfacePtr = std::unique_ptr<Grpc::Broker::StubInterface>;
+using QueryReaderMock = grpc::testing::MockClientReader<Grpc::QueryResponse>;
+
+// Reader of a QueryStream call that sends the given chunks, then finishes
+// with the given status.
+QueryReaderMock* QueryReaderOf(
+  const std::vector<Grpc::QueryResponse>& chunks,
+  const grpc::Status& status = grpc::Status::OK
+)
+{
+  auto reader = new QueryReaderMock();
+  auto& read = EXPECT_CALL(*reader, Read(_));
+  for (const auto& chunk : chunks) {
+    read.WillOnce(DoAll(SetArgPointee<0>(chunk), Return(true)));
+  }
+  read.WillRepeatedly(Return(false));
+  EXPECT_CALL(*reader, Finish()).WillOnce(Return(status));
+  return reader;
+}
+
+Grpc::QueryResponse ChunkOf(const EntryList& entries)
+{
+  Grpc::QueryResponse chunk;
+  for (const auto& entry : entries) {
+    Utils::SetEntry(chunk.add_entries(), entry);
+  }
+  return chunk;
+}
 
 struct BrokerGrpcStubTest : public ::testing::Test
 {
   void SetUp() override {
     store = BrokerStore::create();
     stub = std::make_unique<Grpc::MockBrokerStub>();
+    ON_CALL(*stub, QueryStreamRaw(_, _)).WillByDefault([](auto, auto) {
+      return QueryReaderOf({});
+    });
   }
 
   BrokerStoreBasePtr store;
@@ -61,14 +99,13 @@ TEST_F(BrokerGrpcStubTest, StartsConnectionsUsingGrpcStub)
 
   EXPECT_CALL(
     *stub,
-    Query(
+    QueryStreamRaw(
       _,
-      ResultOf([](Grpc::QueryRequest in) { return in.sender(); }, Eq(kSource)),
-      _
+      ResultOf([](Grpc::QueryRequest in) { return in.sender(); }, Eq(kSource))
     )
   )
     .Times(1)
-    .WillOnce(DoAll(SetArgPointee<2>(queryResponse), Return(grpc::Status::OK)));
+    .WillOnce(Return(QueryReaderOf({queryResponse})));
 
   store->insert(kTestGrpcUrl, std::make_shared<BrokerGrpcStub>(std::move(stub)));
 
@@ -91,6 +128,8 @@ TEST_F(BrokerGrpcStubTest, InsertIsCalledPassingTheCorrectPort)
   Grpc::InsertResponse response;
   (*response.mutable_clock())[0xAA] = 1;
 
+  EXPECT_CALL(*stub, InsertBatch(_, _, _))
+    .WillOnce(Return(grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "old")));
   EXPECT_CALL(
     *stub,
     Insert(
@@ -107,6 +146,76 @@ TEST_F(BrokerGrpcStubTest, InsertIsCalledPassingTheCorrectPort)
   journal->connect(kTestGrpcUrl);
 }
 
+TEST_F(BrokerGrpcStubTest, InsertBatchIsCalledPassingTheCorrectPort)
+{
+  auto journal = store->getOrCreate("cache://aa");
+  journal->append(1000);
+
+  Grpc::ConnectionResponse resp;
+  resp.set_source(kSource);
+
+  EXPECT_CALL(*stub, Connect(_, _, _))
+    .Times(1)
+    .WillOnce(DoAll(SetArgPointee<2>(resp), Return(grpc::Status::OK)));
+
+  Grpc::InsertResponse response;
+  (*response.mutable_clock())[0xAA] = 1;
+
+  EXPECT_CALL(
+    *stub,
+    InsertBatch(
+      _,
+      ResultOf(
+        [](Grpc::InsertBatchRequest in) { return in.sender(); }, Eq(kSource)
+      ),
+      _
+    )
+  )
+    .Times(1)
+    .WillOnce(DoAll(SetArgPointee<2>(response), Return(grpc::Status::OK)));
+
+  store->insert(kTestGrpcUrl, std::make_shared<BrokerGrpcStub>(std::move(stub)));
+
+  journal->connect(kTestGrpcUrl);
+}
+
+TEST_F(BrokerGrpcStubTest, EntriesAreSentInTheEncodingAgreedOnConnect)
+{
+  auto journal = store->getOrCreate("cache://aa");
+  journal->append(1000);
+
+  Grpc::ConnectionResponse resp;
+  resp.set_source(kSource);
+  resp.set_encoding(Grpc::PACKED_CLOCKS);
+
+  EXPECT_CALL(
+    *stub,
+    Connect(
+      _,
+      ResultOf(
+        [](Grpc::ConnectionRequest in) { return in.encoding(); },
+        Eq(Utils::kLatestEncoding)
+      ),
+      _
+    )
+  )
+    .WillOnce(DoAll(SetArgPointee<2>(resp), Return(grpc::Status::OK)));
+
+  Grpc::InsertBatchRequest sent;
+  EXPECT_CALL(*stub, InsertBatch(_, _, _))
+    .WillOnce(DoAll(SaveArg<1>(&sent), Return(grpc::Status::OK)));
+
+  store->insert(kTestGrpcUrl, std::make_shared<BrokerGrpcStub>(std::move(stub)));
+  journal->connect(kTestGrpcUrl);
+
+  ASSERT_EQ(sent.entries_size(), 1);
+  EXPECT_TRUE(sent.entries(0).clock().empty());
+  EXPECT_EQ(Utils::ClockFrom(sent.base()), journal->clock());
+  EXPECT_EQ(
+    Utils::EntriesFrom(sent.entries(), sent.base()), journal->entries()
+  );
+}
+
 TEST_F(BrokerGrpcStubTest, InsertIsCalledOnConnect)
 {
   auto journal = store->getOrCreate("cache://aa@localhost");
@@ -115,6 +224,8 @@ TEST_F(BrokerGrpcStubTest, InsertIsCalledOnConnect)
   Grpc::InsertResponse response;
   (*response.mutable_clock())[0xAA] = 1;
 
+  EXPECT_CALL(*stub, InsertBatch(_, _, _))
+    .WillOnce(Return(grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "old")));
   EXPECT_CALL(*stub, Insert(_, _, _))
     .Times(1)
     .WillOnce(DoAll(SetArgPointee<2>(response), Return(grpc::Status::OK)));
@@ -123,6 +234,145 @@ TEST_F(BrokerGrpcStubTest, InsertIsCalledOnConnect)
   journal->connect(kTestGrpcUrl);
 }
 
+TEST_F(BrokerGrpcStubTest, InsertBatchIsCalledOnConnect)
+{
+  auto journal = store->getOrCreate("cache://aa@localhost");
+  journal->append(1000);
+
+  Grpc::InsertResponse response;
+  (*response.mutable_clock())[0xAA] = 1;
+
+  EXPECT_CALL(*stub, InsertBatch(_, _, _))
+    .Times(1)
+    .WillOnce(DoAll(SetArgPointee<2>(response), Return(grpc::Status::OK)));
+
+  store->insert(kTestGrpcUrl, std::make_shared<BrokerGrpcStub>(std::move(stub)));
+  journal->connect(kTestGrpcUrl);
+}
+
+TEST_F(BrokerGrpcStubTest, InsertsAreSentOneByOneWithoutBatching)
+{
+  EXPECT_CALL(*stub, Insert(_, _, _))
+    .Times(2)
+    .WillRepeatedly(Return(grpc::Status::OK));
+  EXPECT_CALL(*stub, InsertBatch(_, _, _)).Times(0);
+
+  BrokerGrpcStub grpcStub(std::move(stub));
+  grpcStub.insert(Entry{{{0xAA, 1}}, {0xAA, 10, {}}}, kSource);
+  grpcStub.insert(Entry{{{0xAA, 2}}, {0xAA, 20, {}}}, kSource);
+}
+
+TEST_F(BrokerGrpcStubTest, BatchesAreSentOneByOneToPeersWithoutInsertBatch)
+{
+  Grpc::InsertResponse response;
+  (*response.mutable_clock())[0xAA] = 2;
+  EXPECT_CALL(*stub, InsertBatch(_, _, _))
+    .Times(1)
+    .WillOnce(Return(grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "old")));
+  EXPECT_CALL(*stub, Insert(_, _, _))
+    .Times(4)
+    .WillRepeatedly(
+      DoAll(SetArgPointee<2>(response), Return(grpc::Status::OK))
+    );
+
+  BrokerGrpcStub grpcStub(std::move(stub));
+  const EntryList entries{
+    {{{0xAA, 1}}, {0xAA, 10, {}}},
+    {{{0xAA, 2}}, {0xAA, 20, {}}},
+  };
+  EXPECT_EQ(grpcStub.insert(entries, kSource), Clock({{0xAA, 2}}));
+  EXPECT_EQ(grpcStub.insert(entries, kSource), Clock({{0xAA, 2}}));
+}
+
+TEST_F(BrokerGrpcStubTest, InsertsAreBatchedUpToTheBatchSize)
+{
+  auto entriesSize = [](Grpc::InsertBatchRequest in) {
+    return in.entries_size();
+  };
+  EXPECT_CALL(*stub, Insert(_, _, _)).Times(0);
+  EXPECT_CALL(*stub, InsertBatch(_, ResultOf(entriesSize, Eq(2)), _))
+    .Times(2)
+    .WillRepeatedly(Return(grpc::Status::OK));
+
+  BrokerGrpcStub grpcStub(
+    std::move(stub), BatchPolicy{.entries = 2, .delay = std::chrono::hours(1)}
+  );
+  for (Time time = 1; time <= 4; ++time) {
+    grpcStub.insert(Entry{{{0xAA, time}}, {0xAA, 10, {}}}, kSource);
+  }
+}
+
+TEST_F(BrokerGrpcStubTest, BatchedInsertsAreOnlyAckedOnceSent)
+{
+  EXPECT_CALL(*stub, InsertBatch(_, _, _))
+    .WillOnce(Return(grpc::Status(grpc::StatusCode::UNAVAILABLE, "down")))
+    .WillOnce([](auto, auto, Grpc::InsertResponse* response) {
+      Utils::SetClock(response->mutable_clock(), Clock{{0xAA, 4}});
+      return grpc::Status::OK;
+    });
+
+  BrokerGrpcStub grpcStub(
+    std::move(stub), BatchPolicy{.entries = 2, .delay = std::chrono::hours(1)}
+  );
+  for (Time time = 1; time <= 3; ++time) {
+    const auto clock =
+      grpcStub.insert(Entry{{{0xAA, time}}, {0xAA, 10, {}}}, kSource);
+    EXPECT_EQ(clock, Clock{});
+  }
+  EXPECT_EQ(grpcStub.flush(), Clock({{0xAA, 4}}));
+}
+
+TEST_F(BrokerGrpcStubTest, PendingInsertsAreFlushedAfterTheDelay)
+{
+  std::promise<int> sent;
+  EXPECT_CALL(*stub, InsertBatch(_, _, _))
+    .Times(1)
+    .WillOnce([&sent](auto, const Grpc::InsertBatchRequest& request, auto) {
+      sent.set_value(request.entries_size());
+      return grpc::Status::OK;
+    });
+
+  BrokerGrpcStub grpcStub(
+    std::move(stub),
+    BatchPolicy{.entries = 256, .delay = std::chrono::milliseconds(1)}
+  );
+  grpcStub.insert(Entry{{{0xAA, 1}}, {0xAA, 10, {}}}, kSource);
+
+  auto future = sent.get_future();
+  ASSERT_EQ(future.wait_for(std::chrono::seconds(5)), std::future_status::ready);
+  EXPECT_EQ(future.get(), 1);
+}
+
+TEST_F(BrokerGrpcStubTest, PendingInsertsAreFlushedBeforeOtherCalls)
+{
+  InSequence sequence;
+  EXPECT_CALL(*stub, InsertBatch(_, _, _)).WillOnce(Return(grpc::Status::OK));
+  EXPECT_CALL(*stub, Relay(_, _, _)).WillOnce(Return(grpc::Status::OK));
+
+  BrokerGrpcStub grpcStub(
+    std::move(stub), BatchPolicy{.entries = 256, .delay = std::chrono::hours(1)}
+  );
+  grpcStub.insert(Entry{{{0xAA, 1}}, {0xAA, 10, {}}}, kSource);
+  grpcStub.relay(Data{0xBB, 10, {}}, kSource);
+}
+
+TEST(BatchPolicy, IsReadFromTheUrl)
+{
+  const auto policy =
+    BrokerGrpcStub::BatchPolicyFrom("grpc://localhost:5000?batch=256&flush_ms=3");
+  EXPECT_EQ(policy.entries, 256);
+  EXPECT_EQ(policy.delay, std::chrono::milliseconds(3));
+  EXPECT_EQ(BrokerGrpcStub::BatchPolicyFrom("grpc://localhost:5000").entries, 0);
+  EXPECT_EQ(
+    BrokerGrpcStub::BatchPolicyFrom("grpc://localhost:5000?batch=-1").entries, 0
+  );
+  EXPECT_EQ(
+    BrokerGrpcStub::BatchPolicyFrom("grpc://localhost:5000?batch=2&flush_ms=-1")
+      .entries,
+    0
+  );
+}
+
 TEST_F(BrokerGrpcStubTest, RefreshIsCalledOnDisconnect)
 {
   auto journal = store->getOrCreate("hub://");
@@ -171,7 +421,78 @@ TEST_F(BrokerGrpcStubTest, RefreshIsCalledWithSender)
 
   store->insert(kTestGrpcUrl, std::make_shared<BrokerGrpcStub>(std::move(stub)));
   broker->connect(kTestGrpcUrl);
-  EXPECT_TRUE(broker->refresh(Connection{}, 1));
+  const auto changed = Connection({}, 0, {}, {{0xCC, {0, {}}}});
+  EXPECT_TRUE(broker->refresh(changed, 1));
+}
+
+TEST_F(BrokerGrpcStubTest, UpdateSendsAnIncrementalRefresh)
+{
+  Grpc::ConnectionResponse resp;
+  resp.set_incremental(true);
+  EXPECT_CALL(*stub, Connect(_, _, _))
+    .WillOnce(DoAll(SetArgPointee<2>(resp), Return(grpc::Status::OK)));
+  EXPECT_CALL(
+    *stub, Refresh(
+             _,
+             AllOf(
+               ResultOf(
+                 [](Grpc::RefreshRequest in) { return in.incremental(); },
+                 Eq(true)
+               ),
+               ResultOf(
+                 [](Grpc::RefreshRequest in) { return in.sender(); },
+                 Eq(kSource)
+               )
+             ),
+             _
+           )
+  )
+    .Times(1)
+    .WillOnce(Return(grpc::Status::OK));
+
+  const auto broker = std::make_shared<BrokerGrpcStub>(std::move(stub));
+  broker->connect(Connection{});
+  EXPECT_TRUE(broker->update(Connection{}, kSource));
+}
+
+TEST_F(BrokerGrpcStubTest, UpdateIsRefusedByPeersWithoutIncrementalRefreshes)
+{
+  EXPECT_CALL(*stub, Connect(_, _, _))
+    .WillOnce(Return(grpc::Status::OK));
+  EXPECT_CALL(*stub, Refresh(_, _, _)).Times(0);
+
+  const auto broker = std::make_shared<BrokerGrpcStub>(std::move(stub));
+  broker->connect(Connection{});
+  EXPECT_FALSE(broker->update(Connection{}, kSource));
+}
+
+TEST_F(BrokerGrpcStubTest, PeersWithoutIncrementalRefreshesGetTheWholeMap)
+{
+  auto broker = store->getOrCreate("hub://aa@localhost");
+
+  Grpc::ConnectionResponse resp;
+  resp.set_source(kSource);
+  EXPECT_CALL(*stub, Connect(_, _, _))
+    .WillOnce(DoAll(SetArgPointee<2>(resp), Return(grpc::Status::OK)));
+  EXPECT_CALL(
+    *stub, Refresh(
+             _,
+             ResultOf(
+               [](Grpc::RefreshRequest in) {
+                 return std::pair(in.incremental(), in.sources().size());
+               },
+               Eq(std::pair(false, size_t{2}))
+             ),
+             _
+           )
+  )
+    .WillOnce(Return(grpc::Status::OK));
+
+  store->insert(kTestGrpcUrl, std::make_shared<BrokerGrpcStub>(std::move(stub)));
+  store->insert("hub://bb@localhost", std::make_shared<BrokerMock>());
+  broker->connect(kTestGrpcUrl);
+  broker->connect("hub://bb@localhost");
+  broker->refresh(Connection({}, 0, {}, {{0xBB, {0, {}}}, {0xCC, {0, {}}}}), 2);
 }
 
 TEST(BrokerStore, CanCreateGrpcType)
@@ -180,3 +501,653 @@ TEST(BrokerStore, CanCreateGrpcType)
   auto instance = store->getOrCreate("grpc://0.0.0.0:9999");
   ASSERT_EQ(instance->schema(), "grpc");
 }
+
+TEST_F(BrokerGrpcStubTest, RelaySendsTheBytesTheEntryWasReceivedAs)
+{
+  const Data data{0xAA, 10, {}};
+  Grpc::Data proto;
+  Utils::SetData(&proto, data);
+  const auto received = proto.SerializeAsString();
+
+  EXPECT_CALL(
+    *stub,
+    Relay(
+      _,
+      ResultOf(
+        [](Grpc::RelayInsertRequest in) { return in.entry(); }, Eq(received)
+      ),
+      _
+    )
+  )
+    .WillOnce(Return(grpc::Status::OK));
+
+  BrokerGrpcStub grpcStub(std::move(stub));
+  const Utils::Forwarded forwarded(data, received, Grpc::MAP_CLOCKS);
+  grpcStub.relay(data, kSource);
+}
+
+TEST_F(BrokerGrpcStubTest, AsyncInsertReturnsTheRemoteClock)
+{
+  Grpc::InsertResponse response;
+  (*response.mutable_clock())[0xAA] = 1;
+
+  EXPECT_CALL(
+    *stub, PrepareAsyncInsertRaw(
+             _,
+             ResultOf(
+               [](Grpc::InsertRequest in) { return in.sender(); }, Eq(kSource)
+             ),
+             _
+           )
+  )
+    .WillOnce([&response](auto, auto, auto queue) {
+      return new AsyncReaderFake(queue, response);
+    });
+
+  BrokerGrpcStub grpcStub(std::move(stub));
+  auto call = grpcStub.insertAsync(Entry{{{0xAA, 1}}, {0xAA, 10, {}}}, kSource);
+  EXPECT_EQ(call.result.get(), Clock({{0xAA, 1}}));
+}
+
+TEST_F(BrokerGrpcStubTest, AsyncCallsHaveTheGivenDeadline)
+{
+  std::chrono::system_clock::time_point deadline;
+  EXPECT_CALL(*stub, PrepareAsyncGetClockRaw(_, _, _))
+    .WillOnce([&deadline](auto context, auto, auto queue) {
+      deadline = context->deadline();
+      return new AsyncReaderFake(queue, Grpc::ClockResponse{});
+    });
+
+  BrokerGrpcStub grpcStub(std::move(stub));
+  const auto start = std::chrono::system_clock::now();
+  grpcStub.clockAsync(std::chrono::seconds(10)).result.wait();
+
+  EXPECT_GE(deadline, start + std::chrono::seconds(10));
+  EXPECT_LT(deadline, start + std::chrono::seconds(20));
+}
+
+TEST_F(BrokerGrpcStubTest, FailedAsyncCallsReturnTheFailureValues)
+{
+  const grpc::Status cancelled(grpc::StatusCode::CANCELLED, "");
+  EXPECT_CALL(*stub, PrepareAsyncRelayRaw(_, _, _))
+    .WillOnce([&cancelled](auto, auto, auto queue) {
+      return new AsyncReaderFake(queue, Grpc::InsertResponse{}, cancelled);
+    });
+  EXPECT_CALL(*stub, PrepareAsyncRefreshRaw(_, _, _))
+    .WillOnce([&cancelled](auto, auto, auto queue) {
+      return new AsyncReaderFake(
+        queue, ::google::protobuf::Empty{}, cancelled
+      );
+    });
+
+  BrokerGrpcStub grpcStub(std::move(stub));
+  auto relay = grpcStub.relayAsync(Data{0xBB, 10, {}}, kSource);
+  relay.cancel();
+  EXPECT_FALSE(relay.result.get().valid());
+  EXPECT_FALSE(grpcStub.refreshAsync(Connection{}, kSource).result.get());
+}
+
+TEST_F(BrokerGrpcStubTest, InsertsArePipelinedUpToTheInflightLimit)
+{
+  std::vector<AsyncReaderFake<Grpc::InsertResponse>*> readers;
+  EXPECT_CALL(*stub, PrepareAsyncInsertRaw(_, _, _))
+    .Times(3)
+    .WillRepeatedly([&readers](auto, const Grpc::InsertRequest& request, auto queue) {
+      Grpc::Entry entry;
+      entry.ParseFromString(request.entry());
+      Grpc::InsertResponse response;
+      *response.mutable_clock() = entry.clock();
+      const auto reader = new AsyncReaderFake(
+        queue, response, grpc::Status::OK, true
+      );
+      readers.push_back(reader);
+      return reader;
+    });
+  EXPECT_CALL(*stub, Insert(_, _, _)).Times(0);
+
+  BrokerGrpcStub grpcStub(std::move(stub), {}, 4);
+  for (Time time = 1; time <= 3; ++time) {
+    const auto clock =
+      grpcStub.insert(Entry{{{0xAA, time}}, {0xAA, 10, {}}}, kSource);
+    EXPECT_EQ(clock, Clock{});
+  }
+  ASSERT_EQ(readers.size(), 3);
+
+  auto flushed = std::async(std::launch::async, [&grpcStub] {
+    return grpcStub.flush();
+  });
+  EXPECT_EQ(
+    flushed.wait_for(std::chrono::milliseconds(50)),
+    std::future_status::timeout
+  );
+  for (const auto reader : readers) {
+    reader->release();
+  }
+  EXPECT_EQ(
+    flushed.wait_for(std::chrono::seconds(5)), std::future_status::ready
+  );
+  EXPECT_EQ(flushed.get(), Clock({{0xAA, 3}}));
+}
+
+TEST(Inflight, IsReadFromTheUrl)
+{
+  EXPECT_EQ(BrokerGrpcStub::InflightFrom("grpc://localhost:5000?inflight=8"), 8);
+  EXPECT_EQ(BrokerGrpcStub::InflightFrom("grpc://localhost:5000"), 0);
+}
+
+TEST(ChannelPolicy, IsReadFromTheUrl)
+{
+  const auto policy = BrokerGrpcStub::ChannelPolicyFrom(
+    "grpc://localhost:5000?keepalive_ms=10000&keepalive_timeout_ms=500"
+    "&max_message_bytes=1048576"
+  );
+  EXPECT_EQ(policy.keepalive, std::chrono::seconds(10));
+  EXPECT_EQ(policy.keepaliveTimeout, std::chrono::milliseconds(500));
+  EXPECT_EQ(policy.maxMessageBytes, 1 << 20);
+  EXPECT_EQ(
+    BrokerGrpcStub::ChannelPolicyFrom("grpc://localhost:5000"), ChannelPolicy{}
+  );
+}
+
+TEST(SharedChannel, IsSharedByEveryStubToTheSameHostAndPolicy)
+{
+  const ChannelPolicy keepalive{.keepalive = std::chrono::seconds(10)};
+  const auto channel = BrokerGrpcStub::SharedChannel("test:123", {});
+
+  EXPECT_EQ(BrokerGrpcStub::SharedChannel("TEST:123", {}), channel);
+  EXPECT_NE(BrokerGrpcStub::SharedChannel("test:124", {}), channel);
+  EXPECT_NE(BrokerGrpcStub::SharedChannel("test:123", keepalive), channel);
+}
+
+TEST(SharedChannel, IsSharedByTheNamesOfTheSameAddress)
+{
+  const auto channel = BrokerGrpcStub::SharedChannel("localhost:123", {});
+
+  EXPECT_EQ(BrokerGrpcStub::SharedChannel("127.0.0.1:123", {}), channel);
+  EXPECT_NE(BrokerGrpcStub::SharedChannel("127.0.0.2:123", {}), channel);
+}
+
+TEST_F(BrokerGrpcStubTest, QueryReadsEveryChunkOfTheStream)
+{
+  const Entry first{{{0xAA, 1}}, {0xAA, 10, {}}};
+  const Entry second{{{0xAA, 2}}, {0xAA, 20, {}}};
+  const Entry third{{{0xBB, 1}}, {0xBB, 30, {}}};
+
+  EXPECT_CALL(*stub, QueryStreamRaw(_, _))
+    .WillOnce(
+      Return(QueryReaderOf({ChunkOf({first, second}), ChunkOf({third})}))
+    );
+
+  BrokerGrpcStub grpcStub(std::move(stub));
+  EXPECT_EQ(grpcStub.query({}, kSource), EntryList({first, second, third}));
+}
+
+TEST_F(BrokerGrpcStubTest, QueriesPeersWithoutQueryStreamWithQuery)
+{
+  const Entry first{{{0xAA, 1}}, {0xAA, 10, {}}};
+  const Entry second{{{0xAA, 2}}, {0xAA, 20, {}}};
+  Grpc::QueryResponse response = ChunkOf({first, second});
+
+  EXPECT_CALL(*stub, QueryStreamRaw(_, _))
+    .Times(1)
+    .WillOnce(Return(QueryReaderOf(
+      {}, grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "old")
+    )));
+  EXPECT_CALL(*stub, Query(_, _, _))
+    .Times(2)
+    .WillRepeatedly(
+      DoAll(SetArgPointee<2>(response), Return(grpc::Status::OK))
+    );
+
+  BrokerGrpcStub grpcStub(std::move(stub));
+  EXPECT_EQ(grpcStub.query({}, kSource), EntryList({first, second}));
+
+  EntryList visited;
+  EXPECT_TRUE(grpcStub.scan(
+    {}, kSource,
+    [&visited](const Entry& entry) {
+      visited.push_back(entry);
+      return true;
+    },
+    &first
+  ));
+  EXPECT_EQ(visited, EntryList({second}));
+}
+
+TEST_F(BrokerGrpcStubTest, ScanCancelsTheStreamOnceStopped)
+{
+  const Entry first{{{0xAA, 1}}, {0xAA, 10, {}}};
+  const Entry second{{{0xAA, 2}}, {0xAA, 20, {}}};
+
+  auto reader = new QueryReaderMock();
+  EXPECT_CALL(*reader, Read(_))
+    .WillOnce(DoAll(SetArgPointee<0>(ChunkOf({first, second})), Return(true)));
+  EXPECT_CALL(*reader, Finish())
+    .WillOnce(Return(grpc::Status(grpc::StatusCode::CANCELLED, "")));
+
+  EXPECT_CALL(*stub, QueryStreamRaw(_, _)).WillOnce(Return(reader));
+
+  BrokerGrpcStub grpcStub(std::move(stub));
+  EntryList visited;
+  EXPECT_FALSE(grpcStub.scan({}, kSource, [&visited](const Entry& entry) {
+    visited.push_back(entry);
+    return false;
+  }));
+  EXPECT_EQ(visited, EntryList({first}));
+}
+
+TEST_F(BrokerGrpcStubTest, ScanResumesAfterTheGivenEntry)
+{
+  const Entry after{{{0xAA, 1}}, {0xAA, 10, {}}};
+
+  EXPECT_CALL(
+    *stub,
+    QueryStreamRaw(
+      _, ResultOf(
+           [](Grpc::QueryRequest in) { return Utils::EntryFrom(in.after()); },
+           Eq(after)
+         )
+    )
+  )
+    .WillOnce(Return(QueryReaderOf({})));
+
+  BrokerGrpcStub grpcStub(std::move(stub));
+  EXPECT_TRUE(
+    grpcStub.scan({}, kSource, [](const Entry&) { return true; }, &after)
+  );
+}
+
+TEST_F(BrokerGrpcStubTest, InsertsAreSentAsFramesOfTheReplicateStream)
+{
+  const Entry first{{{0xAA, 1}}, {0xAA, 10, {}}};
+  const Entry second{{{0xAA, 2}}, {0xAA, 20, {}}};
+
+  auto stream = new ReplicateStreamFake();
+  EXPECT_CALL(*stub, ReplicateRaw(_)).WillOnce(Return(stream));
+  EXPECT_CALL(*stub, Insert(_, _, _)).Times(0);
+
+  BrokerGrpcStub grpcStub(std::move(stub), {}, 0, 4);
+  grpcStub.insert(first, kSource);
+  grpcStub.insert(second, kSource);
+  EXPECT_EQ(grpcStub.flush(), second.clock);
+
+  const auto frames = stream->frames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(frames[0].sequence(), 1);
+  EXPECT_EQ(frames[0].entries().sender(), kSource);
+  EXPECT_EQ(Utils::EntryFrom(frames[0].entries().entries(0)), first);
+  EXPECT_EQ(frames[1].sequence(), 2);
+  EXPECT_EQ(Utils::EntryFrom(frames[1].entries().entries(0)), second);
+}
+
+TEST_F(BrokerGrpcStubTest, InsertsWaitForAcksOnceTheWindowIsFull)
+{
+  auto stream = new ReplicateStreamFake(true);
+  EXPECT_CALL(*stub, ReplicateRaw(_)).WillOnce(Return(stream));
+
+  BrokerGrpcStub grpcStub(std::move(stub), {}, 0, 2);
+  grpcStub.insert({{{0xAA, 1}}, {0xAA, 10, {}}}, kSource);
+  grpcStub.insert({{{0xAA, 2}}, {0xAA, 20, {}}}, kSource);
+
+  auto third = std::async(std::launch::async, [&grpcStub]() {
+    return grpcStub.insert({{{0xAA, 3}}, {0xAA, 30, {}}}, kSource);
+  });
+  EXPECT_EQ(
+    third.wait_for(std::chrono::milliseconds(50)), std::future_status::timeout
+  );
+  EXPECT_EQ(stream->frames().size(), 2);
+
+  stream->release();
+  EXPECT_TRUE(third.get().smallerThan(Clock({{0xAA, 3}})));
+  EXPECT_EQ(stream->frames().size(), 3);
+  EXPECT_EQ(grpcStub.flush(), Clock({{0xAA, 3}}));
+}
+
+TEST_F(BrokerGrpcStubTest, RefreshIsSentAsAFrameOfTheReplicateStream)
+{
+  Grpc::ConnectionResponse resp;
+  resp.set_incremental(true);
+  EXPECT_CALL(*stub, Connect(_, _, _))
+    .WillOnce(DoAll(SetArgPointee<2>(resp), Return(grpc::Status::OK)));
+  auto stream = new ReplicateStreamFake();
+  EXPECT_CALL(*stub, ReplicateRaw(_)).WillOnce(Return(stream));
+  EXPECT_CALL(*stub, Refresh(_, _, _)).Times(0);
+
+  const auto grpcStub =
+    std::make_shared<BrokerGrpcStub>(std::move(stub), BatchPolicy{}, 0, 4);
+  grpcStub->connect(Connection{});
+  Connection conn;
+  conn.source() = 2;
+  EXPECT_TRUE(grpcStub->update(conn, kSource));
+  grpcStub->flush();
+
+  const auto frames = stream->frames();
+  ASSERT_EQ(frames.size(), 1);
+  EXPECT_EQ(frames[0].refresh().sender(), kSource);
+  EXPECT_EQ(frames[0].refresh().source(), 2);
+  EXPECT_TRUE(frames[0].refresh().incremental());
+}
+
+TEST_F(BrokerGrpcStubTest, FramesWithoutAckAreSentAgainOnANewStream)
+{
+  const Entry first{{{0xAA, 1}}, {0xAA, 10, {}}};
+  const Entry second{{{0xAA, 2}}, {0xAA, 20, {}}};
+
+  auto broken = new ReplicateStreamFake(true);
+  auto stream = new ReplicateStreamFake();
+  EXPECT_CALL(*stub, ReplicateRaw(_))
+    .WillOnce(Return(broken))
+    .WillOnce(Return(stream));
+
+  BrokerGrpcStub grpcStub(std::move(stub), {}, 0, 1);
+  grpcStub.insert(first, kSource);
+  broken->close();
+  grpcStub.insert(second, kSource);
+  grpcStub.flush();
+
+  const auto frames = stream->frames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(frames[0].sequence(), 1);
+  EXPECT_EQ(Utils::EntryFrom(frames[0].entries().entries(0)), first);
+  EXPECT_EQ(frames[1].sequence(), 2);
+  EXPECT_EQ(Utils::EntryFrom(frames[1].entries().entries(0)), second);
+}
+
+TEST_F(BrokerGrpcStubTest, FramesWithoutAckAreKeptWhenTheirResendFails)
+{
+  const Entry first{{{0xAA, 1}}, {0xAA, 10, {}}};
+  const Entry second{{{0xAA, 2}}, {0xAA, 20, {}}};
+  const Entry third{{{0xAA, 3}}, {0xAA, 30, {}}};
+
+  auto broken = new ReplicateStreamFake(true);
+  auto refused = new ReplicateStreamFake();
+  refused->close();
+  auto stream = new ReplicateStreamFake();
+  EXPECT_CALL(*stub, ReplicateRaw(_))
+    .WillOnce(Return(broken))
+    .WillOnce(Return(refused))
+    .WillOnce(Return(stream));
+
+  BrokerGrpcStub grpcStub(std::move(stub), {}, 0, 1);
+  grpcStub.insert(first, kSource);
+  broken->close();
+  EXPECT_EQ(grpcStub.insert(second, kSource), Clock{});
+  grpcStub.insert(third, kSource);
+  EXPECT_EQ(grpcStub.flush(), third.clock);
+
+  const auto frames = stream->frames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(Utils::EntryFrom(frames[0].entries().entries(0)), first);
+  EXPECT_EQ(Utils::EntryFrom(frames[1].entries().entries(0)), third);
+}
+
+TEST_F(BrokerGrpcStubTest, InsertsStopWaitingForAcksAfterTheInsertDeadline)
+{
+  const Entry first{{{0xAA, 1}}, {0xAA, 10, {}}};
+  const Entry second{{{0xAA, 2}}, {0xAA, 20, {}}};
+  const Entry third{{{0xAA, 3}}, {0xAA, 30, {}}};
+
+  auto stalled = new ReplicateStreamFake(true);
+  auto stream = new ReplicateStreamFake();
+  EXPECT_CALL(*stub, ReplicateRaw(_))
+    .WillOnce(Return(stalled))
+    .WillOnce(Return(stream));
+
+  CallPolicy calls;
+  calls.deadlines["insert"] = std::chrono::milliseconds(20);
+  BrokerGrpcStub grpcStub(std::move(stub), {}, 0, 1, calls);
+  grpcStub.insert(first, kSource);
+  EXPECT_EQ(grpcStub.insert(second, kSource), Clock{});
+  // Ends the stream as the cancellation would.
+  stalled->close();
+  grpcStub.insert(third, kSource);
+  EXPECT_EQ(grpcStub.flush(), third.clock);
+
+  const auto frames = stream->frames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(Utils::EntryFrom(frames[0].entries().entries(0)), first);
+  EXPECT_EQ(Utils::EntryFrom(frames[1].entries().entries(0)), third);
+}
+
+TEST_F(BrokerGrpcStubTest, FlushStopsWaitingForAcksAfterTheInsertDeadline)
+{
+  auto stalled = new ReplicateStreamFake(true);
+  EXPECT_CALL(*stub, ReplicateRaw(_)).WillOnce(Return(stalled));
+
+  CallPolicy calls;
+  calls.deadlines["insert"] = std::chrono::milliseconds(20);
+  BrokerGrpcStub grpcStub(std::move(stub), {}, 0, 4, calls);
+  grpcStub.insert({{{0xAA, 1}}, {0xAA, 10, {}}}, kSource);
+  EXPECT_EQ(grpcStub.flush(), Clock{});
+}
+
+TEST_F(BrokerGrpcStubTest, FramesRejectedThreeTimesAreDropped)
+{
+  const Entry first{{{0xAA, 1}}, {0xAA, 10, {}}};
+  const Entry second{{{0xAA, 2}}, {0xAA, 20, {}}};
+  const Entry third{{{0xAA, 3}}, {0xAA, 30, {}}};
+  const Entry fourth{{{0xAA, 4}}, {0xAA, 40, {}}};
+
+  auto stream = new ReplicateStreamFake();
+  EXPECT_CALL(*stub, ReplicateRaw(_))
+    .WillOnce(Return(new ReplicateStreamFake(false, true)))
+    .WillOnce(Return(new ReplicateStreamFake(false, true)))
+    .WillOnce(Return(new ReplicateStreamFake(false, true)))
+    .WillOnce(Return(stream));
+
+  const auto before = Metrics::Snapshot();
+  BrokerGrpcStub grpcStub(std::move(stub), {}, 0, 1);
+  grpcStub.insert(first, kSource);
+  EXPECT_EQ(grpcStub.insert(second, kSource), Clock{});
+  EXPECT_EQ(grpcStub.insert(third, kSource), Clock{});
+  grpcStub.insert(fourth, kSource);
+  EXPECT_EQ(grpcStub.flush(), fourth.clock);
+  const auto recorded = Metrics::Snapshot() - before;
+  EXPECT_EQ(recorded[Counter::ReplicateFramesDropped], 1);
+
+  const auto frames = stream->frames();
+  ASSERT_EQ(frames.size(), 2);
+  EXPECT_EQ(Utils::EntryFrom(frames[0].entries().entries(0)), second);
+  EXPECT_EQ(Utils::EntryFrom(frames[1].entries().entries(0)), fourth);
+}
+
+TEST(ReplicateWindow, IsReadFromTheUrl)
+{
+  EXPECT_EQ(
+    BrokerGrpcStub::ReplicateWindowFrom("grpc://localhost:5000?replicate=32"),
+    32
+  );
+  EXPECT_EQ(BrokerGrpcStub::ReplicateWindowFrom("grpc://localhost:5000"), 0);
+}
+
+TEST(CallPolicy, IsReadFromTheUrl)
+{
+  const auto policy = BrokerGrpcStub::CallPolicyFrom(
+    "grpc://localhost:5000?deadline_ms=2000&clock_deadline_ms=100&retries=3"
+    "&backoff_ms=10&backoff_max_ms=50&hedge_ms=20&peers=a:5000,b:5000"
+  );
+  EXPECT_EQ(policy.deadlineOf("clock"), std::chrono::milliseconds(100));
+  EXPECT_EQ(policy.deadlineOf("insert"), std::chrono::seconds(2));
+  EXPECT_EQ(policy.retries, 3);
+  EXPECT_EQ(policy.backoff, std::chrono::milliseconds(10));
+  EXPECT_EQ(policy.maxBackoff, std::chrono::milliseconds(50));
+  EXPECT_EQ(policy.hedge, std::chrono::milliseconds(20));
+  EXPECT_EQ(policy.peers, std::vector<std::string>({"a:5000", "b:5000"}));
+  EXPECT_EQ(
+    BrokerGrpcStub::CallPolicyFrom("grpc://localhost:5000"), CallPolicy{}
+  );
+}
+
+TEST(CallPolicy, BackoffIsRandomUpToTheDoubledBaseAndCapped)
+{
+  const CallPolicy policy{
+    .backoff = std::chrono::milliseconds(10),
+    .maxBackoff = std::chrono::milliseconds(30)
+  };
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_LE(policy.backoffOf(0), std::chrono::milliseconds(10));
+    EXPECT_LE(policy.backoffOf(1), std::chrono::milliseconds(20));
+    EXPECT_LE(policy.backoffOf(5), std::chrono::milliseconds(30));
+  }
+}
+
+TEST_F(BrokerGrpcStubTest, CallsHaveTheDeadlineOfTheirMethod)
+{
+  std::chrono::system_clock::time_point clock;
+  std::chrono::system_clock::time_point sources;
+  EXPECT_CALL(*stub, GetClock(_, _, _))
+    .WillOnce([&clock](auto context, auto, auto) {
+      clock = context->deadline();
+      return grpc::Status::OK;
+    });
+  EXPECT_CALL(*stub, Sources(_, _, _))
+    .WillOnce([&sources](auto context, auto, auto) {
+      sources = context->deadline();
+      return grpc::Status::OK;
+    });
+
+  const CallPolicy calls{
+    .deadline = std::chrono::seconds(100),
+    .deadlines = {{"clock", std::chrono::seconds(10)}}
+  };
+  BrokerGrpcStub grpcStub(std::move(stub), {}, 0, 0, calls);
+  const auto start = std::chrono::system_clock::now();
+  grpcStub.clock();
+  grpcStub.sources(kSource);
+
+  EXPECT_GE(clock, start + std::chrono::seconds(10));
+  EXPECT_LT(clock, start + std::chrono::seconds(20));
+  EXPECT_GE(sources, start + std::chrono::seconds(100));
+  EXPECT_LT(sources, start + std::chrono::seconds(110));
+}
+
+TEST_F(BrokerGrpcStubTest, IdempotentCallsAreRetriedOnTransientFailures)
+{
+  const grpc::Status unavailable(grpc::StatusCode::UNAVAILABLE, "");
+  Grpc::ClockResponse response;
+  (*response.mutable_clock())[0xAA] = 1;
+  EXPECT_CALL(*stub, GetClock(_, _, _))
+    .WillOnce(Return(unavailable))
+    .WillOnce(Return(unavailable))
+    .WillOnce(DoAll(SetArgPointee<2>(response), Return(grpc::Status::OK)));
+  EXPECT_CALL(*stub, Sources(_, _, _))
+    .Times(3)
+    .WillRepeatedly(Return(unavailable));
+  EXPECT_CALL(*stub, Relay(_, _, _)).WillOnce(Return(unavailable));
+
+  const CallPolicy calls{
+    .retries = 2, .backoff = std::chrono::milliseconds(1)
+  };
+  BrokerGrpcStub grpcStub(std::move(stub), {}, 0, 0, calls);
+  EXPECT_EQ(grpcStub.clock(), Clock({{0xAA, 1}}));
+  EXPECT_EQ(grpcStub.sources(kSource), SourcesMap{});
+  EXPECT_FALSE(grpcStub.relay(Data{0xBB, 10, {}}, kSource).valid());
+}
+
+TEST_F(BrokerGrpcStubTest, LagIsReadFromTheRemoteBroker)
+{
+  const std::chrono::system_clock::time_point progress(
+    std::chrono::milliseconds(1234)
+  );
+  const PeerLagList peers = {{1, 0xAA, 3, progress}, {2, 0xBB, 0, progress}};
+  Grpc::LagResponse response;
+  Utils::SetLag(response.mutable_peers(), peers);
+  EXPECT_CALL(*stub, Lag(_, _, _))
+    .WillOnce(DoAll(SetArgPointee<2>(response), Return(grpc::Status::OK)));
+
+  BrokerGrpcStub grpcStub(std::move(stub));
+  EXPECT_EQ(grpcStub.lag(), peers);
+}
+
+TEST_F(BrokerGrpcStubTest, RetriedQueriesResumeAfterTheLastVisitedEntry)
+{
+  const Entry first{{{0xAA, 1}}, {0xAA, 10, {}}};
+  const Entry second{{{0xAA, 2}}, {0xAA, 20, {}}};
+
+  auto broken = new QueryReaderMock();
+  EXPECT_CALL(*broken, Read(_))
+    .WillOnce(DoAll(SetArgPointee<0>(ChunkOf({first})), Return(true)))
+    .WillOnce(Return(false));
+  EXPECT_CALL(*broken, Finish())
+    .WillOnce(Return(grpc::Status(grpc::StatusCode::UNAVAILABLE, "")));
+
+  EXPECT_CALL(*stub, QueryStreamRaw(_, _))
+    .WillOnce(Return(broken))
+    .WillOnce([&first, &second](auto, const Grpc::QueryRequest& request) {
+      EXPECT_EQ(Utils::EntryFrom(request.after()), first);
+      return QueryReaderOf({ChunkOf({second})});
+    });
+
+  const CallPolicy calls{
+    .retries = 1, .backoff = std::chrono::milliseconds(1)
+  };
+  BrokerGrpcStub grpcStub(std::move(stub), {}, 0, 0, calls);
+  EXPECT_EQ(grpcStub.query({}, kSource), EntryList({first, second}));
+}
+
+TEST_F(BrokerGrpcStubTest, SlowQueriesAreHedgedToTheEquivalentPeers)
+{
+  const Entry first{{{0xAA, 1}}, {0xAA, 10, {}}};
+  const Entry second{{{0xAA, 2}}, {0xAA, 20, {}}};
+
+  // The slow stream ends, as cancelled, once the peer has answered.
+  std::promise<void> answered;
+  auto slow = new QueryReaderMock();
+  EXPECT_CALL(*slow, Read(_))
+    .WillOnce([done = answered.get_future()](auto) {
+      done.wait();
+      return false;
+    });
+  EXPECT_CALL(*slow, Finish()).WillOnce(Return(grpc::Status::CANCELLED));
+  EXPECT_CALL(
+    *stub, QueryStreamRaw(_, Property(&Grpc::QueryRequest::sender, kSource))
+  )
+    .WillOnce(Return(slow));
+
+  auto fast = new QueryReaderMock();
+  EXPECT_CALL(*fast, Read(_))
+    .WillOnce(DoAll(SetArgPointee<0>(ChunkOf({first})), Return(true)))
+    .WillOnce(DoAll(SetArgPointee<0>(ChunkOf({second})), Return(true)))
+    .WillOnce(Return(false));
+  EXPECT_CALL(*fast, Finish()).WillOnce([&answered]() {
+    answered.set_value();
+    return grpc::Status::OK;
+  });
+  auto peer = std::make_unique<Grpc::MockBrokerStub>();
+  EXPECT_CALL(
+    *peer, QueryStreamRaw(_, Property(&Grpc::QueryRequest::sender, 0))
+  )
+    .WillOnce(Return(fast));
+
+  std::vector<StubInterfacePtr> peers;
+  peers.push_back(std::move(peer));
+  const CallPolicy calls{.hedge = std::chrono::milliseconds(10)};
+  BrokerGrpcStub grpcStub(
+    std::move(stub), {}, 0, 0, calls, std::move(peers)
+  );
+  EXPECT_EQ(grpcStub.query({}, kSource), EntryList({first, second}));
+}
+
+TEST_F(BrokerGrpcStubTest, OnlyRequestsAboveTheThresholdAreCompressed)
+{
+  std::vector<grpc_compression_algorithm> algorithms;
+  EXPECT_CALL(*stub, Relay(_, _, _))
+    .Times(2)
+    .WillRepeatedly([&algorithms](auto context, auto, auto) {
+      algorithms.push_back(context->compression_algorithm());
+      return grpc::Status::OK;
+    });
+
+  Clock alters;
+  for (Id id = 1; id <= 100; ++id) {
+    alters[id] = id;
+  }
+  const CallPolicy calls{.compression = {GRPC_COMPRESS_GZIP, 256}};
+  BrokerGrpcStub grpcStub(std::move(stub), {}, 0, 0, calls);
+  grpcStub.relay(Data{0xAA, 10, {}}, kSource);
+  grpcStub.relay(Data{0xAA, 10, alters}, kSource);
+
+  EXPECT_EQ(
+    algorithms, std::vector({GRPC_COMPRESS_NONE, GRPC_COMPRESS_GZIP})
+  );
+}
@@ -0,0 +1,166 @@
+// Cashmere - a distributed conflict-free replicated database.
+// Copyright (C) 2026 Aeliton G. Silva
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Affero General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Affero General Public License for more details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include "cashmere/utils/grpc.h"
+
+using namespace ::Cashmere;
+using namespace ::testing;
+
+namespace
+{
+
+const EntryList kEntries = {
+  {{{0xAA, 1}}, {0xAA, 10, {}}},
+  {{{0xAA, 2}, {0xBB, 1}}, {0xBB, 20, {}}},
+  {{{0xAA, 3}, {0xBB, 1}, {0xCC, 5}}, {0xAA, 30, {{0xAA, 1}}}},
+  {{}, {0xDD, 40, {}}},
+};
+
+Grpc::QueryResponse Encode(const EntryList& entries, Grpc::Encoding encoding)
+{
+  Grpc::QueryResponse batch;
+  Utils::SetEntries(
+    batch.mutable_entries(), batch.mutable_base(), entries, encoding
+  );
+  return batch;
+}
+
+}
+
+TEST(GrpcUtils, PackedBatchesDecodeToTheSameEntries)
+{
+  const auto batch = Encode(kEntries, Grpc::PACKED_CLOCKS);
+  EXPECT_EQ(Utils::EntriesFrom(batch.entries(), batch.base()), kEntries);
+}
+
+TEST(GrpcUtils, MapBatchesDecodeToTheSameEntries)
+{
+  const auto batch = Encode(kEntries, Grpc::MAP_CLOCKS);
+  EXPECT_FALSE(batch.entries(0).has_packed_clock());
+  EXPECT_EQ(Utils::EntriesFrom(batch.entries(), batch.base()), kEntries);
+}
+
+TEST(GrpcUtils, PackedBatchClocksAreRelativeToTheEarliestTimes)
+{
+  const auto batch = Encode(kEntries, Grpc::PACKED_CLOCKS);
+  EXPECT_EQ(
+    Utils::ClockFrom(batch.base()), Clock({{0xAA, 1}, {0xBB, 1}, {0xCC, 5}})
+  );
+
+  const auto& clock = batch.entries(2).packed_clock();
+  EXPECT_THAT(clock.positions(), ElementsAre(0, 1, 2));
+  EXPECT_THAT(clock.times(), ElementsAre(2, 0, 0));
+  EXPECT_TRUE(clock.ids().empty());
+}
+
+TEST(GrpcUtils, PackedEntriesDecodeToTheSameEntry)
+{
+  for (const auto& entry : kEntries) {
+    Grpc::Entry proto;
+    Utils::SetEntry(&proto, entry, Grpc::PACKED_CLOCKS);
+    EXPECT_EQ(Utils::EntryFrom(proto), entry);
+  }
+}
+
+TEST(GrpcUtils, PackedBatchesAreSmaller)
+{
+  EXPECT_LT(
+    Encode(kEntries, Grpc::PACKED_CLOCKS).ByteSizeLong(),
+    Encode(kEntries, Grpc::MAP_CLOCKS).ByteSizeLong()
+  );
+}
+
+TEST(GrpcUtils, ClockViewsReadClocksInPlace)
+{
+  const Clock clock = {{0xAA, 2}, {0xBB, 5}};
+  Grpc::PackedClock packed;
+  Utils::SetClock(&packed, clock);
+  google::protobuf::Map<uint64_t, uint64_t> map;
+  Utils::SetClock(&map, clock);
+
+  for (const auto view : {Utils::ClockView(packed), Utils::ClockView(map)}) {
+    EXPECT_EQ(view.size(), 2);
+    EXPECT_EQ(view.at(0xBB), 5);
+    EXPECT_EQ(view.at(0xCC), 0);
+    EXPECT_EQ(
+      view.merge({{0xAA, 3}, {0xCC, 1}}),
+      Clock({{0xAA, 3}, {0xBB, 5}, {0xCC, 1}})
+    );
+  }
+}
+
+TEST(GrpcUtils, EncodedEntriesAreEntryFieldsOnTheWire)
+{
+  for (const auto encoding : {Grpc::MAP_CLOCKS, Grpc::PACKED_CLOCKS}) {
+    Grpc::InsertRequest request;
+    request.set_sender(1);
+    Utils::SetEncoded(request.mutable_entry(), kEntries.back(), encoding);
+
+    Grpc::InsertBatchRequest batch;
+    ASSERT_TRUE(batch.ParseFromString(request.SerializeAsString()));
+    ASSERT_EQ(batch.entries_size(), 1);
+    EXPECT_EQ(Utils::EntryFrom(batch.entries(0)), kEntries.back());
+  }
+}
+
+TEST(GrpcUtils, ForwardedEntriesAreSentAsTheyWereReceived)
+{
+  const auto entry = kEntries.front();
+  const std::string received = "received";
+  std::string bytes;
+  {
+    const Utils::Forwarded forwarded(entry, received, Grpc::PACKED_CLOCKS);
+
+    Utils::SetEncoded(&bytes, entry, Grpc::PACKED_CLOCKS);
+    EXPECT_EQ(bytes, received);
+
+    Utils::SetEncoded(&bytes, entry, Grpc::MAP_CLOCKS);
+    EXPECT_NE(bytes, received);
+
+    Utils::SetEncoded(&bytes, kEntries.back(), Grpc::PACKED_CLOCKS);
+    EXPECT_NE(bytes, received);
+  }
+  Utils::SetEncoded(&bytes, entry, Grpc::PACKED_CLOCKS);
+  EXPECT_NE(bytes, received);
+}
+
+TEST(GrpcUtils, CompressionIsReadFromTheUrl)
+{
+  const auto compression = Utils::CompressionFrom(
+    "grpc://localhost:5000?compression=deflate&compression_min_bytes=1024"
+  );
+  EXPECT_EQ(compression.algorithm, GRPC_COMPRESS_DEFLATE);
+  EXPECT_EQ(compression.threshold, 1024);
+  EXPECT_EQ(
+    Utils::CompressionFrom("grpc://localhost:5000?compression=gzip").algorithm,
+    GRPC_COMPRESS_GZIP
+  );
+  EXPECT_EQ(
+    Utils::CompressionFrom("grpc://localhost:5000"), Utils::Compression{}
+  );
+}
+
+TEST(GrpcUtils, MessagesBelowTheThresholdAreNotCompressed)
+{
+  const Utils::Compression compression{GRPC_COMPRESS_GZIP, 1024};
+  EXPECT_FALSE(compression.compresses(1023));
+  EXPECT_TRUE(compression.compresses(1024));
+  EXPECT_TRUE(compression.options(100).get_no_compression());
+  EXPECT_FALSE(compression.options(2048).get_no_compression());
+  EXPECT_FALSE(Utils::Compression{}.compresses(2048));
+}
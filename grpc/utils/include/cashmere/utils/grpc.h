@@ -17,36 +17,137 @@
 #define CASHMERE_UTILS_GRPCUTILS_H
 
 #include <google/protobuf/map.h>
+#include <google/protobuf/repeated_ptr_field.h>
+#include <grpc/compression.h>
+#include <grpcpp/server_context.h>
+#include <grpcpp/support/sync_stream.h>
+#include <cashmere/brokerbase.h>
 #include <cashmere/cashmere_export.h>
 #include <cashmere/clock.h>
 #include <cashmere/entry.h>
 #include <cashmere/connectioninfo.h>
+#include <cashmere/tracing.h>
+#include <proto/cashmere.pb.h>
 
-namespace Cashmere::Grpc
-{
-class ConnectionInfo;
-class Data;
-class Entry;
-class IdConnectionInfoMap;
-}
+#include <string>
 
 namespace Cashmere::Utils
 {
+// The Set* functions fill messages in place, so the fields they add are
+// allocated on the arena of the message given, if any, and freed with it.
+
+// Latest encoding of the entries, offered by clients on Connect.
+constexpr Grpc::Encoding kLatestEncoding = Grpc::PACKED_CLOCKS;
+
+// Metadata of the calls carrying the TraceContext of their caller.
+constexpr char kTraceMetadata[] = "cashmere-trace";
+
+// Clock read in place from a message, without copying it into a Clock.
+class CASHMERE_EXPORT ClockView
+{
+public:
+  ClockView(const google::protobuf::Map<uint64_t, uint64_t>& clock);
+  ClockView(const Grpc::PackedClock& clock);
+
+  size_t size() const;
+  // Time of the id, 0 if the clock doesn't hold it.
+  Time at(Id id) const;
+  // The given clock merged with this one.
+  Clock merge(Clock clock) const;
+
+private:
+  const google::protobuf::Map<uint64_t, uint64_t>* _map;
+  const Grpc::PackedClock* _packed;
+};
+
+// Entry a runner is handling, along with the bytes it was received as. While
+// in scope, stubs sending an equal entry from the same thread send these
+// bytes as they are instead of encoding the entry again.
+class CASHMERE_EXPORT Forwarded
+{
+public:
+  Forwarded(
+    const Entry& entry, const std::string& bytes, Grpc::Encoding encoding
+  );
+  Forwarded(const Data& data, const std::string& bytes, Grpc::Encoding encoding);
+  ~Forwarded();
+
+  Forwarded(const Forwarded&) = delete;
+  Forwarded& operator=(const Forwarded&) = delete;
+
+  // Bytes the entry was received as, if it is being forwarded by this thread
+  // in an encoding no later than the given one.
+  static const std::string*
+  BytesOf(const Entry& entry, Grpc::Encoding encoding);
+  static const std::string* BytesOf(const Data& data, Grpc::Encoding encoding);
+
+private:
+  const Entry* _entry;
+  const Data* _data;
+  const std::string& _bytes;
+  const Grpc::Encoding _encoding;
+  Forwarded* const _outer;
+};
+
+// Compression of the messages sent, from the `compression` (gzip or deflate)
+// and `compression_min_bytes` options of a url. Messages smaller than the
+// threshold are sent uncompressed.
+struct CASHMERE_EXPORT Compression
+{
+  grpc_compression_algorithm algorithm = GRPC_COMPRESS_NONE;
+  size_t threshold = 0;
+
+  bool compresses(size_t bytes) const;
+  // Options of a streamed message of the given size.
+  ::grpc::WriteOptions options(size_t bytes) const;
+
+  auto operator<=>(const Compression&) const = default;
+};
+
+Compression CASHMERE_EXPORT CompressionFrom(const std::string& url);
 Clock CASHMERE_EXPORT ClockFrom(const ::google::protobuf::Map<uint64_t, uint64_t>& version);
+Clock CASHMERE_EXPORT ClockFrom(const Grpc::PackedClock& clock);
 Data CASHMERE_EXPORT DataFrom(const Grpc::Data& data);
 Entry CASHMERE_EXPORT EntryFrom(const Grpc::Entry& entry);
+Grpc::Encoding CASHMERE_EXPORT EncodingOf(const Grpc::Data& data);
+Grpc::Encoding CASHMERE_EXPORT EncodingOf(const Grpc::Entry& entry);
+EntryList CASHMERE_EXPORT EntriesFrom(
+  const google::protobuf::RepeatedPtrField<Grpc::Entry>& entries,
+  const Grpc::PackedClock& base
+);
 IdConnectionInfoMap CASHMERE_EXPORT IdConnectionInfoMapFrom(
   const google::protobuf::Map<uint64_t, Grpc::ConnectionInfo>& sources
 );
 SourcesMap CASHMERE_EXPORT SourcesFrom(
   const google::protobuf::Map<uint32_t, Grpc::IdConnectionInfoMap>& sources
 );
+PeerLagList CASHMERE_EXPORT
+LagFrom(const google::protobuf::RepeatedPtrField<Grpc::PeerLag>& peers);
+TraceContext CASHMERE_EXPORT
+TraceContextOf(const ::grpc::ServerContextBase& context);
 
 void CASHMERE_EXPORT SetClock(
   google::protobuf::Map<uint64_t, uint64_t>* version, const Clock& data
 );
+void CASHMERE_EXPORT SetClock(Grpc::PackedClock* proto, const Clock& clock);
 void CASHMERE_EXPORT SetData(Grpc::Data* entry, const Data& data);
+void CASHMERE_EXPORT
+SetData(Grpc::Data* proto, const Data& data, Grpc::Encoding encoding);
 void CASHMERE_EXPORT SetEntry(Grpc::Entry* proto, const Entry& entry);
+void CASHMERE_EXPORT
+SetEntry(Grpc::Entry* proto, const Entry& entry, Grpc::Encoding encoding);
+// Encodes the entry into bytes, or copies the bytes it was received as when it
+// is being forwarded.
+void CASHMERE_EXPORT
+SetEncoded(std::string* bytes, const Entry& entry, Grpc::Encoding encoding);
+void CASHMERE_EXPORT
+SetEncoded(std::string* bytes, const Data& data, Grpc::Encoding encoding);
+// Packed clocks of a batch are encoded relative to its base, which is set to
+// the earliest time of each id in the batch.
+void CASHMERE_EXPORT SetEntries(
+  google::protobuf::RepeatedPtrField<Grpc::Entry>* proto,
+  Grpc::PackedClock* base, const EntryList& entries, Grpc::Encoding encoding
+);
 void CASHMERE_EXPORT SetConnectionInfo(Grpc::ConnectionInfo& info, const ConnectionInfo& data);
 void CASHMERE_EXPORT SetConnectionInfo(Grpc::ConnectionInfo* info, const ConnectionInfo& data);
 void CASHMERE_EXPORT SetIdConnectionInfoMap(
@@ -57,6 +158,10 @@ void CASHMERE_EXPORT SetSources(
   google::protobuf::Map<uint32_t, Grpc::IdConnectionInfoMap>* proto,
   const SourcesMap sources
 );
+void CASHMERE_EXPORT SetLag(
+  google::protobuf::RepeatedPtrField<Grpc::PeerLag>* proto,
+  const PeerLagList& peers
+);
 
 }
 
@@ -14,7 +14,9 @@
 // You should have received a copy of the GNU Affero General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "cashmere/utils/grpc.h"
+#include "cashmere/utils/url.h"
 
+#include <google/protobuf/arena.h>
 #include <google/protobuf/empty.pb.h>
 #include <grpcpp/create_channel.h>
 #include <proto/cashmere.grpc.pb.h>
@@ -22,9 +24,211 @@
 #include <grpc/grpc.h>
 #include <grpcpp/server_builder.h>
 
+#include <algorithm>
+#include <chrono>
+#include <utility>
+#include <vector>
+
 namespace Cashmere::Utils
 {
 
+namespace
+{
+
+// Innermost entry forwarded by the runner handling a call on this thread.
+thread_local Forwarded* tForwarded = nullptr;
+
+// Ids and times of a base clock, by position.
+using Base = std::vector<std::pair<Id, Time>>;
+
+Base BaseFrom(const Grpc::PackedClock& base)
+{
+  Base out;
+  const auto size = std::min(base.ids_size(), base.times_size());
+  out.reserve(size);
+  for (int i = 0; i < size; ++i) {
+    out.emplace_back(base.ids(i), base.times(i));
+  }
+  return out;
+}
+
+Clock ClockFrom(const Grpc::PackedClock& clock, const Base& base)
+{
+  Clock out;
+  const auto size = std::min(clock.positions_size(), clock.times_size());
+  for (int i = 0; i < size; ++i) {
+    const auto position = clock.positions(i);
+    if (position < base.size()) {
+      const auto& [id, time] = base[position];
+      out.emplace_hint(out.end(), id, time + clock.times(i));
+    }
+  }
+  return out;
+}
+
+// Clocks are ordered by id, and the base holds every id of the clock.
+void SetClock(Grpc::PackedClock* proto, const Clock& clock, const Clock& base)
+{
+  proto->mutable_positions()->Reserve(clock.size());
+  proto->mutable_times()->Reserve(clock.size());
+  auto it = base.cbegin();
+  uint32_t position = 0;
+  for (const auto& [id, time] : clock) {
+    for (; it->first != id; ++it) {
+      ++position;
+    }
+    proto->add_positions(position);
+    proto->add_times(time - it->second);
+  }
+}
+
+void SetPackedData(Grpc::Data* proto, const Data& data)
+{
+  proto->set_id(data.id);
+  proto->set_value(data.value);
+  if (!data.alters.empty()) {
+    Utils::SetClock(proto->mutable_packed_alters(), data.alters);
+  }
+}
+
+}
+
+ClockView::ClockView(const google::protobuf::Map<uint64_t, uint64_t>& clock)
+  : _map(&clock)
+  , _packed(nullptr)
+{
+}
+
+ClockView::ClockView(const Grpc::PackedClock& clock)
+  : _map(nullptr)
+  , _packed(&clock)
+{
+}
+
+size_t ClockView::size() const
+{
+  if (_map) {
+    return _map->size();
+  }
+  return std::min(_packed->ids_size(), _packed->times_size());
+}
+
+Time ClockView::at(Id id) const
+{
+  if (_map) {
+    const auto it = _map->find(id);
+    return it == _map->cend() ? 0 : it->second;
+  }
+  const auto size = static_cast<int>(this->size());
+  for (int i = 0; i < size; ++i) {
+    if (_packed->ids(i) == id) {
+      return _packed->times(i);
+    }
+  }
+  return 0;
+}
+
+Clock ClockView::merge(Clock clock) const
+{
+  auto update = [&clock](Id id, Time time) {
+    const auto [it, added] = clock.emplace(id, time);
+    if (!added && it->second < time) {
+      it->second = time;
+    }
+  };
+  if (_map) {
+    for (const auto& [id, time] : *_map) {
+      update(id, time);
+    }
+    return clock;
+  }
+  const auto size = static_cast<int>(this->size());
+  for (int i = 0; i < size; ++i) {
+    update(_packed->ids(i), _packed->times(i));
+  }
+  return clock;
+}
+
+Forwarded::Forwarded(
+  const Entry& entry, const std::string& bytes, Grpc::Encoding encoding
+)
+  : _entry(&entry)
+  , _data(nullptr)
+  , _bytes(bytes)
+  , _encoding(encoding)
+  , _outer(std::exchange(tForwarded, this))
+{
+}
+
+Forwarded::Forwarded(
+  const Data& data, const std::string& bytes, Grpc::Encoding encoding
+)
+  : _entry(nullptr)
+  , _data(&data)
+  , _bytes(bytes)
+  , _encoding(encoding)
+  , _outer(std::exchange(tForwarded, this))
+{
+}
+
+Forwarded::~Forwarded()
+{
+  tForwarded = _outer;
+}
+
+const std::string*
+Forwarded::BytesOf(const Entry& entry, Grpc::Encoding encoding)
+{
+  for (auto it = tForwarded; it; it = it->_outer) {
+    if (it->_entry && it->_encoding <= encoding && *it->_entry == entry) {
+      return &it->_bytes;
+    }
+  }
+  return nullptr;
+}
+
+const std::string* Forwarded::BytesOf(const Data& data, Grpc::Encoding encoding)
+{
+  for (auto it = tForwarded; it; it = it->_outer) {
+    if (it->_data && it->_encoding <= encoding && *it->_data == data) {
+      return &it->_bytes;
+    }
+  }
+  return nullptr;
+}
+
+bool Compression::compresses(size_t bytes) const
+{
+  return algorithm != GRPC_COMPRESS_NONE && bytes >= threshold;
+}
+
+::grpc::WriteOptions Compression::options(size_t bytes) const
+{
+  ::grpc::WriteOptions out;
+  if (!compresses(bytes)) {
+    out.set_no_compression();
+  }
+  return out;
+}
+
+Compression CompressionFrom(const std::string& url)
+{
+  const Url parsed = ParseUrl(url);
+  Compression out;
+  const auto name = parsed.option("compression");
+  if (name == "gzip") {
+    out.algorithm = GRPC_COMPRESS_GZIP;
+  } else if (name == "deflate") {
+    out.algorithm = GRPC_COMPRESS_DEFLATE;
+  }
+  try {
+    out.threshold = std::stoul(parsed.option("compression_min_bytes", "0"));
+  } catch (const std::exception&) {
+    return {};
+  }
+  return out;
+}
+
 Clock ClockFrom(const ::google::protobuf::Map<uint64_t, uint64_t>& version)
 {
   Clock out;
@@ -34,23 +238,65 @@ Clock ClockFrom(const ::google::protobuf::Map<uint64_t, uint64_t>& version)
   return out;
 }
 
+Clock ClockFrom(const Grpc::PackedClock& clock)
+{
+  Clock out;
+  const auto size = std::min(clock.ids_size(), clock.times_size());
+  for (int i = 0; i < size; ++i) {
+    out.emplace_hint(out.end(), clock.ids(i), clock.times(i));
+  }
+  return out;
+}
+
 Data DataFrom(const Grpc::Data& data)
 {
   Data out;
   out.id = data.id();
   out.value = data.value();
-  out.alters = ClockFrom(data.alters());
+  out.alters = data.has_packed_alters() ? ClockFrom(data.packed_alters())
+                                        : ClockFrom(data.alters());
   return out;
 }
 
+Grpc::Encoding EncodingOf(const Grpc::Data& data)
+{
+  return data.has_packed_alters() ? Grpc::PACKED_CLOCKS : Grpc::MAP_CLOCKS;
+}
+
+Grpc::Encoding EncodingOf(const Grpc::Entry& entry)
+{
+  return entry.has_packed_clock() ? Grpc::PACKED_CLOCKS
+                                  : EncodingOf(entry.data());
+}
+
 Entry EntryFrom(const Grpc::Entry& entry)
 {
   Entry out;
-  out.clock = ClockFrom(entry.clock());
+  out.clock = entry.has_packed_clock() ? ClockFrom(entry.packed_clock())
+                                       : ClockFrom(entry.clock());
   out.entry = DataFrom(entry.data());
   return out;
 }
 
+EntryList EntriesFrom(
+  const google::protobuf::RepeatedPtrField<Grpc::Entry>& entries,
+  const Grpc::PackedClock& base
+)
+{
+  const auto positions = BaseFrom(base);
+  EntryList out;
+  for (const auto& entry : entries) {
+    if (entry.packed_clock().positions_size() == 0) {
+      out.push_back(EntryFrom(entry));
+      continue;
+    }
+    out.push_back(
+      {ClockFrom(entry.packed_clock(), positions), DataFrom(entry.data())}
+    );
+  }
+  return out;
+}
+
 IdConnectionInfoMap IdConnectionInfoMapFrom(
   const google::protobuf::Map<uint64_t, Grpc::ConnectionInfo>& sources
 )
@@ -76,6 +322,31 @@ SourcesMap SourcesFrom(
   return out;
 }
 
+PeerLagList
+LagFrom(const google::protobuf::RepeatedPtrField<Grpc::PeerLag>& peers)
+{
+  PeerLagList out;
+  out.reserve(peers.size());
+  for (const auto& peer : peers) {
+    const std::chrono::milliseconds progress(peer.progress());
+    out.push_back(
+      {static_cast<Source>(peer.port()), peer.id(), peer.behind(),
+       std::chrono::system_clock::time_point(progress)}
+    );
+  }
+  return out;
+}
+
+TraceContext TraceContextOf(const ::grpc::ServerContextBase& context)
+{
+  const auto& metadata = context.client_metadata();
+  const auto it = metadata.find(kTraceMetadata);
+  if (it == metadata.cend()) {
+    return {};
+  }
+  return TraceContext::From(std::string(it->second.data(), it->second.size()));
+}
+
 void SetClock(
   ::google::protobuf::Map<uint64_t, uint64_t>* version, const Clock& data
 )
@@ -85,6 +356,16 @@ void SetClock(
   }
 }
 
+void SetClock(Grpc::PackedClock* proto, const Clock& clock)
+{
+  proto->mutable_ids()->Reserve(clock.size());
+  proto->mutable_times()->Reserve(clock.size());
+  for (const auto& [id, time] : clock) {
+    proto->add_ids(id);
+    proto->add_times(time);
+  }
+}
+
 void SetData(Grpc::Data* entry, const Data& data)
 {
   entry->set_id(data.id);
@@ -98,6 +379,79 @@ void SetEntry(Grpc::Entry* entry, const Entry& data)
   SetData(entry->mutable_data(), data.entry);
 }
 
+void SetData(Grpc::Data* proto, const Data& data, Grpc::Encoding encoding)
+{
+  if (encoding != Grpc::PACKED_CLOCKS) {
+    SetData(proto, data);
+    return;
+  }
+  SetPackedData(proto, data);
+}
+
+void SetEntry(Grpc::Entry* proto, const Entry& entry, Grpc::Encoding encoding)
+{
+  if (encoding != Grpc::PACKED_CLOCKS) {
+    SetEntry(proto, entry);
+    return;
+  }
+  SetClock(proto->mutable_packed_clock(), entry.clock);
+  SetPackedData(proto->mutable_data(), entry.entry);
+}
+
+void SetEncoded(std::string* bytes, const Entry& entry, Grpc::Encoding encoding)
+{
+  if (const auto forwarded = Forwarded::BytesOf(entry, encoding)) {
+    *bytes = *forwarded;
+    return;
+  }
+  google::protobuf::Arena arena;
+  auto proto = google::protobuf::Arena::CreateMessage<Grpc::Entry>(&arena);
+  SetEntry(proto, entry, encoding);
+  proto->SerializeToString(bytes);
+}
+
+void SetEncoded(std::string* bytes, const Data& data, Grpc::Encoding encoding)
+{
+  if (const auto forwarded = Forwarded::BytesOf(data, encoding)) {
+    *bytes = *forwarded;
+    return;
+  }
+  google::protobuf::Arena arena;
+  auto proto = google::protobuf::Arena::CreateMessage<Grpc::Data>(&arena);
+  SetData(proto, data, encoding);
+  proto->SerializeToString(bytes);
+}
+
+void SetEntries(
+  google::protobuf::RepeatedPtrField<Grpc::Entry>* proto,
+  Grpc::PackedClock* base, const EntryList& entries, Grpc::Encoding encoding
+)
+{
+  proto->Reserve(entries.size());
+  if (encoding != Grpc::PACKED_CLOCKS) {
+    for (const auto& entry : entries) {
+      SetEntry(proto->Add(), entry);
+    }
+    return;
+  }
+
+  Clock earliest;
+  for (const auto& entry : entries) {
+    for (const auto& [id, time] : entry.clock) {
+      const auto [it, added] = earliest.emplace(id, time);
+      if (!added) {
+        it->second = std::min(it->second, time);
+      }
+    }
+  }
+  SetClock(base, earliest);
+  for (const auto& entry : entries) {
+    auto out = proto->Add();
+    SetClock(out->mutable_packed_clock(), entry.clock, earliest);
+    SetPackedData(out->mutable_data(), entry.entry);
+  }
+}
+
 void SetConnectionInfo(Grpc::ConnectionInfo& info, const ConnectionInfo& data)
 {
   info.set_distance(data.distance);
@@ -137,4 +491,24 @@ void SetSources(
   }
 }
 
+void SetLag(
+  google::protobuf::RepeatedPtrField<Grpc::PeerLag>* proto,
+  const PeerLagList& peers
+)
+{
+  proto->Reserve(peers.size());
+  for (const auto& peer : peers) {
+    auto* out = proto->Add();
+    out->set_port(peer.port);
+    out->set_id(peer.id);
+    out->set_behind(peer.behind);
+    out->set_progress(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+        peer.progress.time_since_epoch()
+      )
+        .count()
+    );
+  }
+}
+
 }
@@ -25,6 +25,7 @@ static const std::unordered_map<std::string, Command::Type> kNameTypeMap = {
   {"add", Command::Type::Append},
   {"relay", Command::Type::Relay},
   {"sources", Command::Type::Sources},
+  {"versions", Command::Type::Versions},
   {"list", Command::Type::ListCommands},
   {"quit", Command::Type::Quit}
 };
@@ -36,6 +37,7 @@ static const std::unordered_map<Command::Type, std::string> kTypeNameMap = {
   {Command::Type::Append, "add"},
   {Command::Type::Relay, "relay"},
   {Command::Type::Sources, "sources"},
+  {Command::Type::Versions, "versions"},
   {Command::Type::ListCommands, "list"},
   {Command::Type::Quit, "quit"}
 };
@@ -46,6 +46,7 @@ void RunService(const Options& options);
 void RunCommand(const Options& options);
 
 void PrintCommands();
+void PrintLag(const PeerLagList& peers);
 
 int main(int argc, char* argv[])
 {
@@ -94,6 +95,7 @@ void RunCommand(const Options& options)
       std::cout << stub->sources(0) << std::endl;
       break;
     case Command::Type::Versions:
+      PrintLag(stub->lag());
       break;
     case Command::Type::ListCommands:
       PrintCommands();
@@ -149,6 +151,7 @@ void RunService(const Options& options)
         break;
       case Command::Type::Versions:
         std::cout << journal->versions() << std::endl;
+        PrintLag(journal->lag());
         break;
       case Command::Type::ListCommands:
         PrintCommands();
@@ -188,6 +191,7 @@ void PrintCommands()
     {"relay <id> <value> [<version>]",
      "Relay an addition to another instance: 'relay aaff 10'"},
     {"sources", "Print this instance data sources."},
+    {"versions", "Print how far behind this instance each peer is."},
     {"list", "List commands."},
     {"quit", "Quit the instance."}
   };
@@ -198,6 +202,19 @@ void PrintCommands()
   std::cout << std::endl;
 }
 
+void PrintLag(const PeerLagList& peers)
+{
+  const auto now = std::chrono::system_clock::now();
+  for (const auto& peer : peers) {
+    const auto idle =
+      std::chrono::duration_cast<std::chrono::seconds>(now - peer.progress);
+    std::println(
+      "  {: <6}{: <18x}{} behind, progress {}s ago", peer.port, peer.id,
+      peer.behind, idle.count()
+    );
+  }
+}
+
 namespace fs = std::filesystem;
 
 namespace
@@ -66,3 +66,11 @@ TEST(Command, ConnectReadsAaUrl)
   EXPECT_EQ(cmd.type, Command::Type::Connect);
   ASSERT_EQ(cmd.url, url);
 }
+
+TEST(Command, VersionsIsRead)
+{
+  std::stringstream ss("versions");
+  Command cmd = Command::Read(ss);
+  EXPECT_EQ(cmd.type, Command::Type::Versions);
+  EXPECT_EQ(cmd.name(), "versions");
+}